@@ -131,6 +131,13 @@
 #define driver_start_write_blocks       ATPASTE2(driver, _start_write_blocks)
 #define driver_wait_end_of_write_blocks ATPASTE2(driver, _wait_end_of_write_blocks)
 
+// In SPI mode the data phase of block transfers can be done with PDC
+// (define SD_MMC_SPI_PDC in conf_sd_mmc.h). The commands stay in the SPI driver.
+#if (defined SD_MMC_SPI_MODE) && (defined SD_MMC_SPI_PDC)
+#  include "pdc.h"
+#  define SD_MMC_USE_SPI_PDC
+#endif
+
 
 #if (!defined SD_MMC_0_CD_GPIO) || (!defined SD_MMC_0_CD_DETECT_VALUE)
 #  warning No pin for card detection has been defined in board.h. \
@@ -335,6 +342,53 @@ static inline void SD_MMC_STOP_TIMEOUT(void)
 #endif
 //! @}
 
+//! \name Time based timeouts of busy and token waits
+//! The SD specification limits the read access time to 100ms and the
+//! write busy time to 250ms (SDSC/SDHC) or 500ms (SDXC).
+//! @{
+#ifndef SD_MMC_READ_TIMEOUT_MS
+#  define SD_MMC_READ_TIMEOUT_MS    100
+#endif
+#ifndef SD_MMC_BUSY_TIMEOUT_MS
+#  define SD_MMC_BUSY_TIMEOUT_MS    500
+#endif
+
+typedef struct {
+	uint32_t start;
+	uint32_t limit;
+} sd_mmc_timeout_t;
+
+#if (defined __CORTEX_M) && (__CORTEX_M >= 3)
+// DWT cycle counter: independent of the clock speed and the optimisation
+// level and does not touch SysTick (FreeRTOS, SD_MMC_START_TIMEOUT).
+static inline void sd_mmc_timeout_start(sd_mmc_timeout_t *timeout, uint32_t ms)
+{
+	CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+	DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+	timeout->start = DWT->CYCCNT;
+	timeout->limit = ms * (sysclk_get_cpu_hz() / 1000);
+}
+
+static inline bool sd_mmc_timeout_is_elapsed(sd_mmc_timeout_t *timeout)
+{
+	return (DWT->CYCCNT - timeout->start) >= timeout->limit;
+}
+#else
+// No cycle counter (XMEGA, UC3, Cortex-M0): poll with 10us steps instead
+static inline void sd_mmc_timeout_start(sd_mmc_timeout_t *timeout, uint32_t ms)
+{
+	timeout->start = 0;
+	timeout->limit = ms * 100;
+}
+
+static inline bool sd_mmc_timeout_is_elapsed(sd_mmc_timeout_t *timeout)
+{
+	delay_us(10);
+	return ++timeout->start >= timeout->limit;
+}
+#endif
+//! @}
+
 /**
  * \brief Sends operation condition command and read OCR (SPI only)
  * - CMD1 sends operation condition command
@@ -1119,14 +1173,13 @@ static void sd_decode_csd(void)
  */
 static bool sd_mmc_cmd13(void)
 {
-	uint32_t nec_timeout;
+	sd_mmc_timeout_t timeout;
 
 	/* Wait for data ready status.
 	 * Nec timing: 0 to unlimited
-	 * However a timeout is used.
-	 * 200 000 * 8 cycles
+	 * However a timeout is used (write busy time of the SD specification).
 	 */
-	nec_timeout = 200000;
+	sd_mmc_timeout_start(&timeout, SD_MMC_BUSY_TIMEOUT_MS);
 	do {
 		if (sd_mmc_is_spi()) {
 			if (!driver_send_cmd(SDMMC_SPI_CMD13_SEND_STATUS, 0)) {
@@ -1146,7 +1199,7 @@ static bool sd_mmc_cmd13(void)
 				break;
 			}
 		}
-		if (nec_timeout-- == 0) {
+		if (sd_mmc_timeout_is_elapsed(&timeout)) {
 			sd_mmc_debug("%s: CMD13 Busy timeout\n\r", __func__);
 			return false;
 		}
@@ -1746,6 +1799,199 @@ static bool sd_mmc_mci_install_mmc(void)
 	return false;
 }
 
+#ifdef SD_MMC_USE_SPI_PDC
+//! \name Data phase of block transfers in SPI mode with PDC
+//! The data blocks are moved by PDC at full SPI clock rate instead of polled
+//! byte transfers. Tokens, CRC and data response are still polled.
+//! @{
+
+//! Start token of a read block and of a single block write
+#define SD_MMC_SPI_PDC_TOKEN_SINGLE_MULTI_READ 0xFE
+#define SD_MMC_SPI_PDC_TOKEN_SINGLE_WRITE      0xFE
+//! Start token of a block written with CMD25
+#define SD_MMC_SPI_PDC_TOKEN_MULTI_WRITE       0xFC
+//! Stop token of CMD25
+#define SD_MMC_SPI_PDC_TOKEN_STOP_TRAN         0xFD
+//! Data response token
+#define SD_MMC_SPI_PDC_DATA_RESP_MASK          0x1F
+#define SD_MMC_SPI_PDC_DATA_RESP_ACCEPTED      0x05
+//! Data error token is 0000xxxx
+#define SD_MMC_SPI_PDC_DATA_ERROR_VALID(token) (((token) & 0xF0) == 0)
+
+/**
+ * \brief Exchange a buffer with the card through PDC
+ *
+ * \param rx    Buffer for the received data, NULL to drop it
+ * \param tx    Data to send, NULL to send 0xFF
+ * \param size  Number of bytes
+ */
+static void sd_mmc_spi_pdc_transfer(uint8_t *rx, const uint8_t *tx, uint16_t size)
+{
+	Pdc *p_pdc = spi_get_pdc_base(SD_MMC_SPI);
+	pdc_packet_t rx_packet;
+	pdc_packet_t tx_packet;
+
+	if (tx == NULL) {
+		// RX always trails TX, so the destination can be used as 0xFF source
+		memset(rx, 0xFF, size);
+		tx = rx;
+	}
+
+	tx_packet.ul_addr = (uint32_t)tx;
+	tx_packet.ul_size = size;
+	pdc_tx_init(p_pdc, &tx_packet, NULL);
+
+	if (rx != NULL) {
+		rx_packet.ul_addr = (uint32_t)rx;
+		rx_packet.ul_size = size;
+		pdc_rx_init(p_pdc, &rx_packet, NULL);
+		pdc_enable_transfer(p_pdc, PERIPH_PTCR_RXTEN | PERIPH_PTCR_TXTEN);
+		while (!(spi_read_status(SD_MMC_SPI) & SPI_SR_RXBUFF)) {
+		}
+	} else {
+		pdc_enable_transfer(p_pdc, PERIPH_PTCR_TXTEN);
+		while ((spi_read_status(SD_MMC_SPI) & (SPI_SR_TXBUFE | SPI_SR_TXEMPTY))
+				!= (SPI_SR_TXBUFE | SPI_SR_TXEMPTY)) {
+		}
+		// Drop last received byte and overrun flag
+		(void)SD_MMC_SPI->SPI_RDR;
+		(void)spi_read_status(SD_MMC_SPI);
+	}
+
+	pdc_disable_transfer(p_pdc, PERIPH_PTCR_RXTDIS | PERIPH_PTCR_TXTDIS);
+}
+
+/**
+ * \brief Wait the end of busy on DAT0 line (SPI mode)
+ *
+ * \return true if success, otherwise false
+ */
+static bool sd_mmc_spi_pdc_wait_busy(void)
+{
+	uint8_t line = 0xFF;
+	sd_mmc_timeout_t timeout;
+
+	// Delay before check busy (Nbr = 1 byte)
+	spi_read_packet(SD_MMC_SPI, &line, 1);
+
+	sd_mmc_timeout_start(&timeout, SD_MMC_BUSY_TIMEOUT_MS);
+	do {
+		spi_read_packet(SD_MMC_SPI, &line, 1);
+		if ((line != 0xFF) && sd_mmc_timeout_is_elapsed(&timeout)) {
+			sd_mmc_debug("%s: Busy timeout\n\r", __func__);
+			return false;
+		}
+	} while (line != 0xFF);
+	return true;
+}
+
+/**
+ * \brief Read blocks of the current CMD17/CMD18 transfer
+ *
+ * \param dest      Pointer on buffer to fill
+ * \param nb_block  Number of blocks to read
+ *
+ * \return true if success, otherwise false
+ */
+static bool sd_mmc_spi_pdc_start_read_blocks(void *dest, uint16_t nb_block)
+{
+	uint8_t *ptr = dest;
+	uint8_t token;
+	uint8_t crc[2];
+	sd_mmc_timeout_t timeout;
+
+	while (nb_block--) {
+		// Wait start token, the card sends 0xFF until the data is ready (Nac)
+		sd_mmc_timeout_start(&timeout, SD_MMC_READ_TIMEOUT_MS);
+		do {
+			if (sd_mmc_timeout_is_elapsed(&timeout)) {
+				sd_mmc_debug("%s: Read blocks timeout\n\r", __func__);
+				return false;
+			}
+			spi_read_packet(SD_MMC_SPI, &token, 1);
+			if (SD_MMC_SPI_PDC_DATA_ERROR_VALID(token)) {
+				sd_mmc_debug("%s: Read blocks error token 0x%02x\n\r", __func__, token);
+				return false;
+			}
+		} while (token != SD_MMC_SPI_PDC_TOKEN_SINGLE_MULTI_READ);
+
+		sd_mmc_spi_pdc_transfer(ptr, NULL, SD_MMC_BLOCK_SIZE);
+
+		// CRC is not used in SPI mode
+		spi_read_packet(SD_MMC_SPI, crc, 2);
+
+		ptr += SD_MMC_BLOCK_SIZE;
+	}
+	return true;
+}
+
+/**
+ * \brief Write blocks of the current CMD24/CMD25 transfer
+ *
+ * \param src       Pointer on buffer to send
+ * \param nb_block  Number of blocks to write
+ *
+ * \return true if success, otherwise false
+ */
+static bool sd_mmc_spi_pdc_start_write_blocks(const void *src, uint16_t nb_block)
+{
+	const uint8_t *ptr = src;
+	uint8_t header[2];
+	uint8_t crc[2] = {0xFF, 0xFF};
+	uint8_t resp;
+
+	while (nb_block--) {
+		// Card programs the previous block
+		if (!sd_mmc_spi_pdc_wait_busy()) {
+			return false;
+		}
+
+		// One byte gap (Nwr) and start token
+		header[0] = 0xFF;
+		header[1] = (sd_mmc_nb_block_to_tranfer > 1) ?
+				SD_MMC_SPI_PDC_TOKEN_MULTI_WRITE : SD_MMC_SPI_PDC_TOKEN_SINGLE_WRITE;
+		spi_write_packet(SD_MMC_SPI, header, 2);
+
+		sd_mmc_spi_pdc_transfer(NULL, ptr, SD_MMC_BLOCK_SIZE);
+
+		// CRC is not used in SPI mode, then the card sends the data response
+		spi_write_packet(SD_MMC_SPI, crc, 2);
+		spi_read_packet(SD_MMC_SPI, &resp, 1);
+		if ((resp & SD_MMC_SPI_PDC_DATA_RESP_MASK) != SD_MMC_SPI_PDC_DATA_RESP_ACCEPTED) {
+			sd_mmc_debug("%s: Write blocks data response 0x%02x\n\r", __func__, resp);
+			return false;
+		}
+
+		ptr += SD_MMC_BLOCK_SIZE;
+	}
+	return true;
+}
+
+/**
+ * \brief Wait the end of the current CMD24/CMD25 transfer
+ * (last block programmed and stop token sent for CMD25)
+ *
+ * \return true if success, otherwise false
+ */
+static bool sd_mmc_spi_pdc_wait_end_of_write_blocks(void)
+{
+	uint8_t token = SD_MMC_SPI_PDC_TOKEN_STOP_TRAN;
+
+	if (sd_mmc_nb_block_remaining) {
+		return true;
+	}
+	if (!sd_mmc_spi_pdc_wait_busy()) {
+		return false;
+	}
+	if (sd_mmc_nb_block_to_tranfer == 1) {
+		return true;
+	}
+	spi_write_packet(SD_MMC_SPI, &token, 1);
+	return sd_mmc_spi_pdc_wait_busy();
+}
+//! @}
+#endif // SD_MMC_USE_SPI_PDC
+
 //-------------------------------------------------------------------
 //--------------------- PUBLIC FUNCTIONS ----------------------------
 
@@ -1900,7 +2146,11 @@ sd_mmc_err_t sd_mmc_start_read_blocks(void *dest, uint16_t nb_block)
 {
 	Assert(sd_mmc_nb_block_remaining >= nb_block);
 
+#ifdef SD_MMC_USE_SPI_PDC
+	if (!sd_mmc_spi_pdc_start_read_blocks(dest, nb_block)) {
+#else
 	if (!driver_start_read_blocks(dest, nb_block)) {
+#endif
 		sd_mmc_nb_block_remaining = 0;
 		return SD_MMC_ERR_COMM;
 	}
@@ -1910,9 +2160,11 @@ sd_mmc_err_t sd_mmc_start_read_blocks(void *dest, uint16_t nb_block)
 
 sd_mmc_err_t sd_mmc_wait_end_of_read_blocks(bool abort)
 {
+#ifndef SD_MMC_USE_SPI_PDC
 	if (!driver_wait_end_of_read_blocks()) {
 		return SD_MMC_ERR_COMM;
 	}
+#endif
 	if (abort) {
 		sd_mmc_nb_block_remaining = 0;
 	} else if (sd_mmc_nb_block_remaining) {
@@ -1986,7 +2238,11 @@ sd_mmc_err_t sd_mmc_init_write_blocks(uint8_t slot, uint32_t start,
 sd_mmc_err_t sd_mmc_start_write_blocks(const void *src, uint16_t nb_block)
 {
 	Assert(sd_mmc_nb_block_remaining >= nb_block);
+#ifdef SD_MMC_USE_SPI_PDC
+	if (!sd_mmc_spi_pdc_start_write_blocks(src, nb_block)) {
+#else
 	if (!driver_start_write_blocks(src, nb_block)) {
+#endif
 		sd_mmc_nb_block_remaining = 0;
 		return SD_MMC_ERR_COMM;
 	}
@@ -1996,9 +2252,19 @@ sd_mmc_err_t sd_mmc_start_write_blocks(const void *src, uint16_t nb_block)
 
 sd_mmc_err_t sd_mmc_wait_end_of_write_blocks(bool abort)
 {
+#ifdef SD_MMC_USE_SPI_PDC
+	if (abort) {
+		sd_mmc_nb_block_remaining = 0;
+	}
+	if (!sd_mmc_spi_pdc_wait_end_of_write_blocks()) {
+		sd_mmc_deselect_slot();
+		return SD_MMC_ERR_COMM;
+	}
+#else
 	if (!driver_wait_end_of_write_blocks()) {
 		return SD_MMC_ERR_COMM;
 	}
+#endif
 	if (abort) {
 		sd_mmc_nb_block_remaining = 0;
 	} else if (sd_mmc_nb_block_remaining) {
@@ -2024,6 +2290,42 @@ sd_mmc_err_t sd_mmc_wait_end_of_write_blocks(bool abort)
 	return SD_MMC_OK;
 }
 
+sd_mmc_err_t sd_mmc_read_blocks(uint8_t slot, uint32_t start, void *dest,
+		uint16_t nb_block)
+{
+	sd_mmc_err_t sd_mmc_err;
+
+	// One CMD17/CMD18 for all blocks
+	sd_mmc_err = sd_mmc_init_read_blocks(slot, start, nb_block);
+	if (sd_mmc_err != SD_MMC_OK) {
+		return sd_mmc_err;
+	}
+	sd_mmc_err = sd_mmc_start_read_blocks(dest, nb_block);
+	if (sd_mmc_err != SD_MMC_OK) {
+		sd_mmc_wait_end_of_read_blocks(true);
+		return sd_mmc_err;
+	}
+	return sd_mmc_wait_end_of_read_blocks(false);
+}
+
+sd_mmc_err_t sd_mmc_write_blocks(uint8_t slot, uint32_t start, const void *src,
+		uint16_t nb_block)
+{
+	sd_mmc_err_t sd_mmc_err;
+
+	// One CMD24/CMD25 for all blocks
+	sd_mmc_err = sd_mmc_init_write_blocks(slot, start, nb_block);
+	if (sd_mmc_err != SD_MMC_OK) {
+		return sd_mmc_err;
+	}
+	sd_mmc_err = sd_mmc_start_write_blocks(src, nb_block);
+	if (sd_mmc_err != SD_MMC_OK) {
+		sd_mmc_wait_end_of_write_blocks(true);
+		return sd_mmc_err;
+	}
+	return sd_mmc_wait_end_of_write_blocks(false);
+}
+
 #ifdef SDIO_SUPPORT_ENABLE
 sd_mmc_err_t sdio_read_direct(uint8_t slot, uint8_t func_num, uint32_t addr,
 		uint8_t *dest)
@@ -53,6 +53,103 @@
 
 static bool stdio_usb_interface_enable = false;
 
+#ifdef STDIO_USB_BUFFERED
+#include "interrupt.h"
+
+/* Output is collected in a ring buffer and moved to the CDC endpoint in
+ * packet sized chunks by stdio_usb_flush, which has to be called from the
+ * UDC_SOF_EVENT and UDI_CDC_TX_EMPTY_NOTIFY callbacks (see conf_usb.h).
+ * putchar never waits for the host. If the buffer is full the new byte is
+ * dropped, or with STDIO_USB_DROP_OLDEST the oldest byte is overwritten.
+ * Bytes written while the CDC interface is disabled are dropped too.
+ */
+#ifndef STDIO_USB_BUFFER_SIZE
+#define STDIO_USB_BUFFER_SIZE 1024 // has to be power of 2
+#endif
+
+#if (STDIO_USB_BUFFER_SIZE & (STDIO_USB_BUFFER_SIZE - 1)) != 0
+#error "STDIO_USB_BUFFER_SIZE has to be a power of 2"
+#endif
+
+#define STDIO_USB_BUFFER_MASK (STDIO_USB_BUFFER_SIZE - 1)
+
+static uint8_t stdio_usb_buffer[STDIO_USB_BUFFER_SIZE];
+static volatile uint16_t stdio_usb_start = 0;
+static volatile uint16_t stdio_usb_end = 0;
+static volatile uint32_t stdio_usb_dropped = 0;
+
+int stdio_usb_putchar (volatile void * unused, char data)
+{
+	irqflags_t flags;
+	uint16_t end_next;
+
+	flags = cpu_irq_save();
+	if (!stdio_usb_interface_enable) {
+		/* Nobody is listening (CDC interface disabled), count it as dropped */
+		stdio_usb_dropped++;
+		cpu_irq_restore(flags);
+		return 0;  // -1
+	}
+
+	end_next = (stdio_usb_end + 1) & STDIO_USB_BUFFER_MASK;
+	if (end_next == stdio_usb_start) {
+		stdio_usb_dropped++;
+#ifdef STDIO_USB_DROP_OLDEST
+		stdio_usb_start = (stdio_usb_start + 1) & STDIO_USB_BUFFER_MASK;
+#else
+		cpu_irq_restore(flags);
+		return 0;
+#endif
+	}
+	stdio_usb_buffer[stdio_usb_end] = data;
+	stdio_usb_end = end_next;
+	cpu_irq_restore(flags);
+
+	return 0;
+}
+
+void stdio_usb_flush(void)
+{
+	irqflags_t flags;
+	iram_size_t length;
+	iram_size_t free;
+
+	if (!stdio_usb_interface_enable) {
+		return;
+	}
+
+	flags = cpu_irq_save();
+	while (stdio_usb_start != stdio_usb_end) {
+		free = udi_cdc_get_free_tx_buffer();
+		if (free == 0) {
+			break;
+		}
+
+		/* Contiguous part up to the end of the ring */
+		if (stdio_usb_end > stdio_usb_start) {
+			length = stdio_usb_end - stdio_usb_start;
+		} else {
+			length = STDIO_USB_BUFFER_SIZE - stdio_usb_start;
+		}
+		if (length > free) {
+			length = free;
+		}
+
+		/* Returns the number of bytes that were not written */
+		length -= udi_cdc_write_buf(&stdio_usb_buffer[stdio_usb_start], length);
+		if (length == 0) {
+			break;
+		}
+		stdio_usb_start = (stdio_usb_start + length) & STDIO_USB_BUFFER_MASK;
+	}
+	cpu_irq_restore(flags);
+}
+
+uint32_t stdio_usb_get_dropped(void)
+{
+	return stdio_usb_dropped;
+}
+#else
 int stdio_usb_putchar (volatile void * unused, char data)
 {
 	if(!udi_cdc_is_tx_ready()) {
@@ -71,6 +168,7 @@ int stdio_usb_putchar (volatile void * unused, char data)
 	udi_cdc_putc(data);
 	return 0;
 }
+#endif
 
 void stdio_usb_getchar (void volatile * unused, char *data)
 {
@@ -46,6 +46,12 @@
 
 #include "twi.h"
 
+#ifdef TWI_ASYNC_ENABLE
+#include "pdc.h"
+#include "interrupt.h"
+#include "sysclk.h"
+#endif
+
 /// @cond 0
 /**INDENT-OFF**/
 #ifdef __cplusplus
@@ -637,6 +643,406 @@ Pdc *twi_get_pdc_base(Twi *p_twi)
 	return p_pdc_base;
 }
 
+#ifdef TWI_ASYNC_ENABLE
+
+#ifndef TWI_BUS_RECOVERY_HALF_PERIOD_US
+/* 100kHz bus recovery clock */
+#define TWI_BUS_RECOVERY_HALF_PERIOD_US 5
+#endif
+
+/*
+ * Timeouts and the bus recovery clock use the DWT cycle counter. SysTick can
+ * not be used here, it is owned by FreeRTOS on some targets.
+ */
+static void twi_cycle_counter_enable(void)
+{
+	CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+	DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+}
+
+static void twi_delay_us(uint32_t ul_us)
+{
+	const uint32_t ul_start = DWT->CYCCNT;
+	const uint32_t ul_cycles = ul_us * (sysclk_get_cpu_hz() / 1000000);
+
+	while ((DWT->CYCCNT - ul_start) < ul_cycles) {
+	}
+}
+
+#ifdef TWI_SR_ARBLST
+#define TWI_ASYNC_ERRORS (TWI_SR_NACK | TWI_SR_ARBLST)
+#else
+#define TWI_ASYNC_ERRORS TWI_SR_NACK
+#endif
+
+/* State of the active transfer and the interrupt it waits for */
+enum {
+	TWI_ASYNC_STATE_IDLE = 0,
+	TWI_ASYNC_STATE_WRITE_DATA,  /* PDC sends the data (ENDTX) */
+	TWI_ASYNC_STATE_WRITE_LAST,  /* Last byte moved to the shifter, send STOP (TXRDY) */
+	TWI_ASYNC_STATE_READ_DATA,   /* PDC receives all but the last two bytes (ENDRX) */
+	TWI_ASYNC_STATE_READ_LAST_2, /* Second to last byte received, send STOP (RXRDY) */
+	TWI_ASYNC_STATE_READ_LAST,   /* Last byte received (RXRDY) */
+	TWI_ASYNC_STATE_COMPLETE     /* STOP sent (TXCOMP) */
+};
+
+static const uint32_t twi_async_state_irq[] = {
+	[TWI_ASYNC_STATE_IDLE]        = 0,
+	[TWI_ASYNC_STATE_WRITE_DATA]  = TWI_IER_ENDTX,
+	[TWI_ASYNC_STATE_WRITE_LAST]  = TWI_IER_TXRDY,
+	[TWI_ASYNC_STATE_READ_DATA]   = TWI_IER_ENDRX,
+	[TWI_ASYNC_STATE_READ_LAST_2] = TWI_IER_RXRDY,
+	[TWI_ASYNC_STATE_READ_LAST]   = TWI_IER_RXRDY,
+	[TWI_ASYNC_STATE_COMPLETE]    = TWI_IER_TXCOMP,
+};
+
+static void twi_async_set_state(twi_async_t *p_async, uint32_t ul_state)
+{
+	Twi *p_twi = p_async->p_twi;
+
+	p_async->ul_state = ul_state;
+	p_twi->TWI_IDR = ~0UL;
+	if (ul_state != TWI_ASYNC_STATE_IDLE) {
+		p_twi->TWI_IER = twi_async_state_irq[ul_state] | TWI_ASYNC_ERRORS;
+	}
+}
+
+static void twi_async_start(twi_async_t *p_async)
+{
+	Twi *p_twi = p_async->p_twi;
+	Pdc *p_pdc = twi_get_pdc_base(p_twi);
+	twi_async_transfer_t *p_transfer = p_async->p_head;
+	twi_packet_t *p_packet = &p_transfer->packet;
+	pdc_packet_t pdc_packet;
+
+	p_async->ul_start_cycles = DWT->CYCCNT;
+
+	/* Set direction, slave address and internal address, as in twi_master_read/write */
+	p_twi->TWI_MMR = 0;
+	p_twi->TWI_MMR = (p_transfer->read ? TWI_MMR_MREAD : 0) | TWI_MMR_DADR(p_packet->chip) |
+			((p_packet->addr_length << TWI_MMR_IADRSZ_Pos) &
+			TWI_MMR_IADRSZ_Msk);
+	p_twi->TWI_IADR = 0;
+	p_twi->TWI_IADR = twi_mk_addr(p_packet->addr, p_packet->addr_length);
+
+	/* Clear stale NACK/ARBLST */
+	p_twi->TWI_SR;
+
+	if (!p_transfer->read) {
+		/* The transfer starts as soon as the PDC writes the first byte to THR */
+		pdc_packet.ul_addr = (uint32_t)p_packet->buffer;
+		pdc_packet.ul_size = p_packet->length;
+		pdc_tx_init(p_pdc, &pdc_packet, NULL);
+		twi_async_set_state(p_async, TWI_ASYNC_STATE_WRITE_DATA);
+		pdc_enable_transfer(p_pdc, PERIPH_PTCR_TXTEN);
+	} else if (p_packet->length == 1) {
+		twi_async_set_state(p_async, TWI_ASYNC_STATE_READ_LAST);
+		p_twi->TWI_CR = TWI_CR_START | TWI_CR_STOP;
+	} else if (p_packet->length == 2) {
+		twi_async_set_state(p_async, TWI_ASYNC_STATE_READ_LAST_2);
+		p_twi->TWI_CR = TWI_CR_START;
+	} else {
+		/* The last two bytes are read by hand, STOP has to be set in between */
+		pdc_packet.ul_addr = (uint32_t)p_packet->buffer;
+		pdc_packet.ul_size = p_packet->length - 2;
+		pdc_rx_init(p_pdc, &pdc_packet, NULL);
+		twi_async_set_state(p_async, TWI_ASYNC_STATE_READ_DATA);
+		p_twi->TWI_CR = TWI_CR_START;
+		pdc_enable_transfer(p_pdc, PERIPH_PTCR_RXTEN);
+	}
+}
+
+/* Stops the active transfer and removes it from the queue.
+ * Has to be called with TWI interrupt disabled or from the handler. */
+static twi_async_transfer_t *twi_async_detach(twi_async_t *p_async)
+{
+	twi_async_transfer_t *p_transfer = p_async->p_head;
+
+	pdc_disable_transfer(twi_get_pdc_base(p_async->p_twi), PERIPH_PTCR_RXTDIS | PERIPH_PTCR_TXTDIS);
+	twi_async_set_state(p_async, TWI_ASYNC_STATE_IDLE);
+
+	p_async->p_head = p_transfer->next;
+	if (p_async->p_head == NULL) {
+		p_async->p_tail = NULL;
+	}
+	p_transfer->next = NULL;
+
+	return p_transfer;
+}
+
+/* Reports a detached transfer and starts the next one.
+ * Has to be called with TWI interrupt disabled or from the handler. */
+static void twi_async_complete(twi_async_t *p_async, twi_async_transfer_t *p_transfer, uint32_t ul_status)
+{
+	p_transfer->status = ul_status;
+	p_transfer->done = true;
+	if (p_transfer->callback != NULL) {
+		p_transfer->callback(p_transfer);
+	}
+
+	if ((p_async->p_head != NULL) && !p_async->b_recovery) {
+		twi_async_start(p_async);
+	}
+}
+
+/* Has to be called with TWI interrupt disabled or from the handler */
+static void twi_async_finish(twi_async_t *p_async, uint32_t ul_status)
+{
+	twi_async_complete(p_async, twi_async_detach(p_async), ul_status);
+}
+
+/**
+ * \brief Initialize interrupt/PDC driven master transfers.
+ *
+ * \note twi_master_init has to be called first. The TWI interrupt has to be
+ * enabled in the NVIC and its handler has to call twi_async_handler.
+ *
+ * \param p_async Pointer to the async state.
+ * \param p_twi Pointer to a TWI instance.
+ * \param p_pio PIO controller of the SCL/SDA pins for bus recovery, NULL to only reset the TWI on timeout.
+ * \param ul_scl_mask SCL pin mask in p_pio.
+ * \param ul_sda_mask SDA pin mask in p_pio.
+ * \param ul_timeout_ms Maximum duration of one transfer. It is measured with the
+ * DWT cycle counter, which wraps after 2^32 CPU cycles (about 35s at 120MHz).
+ * Longer timeouts are clipped to that.
+ */
+void twi_async_init(twi_async_t *p_async, Twi *p_twi, Pio *p_pio, uint32_t ul_scl_mask, uint32_t ul_sda_mask, uint32_t ul_timeout_ms)
+{
+	const uint32_t ul_cycles_per_ms = sysclk_get_cpu_hz() / 1000;
+
+	twi_cycle_counter_enable();
+
+	p_async->p_twi = p_twi;
+	p_async->p_pio = p_pio;
+	p_async->ul_scl_mask = ul_scl_mask;
+	p_async->ul_sda_mask = ul_sda_mask;
+	p_async->ul_timeout_cycles = (ul_timeout_ms > UINT32_MAX / ul_cycles_per_ms) ? UINT32_MAX : ul_timeout_ms * ul_cycles_per_ms;
+	p_async->p_head = NULL;
+	p_async->p_tail = NULL;
+	p_async->b_recovery = false;
+	p_async->ul_cwgr = p_twi->TWI_CWGR;
+
+	pdc_disable_transfer(twi_get_pdc_base(p_twi), PERIPH_PTCR_RXTDIS | PERIPH_PTCR_TXTDIS);
+	twi_async_set_state(p_async, TWI_ASYNC_STATE_IDLE);
+}
+
+/**
+ * \brief Queue a master read or write. It is started immediately if the TWI is idle.
+ *
+ * \param p_async Pointer to the async state.
+ * \param p_transfer Transfer to queue, has to stay valid until done is set.
+ *
+ * \return TWI_SUCCESS if the transfer was queued, TWI_INVALID_ARGUMENT otherwise.
+ */
+uint32_t twi_async_submit(twi_async_t *p_async, twi_async_transfer_t *p_transfer)
+{
+	irqflags_t flags;
+
+	if (p_transfer->packet.length == 0) {
+		return TWI_INVALID_ARGUMENT;
+	}
+
+	p_transfer->next = NULL;
+	p_transfer->done = false;
+	p_transfer->status = TWI_BUSY;
+
+	flags = cpu_irq_save();
+	if (p_async->p_tail == NULL) {
+		p_async->p_head = p_transfer;
+		p_async->p_tail = p_transfer;
+		/* During a bus recovery twi_async_tick starts it afterwards */
+		if (!p_async->b_recovery) {
+			twi_async_start(p_async);
+		}
+	} else {
+		p_async->p_tail->next = p_transfer;
+		p_async->p_tail = p_transfer;
+	}
+	cpu_irq_restore(flags);
+
+	return TWI_SUCCESS;
+}
+
+/**
+ * \brief Advance the active transfer. Call from the TWI interrupt handler.
+ *
+ * \param p_async Pointer to the async state.
+ */
+void twi_async_handler(twi_async_t *p_async)
+{
+	Twi *p_twi = p_async->p_twi;
+	twi_packet_t *p_packet;
+	uint32_t status = p_twi->TWI_SR & p_twi->TWI_IMR;
+
+	if (p_async->p_head == NULL) {
+		twi_async_set_state(p_async, TWI_ASYNC_STATE_IDLE);
+		return;
+	}
+	p_packet = &p_async->p_head->packet;
+
+	/* The TWI sends STOP by itself on NACK, NACK comes together with TXCOMP */
+	if (status & TWI_SR_NACK) {
+		twi_async_finish(p_async, TWI_RECEIVE_NACK);
+		return;
+	}
+#ifdef TWI_SR_ARBLST
+	if (status & TWI_SR_ARBLST) {
+		twi_async_finish(p_async, TWI_ARBITRATION_LOST);
+		return;
+	}
+#endif
+
+	switch (p_async->ul_state) {
+	case TWI_ASYNC_STATE_WRITE_DATA:
+		if (status & TWI_SR_ENDTX) {
+			pdc_disable_transfer(twi_get_pdc_base(p_twi), PERIPH_PTCR_TXTDIS);
+			twi_async_set_state(p_async, TWI_ASYNC_STATE_WRITE_LAST);
+		}
+		break;
+
+	case TWI_ASYNC_STATE_WRITE_LAST:
+		if (status & TWI_SR_TXRDY) {
+			p_twi->TWI_CR = TWI_CR_STOP;
+			twi_async_set_state(p_async, TWI_ASYNC_STATE_COMPLETE);
+		}
+		break;
+
+	case TWI_ASYNC_STATE_READ_DATA:
+		if (status & TWI_SR_ENDRX) {
+			pdc_disable_transfer(twi_get_pdc_base(p_twi), PERIPH_PTCR_RXTDIS);
+			twi_async_set_state(p_async, TWI_ASYNC_STATE_READ_LAST_2);
+		}
+		break;
+
+	case TWI_ASYNC_STATE_READ_LAST_2:
+		if (status & TWI_SR_RXRDY) {
+			p_twi->TWI_CR = TWI_CR_STOP;
+			((uint8_t *)p_packet->buffer)[p_packet->length - 2] = p_twi->TWI_RHR;
+			twi_async_set_state(p_async, TWI_ASYNC_STATE_READ_LAST);
+		}
+		break;
+
+	case TWI_ASYNC_STATE_READ_LAST:
+		if (status & TWI_SR_RXRDY) {
+			((uint8_t *)p_packet->buffer)[p_packet->length - 1] = p_twi->TWI_RHR;
+			twi_async_set_state(p_async, TWI_ASYNC_STATE_COMPLETE);
+		}
+		break;
+
+	case TWI_ASYNC_STATE_COMPLETE:
+		if (status & TWI_SR_TXCOMP) {
+			twi_async_finish(p_async, TWI_SUCCESS);
+		}
+		break;
+
+	default:
+		break;
+	}
+}
+
+/**
+ * \brief Check the timeout of the active transfer. Call periodically from the main loop,
+ * at least once per DWT cycle counter wrap (about 35s at 120MHz).
+ *
+ * On timeout the PDC and TWI are stopped, the bus is recovered, the TWI is
+ * reset and the transfer is finished with TWI_ERROR_TIMEOUT. The recovery
+ * runs with interrupts enabled, queued transfers are started afterwards.
+ *
+ * \param p_async Pointer to the async state.
+ */
+void twi_async_tick(twi_async_t *p_async)
+{
+	Twi *p_twi = p_async->p_twi;
+	twi_async_transfer_t *p_transfer = NULL;
+	irqflags_t flags;
+
+	if (p_async->p_head == NULL) {
+		return;
+	}
+
+	flags = cpu_irq_save();
+	if ((p_async->p_head != NULL) && !p_async->b_recovery &&
+			((DWT->CYCCNT - p_async->ul_start_cycles) >= p_async->ul_timeout_cycles)) {
+		p_transfer = twi_async_detach(p_async);
+		p_async->b_recovery = true;
+	}
+	cpu_irq_restore(flags);
+
+	if (p_transfer == NULL) {
+		return;
+	}
+
+	if (p_async->p_pio != NULL) {
+		twi_bus_recovery(p_async->p_pio, p_async->ul_scl_mask, p_async->ul_sda_mask);
+	}
+
+	/* SWRST also clears the clock waveform */
+	twi_reset(p_twi);
+	p_twi->TWI_CWGR = p_async->ul_cwgr;
+	twi_enable_master_mode(p_twi);
+	p_twi->TWI_SR;
+
+	flags = cpu_irq_save();
+	p_async->b_recovery = false;
+	twi_async_complete(p_async, p_transfer, TWI_ERROR_TIMEOUT);
+	cpu_irq_restore(flags);
+}
+
+/**
+ * \brief Free a bus that is held by a slave (e.g. after a reset in the middle of a read).
+ *
+ * Takes SCL/SDA from the TWI as open drain outputs, sends 9 clock pulses and a
+ * STOP condition and gives the pins back to the TWI. The PIO clock has to be
+ * enabled to sample SDA.
+ *
+ * \param p_pio PIO controller of the SCL/SDA pins.
+ * \param ul_scl_mask SCL pin mask.
+ * \param ul_sda_mask SDA pin mask.
+ *
+ * \return TWI_SUCCESS if SCL and SDA are released afterwards, TWI_BUSY otherwise.
+ */
+uint32_t twi_bus_recovery(Pio *p_pio, uint32_t ul_scl_mask, uint32_t ul_sda_mask)
+{
+	const uint32_t mask = ul_scl_mask | ul_sda_mask;
+	uint32_t i;
+	bool released;
+
+	twi_cycle_counter_enable();
+
+	p_pio->PIO_SODR = mask;
+	p_pio->PIO_MDER = mask;
+	p_pio->PIO_OER  = mask;
+	p_pio->PIO_PER  = mask;
+	twi_delay_us(TWI_BUS_RECOVERY_HALF_PERIOD_US);
+
+	/* Clock out the byte (and ACK) the slave is in the middle of */
+	for (i = 0; i < 9; i++) {
+		p_pio->PIO_CODR = ul_scl_mask;
+		twi_delay_us(TWI_BUS_RECOVERY_HALF_PERIOD_US);
+		p_pio->PIO_SODR = ul_scl_mask;
+		twi_delay_us(TWI_BUS_RECOVERY_HALF_PERIOD_US);
+	}
+
+	/* STOP: SDA rises while SCL is high */
+	p_pio->PIO_CODR = ul_scl_mask;
+	twi_delay_us(TWI_BUS_RECOVERY_HALF_PERIOD_US);
+	p_pio->PIO_CODR = ul_sda_mask;
+	twi_delay_us(TWI_BUS_RECOVERY_HALF_PERIOD_US);
+	p_pio->PIO_SODR = ul_scl_mask;
+	twi_delay_us(TWI_BUS_RECOVERY_HALF_PERIOD_US);
+	p_pio->PIO_SODR = ul_sda_mask;
+	twi_delay_us(TWI_BUS_RECOVERY_HALF_PERIOD_US);
+
+	released = (p_pio->PIO_PDSR & mask) == mask;
+
+	/* Give the pins back to the TWI */
+	p_pio->PIO_PDR = mask;
+
+	return released ? TWI_SUCCESS : TWI_BUSY;
+}
+
+#endif
+
 #if (SAM4E || SAM4C || SAMG || SAM4CP || SAM4CM)
 /**
  * \brief Enables/Disables write protection mode.
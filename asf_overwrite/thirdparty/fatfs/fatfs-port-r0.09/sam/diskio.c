@@ -0,0 +1,411 @@
+/**
+ * \file
+ *
+ * \brief Implementation of low level disk I/O module skeleton for FatFS.
+ *
+ * Copyright (c) 2012-2016 Atmel Corporation. All rights reserved.
+ *
+ * \asf_license_start
+ *
+ * \page License
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. The name of Atmel may not be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * 4. This software may only be redistributed and used in connection with an
+ *    Atmel microcontroller product.
+ *
+ * THIS SOFTWARE IS PROVIDED BY ATMEL "AS IS" AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT ARE
+ * EXPRESSLY AND SPECIFICALLY DISCLAIMED. IN NO EVENT SHALL ATMEL BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN
+ * ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ * \asf_license_stop
+ *
+ */
+/*
+ * Support and FAQ: visit <a href="http://www.atmel.com/design-support/">Atmel Support</a>
+ */
+
+/*
+ * Changed for bricklib2:
+ * - Signatures match the FatFs r0.12c in asf_overwrite (UINT count).
+ * - disk_read/disk_write with count > 1 on a SD/MMC LUN are handed to
+ *   sd_mmc_read_blocks/sd_mmc_write_blocks of the slot of the LUN, so that
+ *   the card gets one CMD18/CMD25 for the whole request instead of one
+ *   CMD17/CMD24 per sector (see DISKIO_SD_MMC_MULTI_BLOCK).
+ */
+
+#include "compiler.h"
+#include "ff.h"
+// The r0.12c diskio.h next to the ff.c in asf_overwrite, not the r0.09 one
+#include "bricklib2/asf_overwrite/thirdparty/fatfs/fatfs-r0.12c/src/diskio.h"
+#include "ctrl_access.h"
+#include <assert.h>
+#include <string.h>
+
+/*
+ * ctrl_access has no multiple sector access, so the multi-block path calls
+ * sd_mmc directly. With FreeRTOS ctrl_access serializes the LUN accesses with
+ * a mutex that is private to ctrl_access.c. There the path is only used if
+ * enabled in conf_access.h, if FatFs is the only user of the card (e.g. no
+ * USB mass storage on the same LUN).
+ */
+#ifndef DISKIO_SD_MMC_MULTI_BLOCK
+# if defined(LUN_ID_SD_MMC_0_MEM) && !defined(FREERTOS_USED)
+#  define DISKIO_SD_MMC_MULTI_BLOCK 1
+# else
+#  define DISKIO_SD_MMC_MULTI_BLOCK 0
+# endif
+#endif
+
+#if DISKIO_SD_MMC_MULTI_BLOCK
+#include "sd_mmc.h"
+#endif
+
+/**
+ * \defgroup thirdparty_fatfs_port_group Port of low level driver for FatFS
+ *
+ * Low level driver for FatFS. The driver is based on the ctrl access module
+ * of the specific MCU device.
+ *
+ * @{
+ */
+
+/** Default sector size */
+#define SECTOR_SIZE_DEFAULT 512
+
+/** Supported sector size. These values are based on the LUN function:
+ * mem_sector_size(). */
+#define SECTOR_SIZE_512  1
+#define SECTOR_SIZE_1024 2
+#define SECTOR_SIZE_2048 4
+#define SECTOR_SIZE_4096 8
+
+/** Biggest block count of one sd_mmc_read_blocks/sd_mmc_write_blocks call */
+#define SD_MMC_MAX_NB_BLOCK 0xFFFF
+
+#if DISKIO_SD_MMC_MULTI_BLOCK
+/**
+ * \brief Map a LUN to the sd_mmc slot it accesses (as in conf_access.h).
+ *
+ * \param drv Physical drive number (0..).
+ *
+ * \return Slot number, or -1 if the LUN is not a SD/MMC slot.
+ */
+static int disk_sd_mmc_slot(BYTE drv)
+{
+	if (drv == LUN_ID_SD_MMC_0_MEM) {
+		return 0;
+	}
+#ifdef LUN_ID_SD_MMC_1_MEM
+	if (drv == LUN_ID_SD_MMC_1_MEM) {
+		return 1;
+	}
+#endif
+	return -1;
+}
+#endif
+
+/**
+ * \brief Initialize a disk.
+ *
+ * \param drv Physical drive number (0..).
+ *
+ * \return 0 or disk status in combination of DSTATUS bits
+ *         (STA_NOINIT, STA_PROTECT).
+ */
+DSTATUS disk_initialize(BYTE drv)
+{
+	int i;
+	Ctrl_status mem_status;
+
+#if LUN_USB
+	/* USB disk with multiple LUNs */
+	if (drv > LUN_ID_USB + Lun_usb_get_lun()) {
+		return STA_NOINIT;
+	}
+#else
+	if (drv > MAX_LUN) {
+		/* At least one of the LUN should be defined */
+		return STA_NOINIT;
+	}
+#endif
+	/* Check LUN ready (USB disk report CTRL_BUSY then CTRL_GOOD) */
+	for (i = 0; i < 2; i ++) {
+		mem_status = mem_test_unit_ready(drv);
+		if (CTRL_BUSY != mem_status) {
+			break;
+		}
+	}
+	if (mem_status != CTRL_GOOD) {
+		return STA_NOINIT;
+	}
+
+	/* Check Write Protection Status */
+	if (mem_wr_protect(drv)) {
+		return STA_PROTECT;
+	}
+
+	/* The memory should already be initialized */
+	return 0;
+}
+
+/**
+ * \brief  Return disk status.
+ *
+ * \param drv Physical drive number (0..).
+ *
+ * \return 0 or disk status in combination of DSTATUS bits
+ *         (STA_NOINIT, STA_NODISK, STA_PROTECT).
+ */
+DSTATUS disk_status(BYTE drv)
+{
+	switch (mem_test_unit_ready(drv)) {
+	case CTRL_GOOD:
+		return 0;
+	case CTRL_NO_PRESENT:
+		return STA_NOINIT | STA_NODISK;
+	default:
+		return STA_NOINIT;
+	}
+}
+
+/**
+ * \brief  Read sector(s).
+ *
+ * \param drv Physical drive number (0..).
+ * \param buff Data buffer to store read data.
+ * \param sector Sector address (LBA).
+ * \param count Number of sectors to read (1..).
+ *
+ * \return RES_OK for success, otherwise DRESULT error code.
+ */
+DRESULT disk_read(BYTE drv, BYTE *buff, DWORD sector, UINT count)
+{
+#if ACCESS_MEM_TO_RAM
+	uint8_t uc_sector_size = mem_sector_size(drv);
+	uint32_t i;
+	uint32_t ul_last_sector_num;
+
+	if (uc_sector_size == 0) {
+		return RES_ERROR;
+	}
+
+	/* Check valid address */
+	mem_read_capacity(drv, &ul_last_sector_num);
+	if ((sector + count * uc_sector_size) >
+			(ul_last_sector_num + 1) * uc_sector_size) {
+		return RES_PARERR;
+	}
+
+#if DISKIO_SD_MMC_MULTI_BLOCK
+	/* SD/MMC blocks are 512 bytes, one CMD18 for all sectors */
+	const int slot = disk_sd_mmc_slot(drv);
+	if ((slot >= 0) && (count > 1)) {
+		while (count > 0) {
+			const uint16_t nb_block = min(count, SD_MMC_MAX_NB_BLOCK);
+			if (sd_mmc_read_blocks(slot, sector, buff, nb_block) != SD_MMC_OK) {
+				return RES_ERROR;
+			}
+			sector += nb_block;
+			buff   += nb_block * SECTOR_SIZE_DEFAULT;
+			count  -= nb_block;
+		}
+
+		return RES_OK;
+	}
+#endif
+
+	/* Read the data */
+	for (i = 0; i < count; i++) {
+		if (memory_2_ram(drv, sector + uc_sector_size * i,
+				buff + uc_sector_size * SECTOR_SIZE_DEFAULT * i) !=
+				CTRL_GOOD) {
+			return RES_ERROR;
+		}
+	}
+
+	return RES_OK;
+
+#else
+	return RES_ERROR;
+#endif
+}
+
+/**
+ * \brief  Write sector(s).
+ *
+ * The FatFs module will issue multiple sector transfer request (count > 1) to
+ * the disk I/O layer. The disk function should process the multiple sector
+ * transfer properly. Do not translate it into multiple sector transfers to the
+ * media, or the data read/write performance may be drastically decreased.
+ *
+ * \param drv Physical drive number (0..).
+ * \param buff Data buffer to store read data.
+ * \param sector Sector address (LBA).
+ * \param count Number of sectors to read (1..).
+ *
+ * \return RES_OK for success, otherwise DRESULT error code.
+ */
+#if _FS_READONLY == 0
+DRESULT disk_write(BYTE drv, BYTE const *buff, DWORD sector, UINT count)
+{
+#if ACCESS_MEM_TO_RAM
+	uint8_t uc_sector_size = mem_sector_size(drv);
+	uint32_t i;
+	uint32_t ul_last_sector_num;
+
+	if (uc_sector_size == 0) {
+		return RES_ERROR;
+	}
+
+	/* Check valid address */
+	mem_read_capacity(drv, &ul_last_sector_num);
+	if ((sector + count * uc_sector_size) >
+			(ul_last_sector_num + 1) * uc_sector_size) {
+		return RES_PARERR;
+	}
+
+#if DISKIO_SD_MMC_MULTI_BLOCK
+	/* SD/MMC blocks are 512 bytes, one CMD25 for all sectors */
+	const int slot = disk_sd_mmc_slot(drv);
+	if ((slot >= 0) && (count > 1)) {
+		if (mem_wr_protect(drv)) {
+			return RES_WRPRT;
+		}
+
+		while (count > 0) {
+			const uint16_t nb_block = min(count, SD_MMC_MAX_NB_BLOCK);
+			if (sd_mmc_write_blocks(slot, sector, buff, nb_block) != SD_MMC_OK) {
+				return RES_ERROR;
+			}
+			sector += nb_block;
+			buff   += nb_block * SECTOR_SIZE_DEFAULT;
+			count  -= nb_block;
+		}
+
+		return RES_OK;
+	}
+#endif
+
+	/* Write the data */
+	for (i = 0; i < count; i++) {
+		if (ram_2_memory(drv, sector + uc_sector_size * i,
+				buff + uc_sector_size * SECTOR_SIZE_DEFAULT * i) !=
+				CTRL_GOOD) {
+			return RES_ERROR;
+		}
+	}
+
+	return RES_OK;
+
+#else
+	return RES_ERROR;
+#endif
+}
+
+#endif /* _FS_READONLY */
+
+/**
+ * \brief  Miscellaneous functions, which support the following commands:
+ *
+ * CTRL_SYNC    Make sure that the disk drive has finished pending write
+ * process. When the disk I/O module has a write back cache, flush the
+ * dirty sector immediately.
+ * In read-only configuration, this command is not needed.
+ *
+ * GET_SECTOR_COUNT    Return total sectors on the drive into the DWORD variable
+ * pointed by buffer.
+ * This command is used only in f_mkfs function.
+ *
+ * GET_BLOCK_SIZE    Return erase block size of the memory array in unit
+ * of sector into the DWORD variable pointed by Buffer.
+ * When the erase block size is unknown or magnetic disk device, return 1.
+ * This command is used only in f_mkfs function.
+ *
+ * GET_SECTOR_SIZE    Return sector size of the memory array.
+ *
+ * \param drv Physical drive number (0..).
+ * \param ctrl Control code.
+ * \param buff Buffer to send/receive control data.
+ *
+ * \return RES_OK for success, otherwise DRESULT error code.
+ */
+DRESULT disk_ioctl(BYTE drv, BYTE ctrl, void *buff)
+{
+	DRESULT res = RES_PARERR;
+
+	switch (ctrl) {
+	case GET_BLOCK_SIZE:
+		*(DWORD *)buff = 1;
+		res = RES_OK;
+		break;
+
+	/* Get the number of sectors on the disk (DWORD) */
+	case GET_SECTOR_COUNT:
+	{
+		uint32_t ul_last_sector_num;
+
+		/* Check valid address */
+		mem_read_capacity(drv, &ul_last_sector_num);
+
+		*(DWORD *)buff = ul_last_sector_num + 1;
+
+		res = RES_OK;
+	}
+	break;
+
+	/* Get sectors on the disk (WORD) */
+	case GET_SECTOR_SIZE:
+	{
+		uint8_t uc_sector_size = mem_sector_size(drv);
+
+		if ((uc_sector_size != SECTOR_SIZE_512) &&
+				(uc_sector_size != SECTOR_SIZE_1024) &&
+				(uc_sector_size != SECTOR_SIZE_2048) &&
+				(uc_sector_size != SECTOR_SIZE_4096)) {
+			/* The sector size is not supported by the FatFS */
+			return RES_ERROR;
+		}
+
+		*(WORD *)buff = uc_sector_size * SECTOR_SIZE_DEFAULT;
+
+		res = RES_OK;
+	}
+	break;
+
+	/* Make sure that data has been written */
+	case CTRL_SYNC:
+		if (mem_test_unit_ready(drv) == CTRL_GOOD) {
+			res = RES_OK;
+		} else {
+			res = RES_NOTRDY;
+		}
+		break;
+
+	default:
+		res = RES_PARERR;
+	}
+
+	return res;
+}
+
+//@}
@@ -541,6 +541,28 @@ static BYTE CurrVol;			/* Current drive */
 static FILESEM Files[_FS_LOCK];	/* Open object lock semaphores */
 #endif
 
+#if _FS_CACHE_SECTORS
+#if _FS_CACHE_WAYS < 1 || _FS_CACHE_SECTORS % _FS_CACHE_WAYS
+#error Wrong _FS_CACHE_SECTORS or _FS_CACHE_WAYS setting
+#endif
+#if _MAX_SS != _MIN_SS
+#error Sector cache needs fixed sector size
+#endif
+#if _FS_REENTRANT && _VOLUMES >= 2
+#error Sector cache is shared by all volumes and is not re-entrant
+#endif
+#define CACHE_SETS	(_FS_CACHE_SECTORS / _FS_CACHE_WAYS)
+typedef struct {
+	DWORD sect;		/* Sector number held in the line */
+	DWORD stamp;	/* Last access time for LRU replacement */
+	BYTE pdrv;		/* Physical drive number */
+	BYTE flag;		/* Line status (CL_VALID, CL_DIRTY) */
+} CACHELINE;
+static CACHELINE CacheTag[_FS_CACHE_SECTORS];		/* Cache line tags, indexed by way * CACHE_SETS + set */
+static BYTE CacheBuf[_FS_CACHE_SECTORS][_MAX_SS];	/* Cache line data */
+static DWORD CacheStamp;							/* Access clock */
+#endif
+
 #if _USE_LFN == 0		/* Non-LFN configuration */
 #define	DEF_NAMBUF
 #define INIT_NAMBUF(fs)
@@ -875,6 +897,212 @@ void clear_lock (	/* Clear lock entries of the volume */
 
 
 
+#if _FS_CACHE_SECTORS
+/*-----------------------------------------------------------------------*/
+/* Sector cache in front of the disk I/O functions                       */
+/*-----------------------------------------------------------------------*/
+/* The sector N can be held in any way of the set N % CACHE_SETS. Lines of
+/  a way are contiguous in CacheBuf[], so that consecutive dirty sectors
+/  can be written back with a multiple sector transfer. */
+
+#define CL_VALID	0x01	/* Line holds a sector */
+#define CL_DIRTY	0x02	/* Line has not been written back */
+
+static
+int cache_find (	/* Returns the line index or -1 if not cached */
+	BYTE pdrv,		/* Physical drive number */
+	DWORD sector	/* Sector number */
+)
+{
+	UINT i;
+
+
+	for (i = sector % CACHE_SETS; i < _FS_CACHE_SECTORS; i += CACHE_SETS) {	/* Search the ways of the set */
+		if ((CacheTag[i].flag & CL_VALID) && CacheTag[i].pdrv == pdrv && CacheTag[i].sect == sector) {
+			CacheTag[i].stamp = ++CacheStamp;
+			return (int)i;
+		}
+	}
+	return -1;
+}
+
+
+static
+int cache_alloc (	/* Returns the line index for the sector or -1 on write-back error */
+	BYTE pdrv,		/* Physical drive number */
+	DWORD sector	/* Sector number */
+)
+{
+	UINT i, v;
+
+
+	v = sector % CACHE_SETS;
+	for (i = v; i < _FS_CACHE_SECTORS; i += CACHE_SETS) {	/* Pick a free or the least recently used way */
+		if (!(CacheTag[i].flag & CL_VALID)) {
+			v = i; break;
+		}
+		if (CacheTag[i].stamp < CacheTag[v].stamp) v = i;
+	}
+#if !_FS_READONLY
+	if (CacheTag[v].flag & CL_DIRTY) {	/* Write back the victim */
+		if (disk_write(CacheTag[v].pdrv, CacheBuf[v], CacheTag[v].sect, 1) != RES_OK) return -1;
+	}
+#endif
+	CacheTag[v].flag = 0;
+	CacheTag[v].pdrv = pdrv;
+	CacheTag[v].sect = sector;
+	CacheTag[v].stamp = ++CacheStamp;
+	return (int)v;
+}
+
+
+static
+DRESULT cache_read (
+	BYTE pdrv,		/* Physical drive number */
+	BYTE* buff,		/* Data buffer to store read data */
+	DWORD sector,	/* Start sector number */
+	UINT count		/* Number of sectors to read */
+)
+{
+	int i;
+	DRESULT res;
+
+
+	if (count == 1) {
+		i = cache_find(pdrv, sector);
+		if (i < 0) {	/* Cache miss, fill a line */
+			i = cache_alloc(pdrv, sector);
+			if (i < 0) return RES_ERROR;
+			res = disk_read(pdrv, CacheBuf[i], sector, 1);
+			if (res != RES_OK) return res;
+			CacheTag[i].flag = CL_VALID;
+		}
+		mem_cpy(buff, CacheBuf[i], _MAX_SS);
+		return RES_OK;
+	}
+
+	res = disk_read(pdrv, buff, sector, count);	/* Multiple sector transfer bypasses the cache */
+	if (res == RES_OK) {
+		for (i = 0; i < _FS_CACHE_SECTORS; i++) {	/* Overlay sectors not written back yet */
+			if ((CacheTag[i].flag & CL_DIRTY) && CacheTag[i].pdrv == pdrv && CacheTag[i].sect - sector < count) {
+				mem_cpy(buff + (CacheTag[i].sect - sector) * _MAX_SS, CacheBuf[i], _MAX_SS);
+			}
+		}
+	}
+	return res;
+}
+
+
+#if !_FS_READONLY
+static
+DRESULT cache_write (
+	BYTE pdrv,			/* Physical drive number */
+	const BYTE* buff,	/* Data to be written */
+	DWORD sector,		/* Start sector number */
+	UINT count			/* Number of sectors to write */
+)
+{
+	int i;
+	DRESULT res;
+
+
+	if (count == 1) {
+		i = cache_find(pdrv, sector);
+		if (i < 0) {
+			i = cache_alloc(pdrv, sector);
+			if (i < 0) return RES_ERROR;
+		}
+		mem_cpy(CacheBuf[i], buff, _MAX_SS);
+		CacheTag[i].flag = CL_VALID | CL_DIRTY;		/* Written back on sync or eviction */
+		return RES_OK;
+	}
+
+	res = disk_write(pdrv, buff, sector, count);	/* Multiple sector transfer bypasses the cache */
+	for (i = 0; i < _FS_CACHE_SECTORS; i++) {
+		if (CacheTag[i].pdrv == pdrv && CacheTag[i].sect - sector < count) {
+			/* Discard the overwritten lines. On error the state of the medium is unknown,
+			/  drop only clean lines and keep dirty ones for the next write back. */
+			if (res == RES_OK || !(CacheTag[i].flag & CL_DIRTY)) CacheTag[i].flag = 0;
+		}
+	}
+	return res;
+}
+
+
+static
+DRESULT cache_flush (	/* Write back all dirty lines of the drive */
+	BYTE pdrv			/* Physical drive number */
+)
+{
+	UINT i, n;
+
+
+	i = 0;
+	while (i < _FS_CACHE_SECTORS) {
+		if ((CacheTag[i].flag & CL_DIRTY) && CacheTag[i].pdrv == pdrv) {
+			for (n = 1; (i + n) % CACHE_SETS; n++) {	/* Merge following consecutive sectors in the way */
+				if (!(CacheTag[i + n].flag & CL_DIRTY) || CacheTag[i + n].pdrv != pdrv || CacheTag[i + n].sect != CacheTag[i].sect + n) break;
+			}
+			if (disk_write(pdrv, CacheBuf[i], CacheTag[i].sect, n) != RES_OK) return RES_ERROR;
+			do {
+				CacheTag[i++].flag &= (BYTE)~CL_DIRTY;
+			} while (--n);
+		} else {
+			i++;
+		}
+	}
+	return RES_OK;
+}
+#endif
+
+
+static
+DRESULT cache_ioctl (
+	BYTE pdrv,		/* Physical drive number */
+	BYTE cmd,		/* Control code */
+	void* buff		/* Buffer to send/receive control data */
+)
+{
+#if !_FS_READONLY
+	if (cmd == CTRL_SYNC && cache_flush(pdrv) != RES_OK) return RES_ERROR;	/* Write back before syncing the drive */
+#endif
+	return disk_ioctl(pdrv, cmd, buff);
+}
+
+
+static
+void cache_discard (	/* Drop all lines of the drive, dirty or not */
+	BYTE pdrv			/* Physical drive number */
+)
+{
+	UINT i;
+
+
+	for (i = 0; i < _FS_CACHE_SECTORS; i++) {
+		if (CacheTag[i].pdrv == pdrv) CacheTag[i].flag = 0;
+	}
+}
+
+
+static
+DSTATUS cache_initialize (
+	BYTE pdrv		/* Physical drive number */
+)
+{
+	cache_discard(pdrv);	/* The medium may have been changed */
+	return disk_initialize(pdrv);
+}
+
+/* Route all disk accesses of the FatFs module through the cache */
+#define disk_initialize(pdrv)				cache_initialize(pdrv)
+#define disk_read(pdrv, buff, sect, cnt)	cache_read(pdrv, buff, sect, cnt)
+#define disk_write(pdrv, buff, sect, cnt)	cache_write(pdrv, buff, sect, cnt)
+#define disk_ioctl(pdrv, cmd, buff)			cache_ioctl(pdrv, cmd, buff)
+
+#endif	/* _FS_CACHE_SECTORS */
+
+
+
 /*-----------------------------------------------------------------------*/
 /* Move/Flush disk access window in the file system object               */
 /*-----------------------------------------------------------------------*/
@@ -1457,6 +1685,48 @@ DWORD clmt_clust (	/* <2:Error, >=2:Cluster number */
 	return cl + *tbl;	/* Return the cluster number */
 }
 
+
+
+
+/*-----------------------------------------------------------------------*/
+/* FAT handling - Create link map table of the file                      */
+/*-----------------------------------------------------------------------*/
+
+static
+FRESULT create_clmt (	/* FR_OK:succeeded, FR_NOT_ENOUGH_CORE:table too small, others:error */
+	FIL* fp,			/* Pointer to the file object, cltbl[0] holds the table size */
+	int stop			/* 0:Walk the whole chain to get the required size, 1:Stop when the table is full */
+)
+{
+	DWORD cl, pcl, ncl, tcl, tlen, ulen, *tbl;
+	FATFS *fs = fp->obj.fs;
+
+
+	tbl = fp->cltbl;
+	tlen = *tbl++; ulen = 2;	/* Given table size and required table size */
+	cl = fp->obj.sclust;		/* Origin of the chain */
+	if (cl) {
+		do {
+			/* Get a fragment */
+			tcl = cl; ncl = 0; ulen += 2;	/* Top, length and used items */
+			if (stop && ulen > tlen) break;	/* Too fragmented, don't follow the rest of the chain */
+			do {
+				pcl = cl; ncl++;
+				cl = get_fat(&fp->obj, cl);
+				if (cl <= 1) return FR_INT_ERR;
+				if (cl == 0xFFFFFFFF) return FR_DISK_ERR;
+			} while (cl == pcl + 1);
+			if (ulen <= tlen) {		/* Store the length and top of the fragment */
+				*tbl++ = ncl; *tbl++ = tcl;
+			}
+		} while (cl < fs->n_fatent);	/* Repeat until end of chain */
+	}
+	*fp->cltbl = ulen;	/* Number of items used */
+	if (ulen > tlen) return FR_NOT_ENOUGH_CORE;	/* Given table size is smaller than required */
+	*tbl = 0;			/* Terminate table */
+	return FR_OK;
+}
+
 #endif	/* _USE_FASTSEEK */
 
 
@@ -3264,6 +3534,14 @@ FRESULT f_mount (
 	cfs = FatFs[vol];					/* Pointer to fs object */
 
 	if (cfs) {
+#if _FS_CACHE_SECTORS
+		if (cfs->fs_type) {				/* Write back and drop the sector cache of the volume */
+#if !_FS_READONLY
+			cache_flush(cfs->drv);		/* Write errors are reported by f_sync()/f_close(), the volume is unregistered anyway (e.g. card removed) */
+#endif
+			cache_discard(cfs->drv);
+		}
+#endif
 #if _FS_LOCK != 0
 		clear_lock(cfs);
 #endif
@@ -3454,6 +3732,9 @@ FRESULT f_open (
 			fp->err = 0;			/* Clear error flag */
 			fp->sect = 0;			/* Invalidate current data sector */
 			fp->fptr = 0;			/* Set file pointer top of the file */
+#if _USE_FASTSEEK && _FS_CLMT_SIZE
+			fp->clmt[0] = 0;		/* Link map not built yet, done by the first f_lseek() */
+#endif
 #if !_FS_READONLY
 #if !_FS_TINY
 			mem_set(fp->buf, 0, _MAX_SS);	/* Clear sector buffer */
@@ -3635,6 +3916,10 @@ FRESULT f_write (
 #if _USE_FASTSEEK
 					if (fp->cltbl) {
 						clst = clmt_clust(fp, fp->fptr);	/* Get cluster# from the CLMT */
+						if (clst == 0) {					/* Beyond the mapped chain? */
+							fp->cltbl = 0;					/* Leave fast seek mode to stretch the chain */
+							clst = create_chain(&fp->obj, fp->clust);
+						}
 					} else
 #endif
 					{
@@ -3997,7 +4282,7 @@ FRESULT f_lseek (
 	DWORD clst, bcs, nsect;
 	FSIZE_t ifptr;
 #if _USE_FASTSEEK
-	DWORD cl, pcl, ncl, tcl, dsc, tlen, ulen, *tbl;
+	DWORD dsc;
 #endif
 
 	res = validate(&fp->obj, &fs);		/* Check validity of the file object */
@@ -4010,32 +4295,26 @@ FRESULT f_lseek (
 	if (res != FR_OK) LEAVE_FF(fs, res);
 
 #if _USE_FASTSEEK
+#if _FS_CLMT_SIZE
+	if (!fp->cltbl && ofs != CREATE_LINKMAP && ofs && ofs != fp->fptr && ofs <= fp->obj.objsize &&
+		fp->obj.sclust && fp->clmt[0] <= _FS_CLMT_SIZE) {	/* Build the link map on the first seek (unless it was too fragmented before) */
+		fp->cltbl = fp->clmt;
+		fp->clmt[0] = _FS_CLMT_SIZE;
+		res = create_clmt(fp, 1);
+		if (res != FR_OK) fp->cltbl = 0;	/* Too fragmented, stay in normal mode */
+		if (res == FR_INT_ERR || res == FR_DISK_ERR) ABORT(fs, res);
+		res = FR_OK;
+	}
+#endif
+#if !_FS_READONLY
+	if (fp->cltbl && ofs != CREATE_LINKMAP && ofs > fp->obj.objsize && (fp->flag & FA_WRITE)) {
+		fp->cltbl = 0;	/* Leave fast seek mode to expand the file */
+	}
+#endif
 	if (fp->cltbl) {	/* Fast seek */
 		if (ofs == CREATE_LINKMAP) {	/* Create CLMT */
-			tbl = fp->cltbl;
-			tlen = *tbl++; ulen = 2;	/* Given table size and required table size */
-			cl = fp->obj.sclust;		/* Origin of the chain */
-			if (cl) {
-				do {
-					/* Get a fragment */
-					tcl = cl; ncl = 0; ulen += 2;	/* Top, length and used items */
-					do {
-						pcl = cl; ncl++;
-						cl = get_fat(&fp->obj, cl);
-						if (cl <= 1) ABORT(fs, FR_INT_ERR);
-						if (cl == 0xFFFFFFFF) ABORT(fs, FR_DISK_ERR);
-					} while (cl == pcl + 1);
-					if (ulen <= tlen) {		/* Store the length and top of the fragment */
-						*tbl++ = ncl; *tbl++ = tcl;
-					}
-				} while (cl < fs->n_fatent);	/* Repeat until end of chain */
-			}
-			*fp->cltbl = ulen;	/* Number of items used */
-			if (ulen <= tlen) {
-				*tbl = 0;		/* Terminate table */
-			} else {
-				res = FR_NOT_ENOUGH_CORE;	/* Given table size is smaller than required */
-			}
+			res = create_clmt(fp, 0);
+			if (res == FR_INT_ERR || res == FR_DISK_ERR) ABORT(fs, res);
 		} else {						/* Fast seek */
 			if (ofs > fp->obj.objsize) ofs = fp->obj.objsize;	/* Clip offset at the file size */
 			fp->fptr = ofs;				/* Set file pointer */
@@ -4489,6 +4768,9 @@ FRESULT f_truncate (
 		}
 		fp->obj.objsize = fp->fptr;	/* Set file size to current R/W point */
 		fp->flag |= FA_MODIFIED;
+#if _USE_FASTSEEK
+		fp->cltbl = 0;				/* The link map may refer to removed clusters */
+#endif
 #if !_FS_TINY
 		if (res == FR_OK && (fp->flag & FA_DIRTY)) {
 			if (disk_write(fs->drv, fp->buf, fp->sect, 1) != RES_OK) {
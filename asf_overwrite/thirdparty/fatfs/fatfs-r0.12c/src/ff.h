@@ -164,7 +164,10 @@ typedef struct {
 	BYTE*	dir_ptr;		/* Pointer to the directory entry in the win[] */
 #endif
 #if _USE_FASTSEEK
-	DWORD*	cltbl;			/* Pointer to the cluster link map table (nulled on open, set by application) */
+	DWORD*	cltbl;			/* Pointer to the cluster link map table (set on the first seek if _FS_CLMT_SIZE, or by application) */
+#if _FS_CLMT_SIZE
+	DWORD	clmt[_FS_CLMT_SIZE];	/* Cluster link map table built by the first f_lseek() */
+#endif
 #endif
 #if !_FS_TINY
 	BYTE	buf[_MAX_SS];	/* File private data read/write window */
@@ -46,10 +46,26 @@
 /* This option switches f_mkfs() function. (0:Disable or 1:Enable) */
 
 
+#ifndef _USE_FASTSEEK
 #define	_USE_FASTSEEK	0
+#endif
 /* This option switches fast seek function. (0:Disable or 1:Enable) */
 
 
+#ifndef _FS_CLMT_SIZE
+#define	_FS_CLMT_SIZE	0
+#endif
+/* This option defines the number of items of the cluster link map table (CLMT)
+/  that is embedded in the file object (4 bytes per item in every FIL). The map is
+/  built by the first f_lseek() on an existing file, so that f_lseek() and f_read()
+/  do not need to follow the FAT chain afterwards. A file with n fragments needs
+/  (n + 1) * 2 items. If the file is too fragmented, building stops at the first
+/  fragment that does not fit and the file stays in normal mode. The map is dropped
+/  when the file is stretched by f_write() or truncated and built again by the next
+/  f_lseek(). (0:Disable, application has to set cltbl, or 4 or larger, e.g. 32)
+/  This option has no effect when _USE_FASTSEEK == 0. */
+
+
 #define	_USE_EXPAND		0
 /* This option switches f_expand function. (0:Disable or 1:Enable) */
 
@@ -212,6 +228,23 @@
 /  buffer in the file system object (FATFS) is used for the file data transfer. */
 
 
+#ifndef _FS_CACHE_SECTORS
+#define	_FS_CACHE_SECTORS	0
+#endif
+#ifndef _FS_CACHE_WAYS
+#define	_FS_CACHE_WAYS		2
+#endif
+/* The _FS_CACHE_SECTORS defines the number of sectors held in the write-back sector
+/  cache in front of disk_read() and disk_write(). The cache is _FS_CACHE_WAYS-way set
+/  associative with LRU replacement and occupies _FS_CACHE_SECTORS * _MAX_SS bytes on
+/  the BSS. Single sector accesses (FAT, directory and file buffer) are cached,
+/  multiple sector transfers bypass the cache. Dirty sectors are written back on
+/  f_sync() and f_close(), which report write errors. Unregistering the volume by
+/  f_mount() tries to write them back and always drops them.
+/  _FS_CACHE_SECTORS must be a multiple of _FS_CACHE_WAYS.
+/  (0:Disable the cache, or e.g. 4 with 2 ways for 2 KiB) */
+
+
 #define _FS_EXFAT	0
 /* This option switches support of exFAT file system. (0:Disable or 1:Enable)
 /  When enable exFAT, also LFN needs to be enabled. (_USE_LFN >= 1)
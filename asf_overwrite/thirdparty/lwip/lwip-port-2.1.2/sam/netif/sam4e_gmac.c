@@ -74,8 +74,8 @@
 /* configLIBRARY_MAX_SYSCALL_INTERRUPT_PRIORITY. */
 #define INT_PRIORITY_GMAC					12
 
-/** The GMAC interrupts to enable */
-#define GMAC_INT_GROUP (GMAC_ISR_RCOMP | GMAC_ISR_ROVR | GMAC_ISR_HRESP | GMAC_ISR_TCOMP | GMAC_ISR_TUR | GMAC_ISR_TFC)
+/** The GMAC interrupts to enable. RXUBR wakes the task if RX stalled on a descriptor without pbuf. */
+#define GMAC_INT_GROUP (GMAC_ISR_RCOMP | GMAC_ISR_RXUBR | GMAC_ISR_ROVR | GMAC_ISR_HRESP | GMAC_ISR_TCOMP | GMAC_ISR_TUR | GMAC_ISR_TFC)
 
 /** The GMAC TX errors to handle */
 #define GMAC_TX_ERRORS (GMAC_TSR_TFC | GMAC_TSR_UND | GMAC_TSR_HRESP)
@@ -89,6 +89,48 @@
 #define GMAC_RX_ERRORS       0
 #endif
 
+/** Maximum number of frames that are processed by one ethernetif_input() call. */
+#ifndef ETHERNET_CONF_RX_BUDGET
+#define ETHERNET_CONF_RX_BUDGET				8
+#endif
+
+/**
+ * RCOMP interrupt coalescing: The RCOMP interrupt is masked after it fired
+ * and only enabled again after the GMAC task has drained the RX ring, so a
+ * burst of frames results in one interrupt (only used with NO_SYS == 0).
+ */
+#ifndef ETHERNET_CONF_RX_COALESCE
+#define ETHERNET_CONF_RX_COALESCE			0
+#endif
+
+/**
+ * If the PBUF_POOL was empty and a RX descriptor could not be refilled, the
+ * GMAC task retries the refill after this timeout (in ms, only used with
+ * NO_SYS == 0), even if no interrupt occurs in the meantime.
+ */
+#ifndef ETHERNET_CONF_RX_REFILL_RETRY_MS
+#define ETHERNET_CONF_RX_REFILL_RETRY_MS	10
+#endif
+
+/**
+ * Zero-copy TX: The pbuf payloads are handed directly to chained TX
+ * descriptors instead of being copied into tx_buf. The pbufs are referenced
+ * until the GMAC has sent the frame (see gmac_tx_reclaim()).
+ */
+#ifndef ETHERNET_CONF_TX_ZERO_COPY
+#define ETHERNET_CONF_TX_ZERO_COPY			0
+#endif
+
+/** Errors reported by GMAC in the first TX descriptor of a frame */
+#define GMAC_TX_DESC_ERRORS (GMAC_TXD_ERROR | GMAC_TXD_UNDERRUN | GMAC_TXD_EXHAUSTED)
+
+/** Status of a TX descriptor that is owned by the driver */
+#if ETHERNET_CONF_TX_ZERO_COPY
+#define GMAC_TXD_FREE (GMAC_TXD_USED)
+#else
+#define GMAC_TXD_FREE (GMAC_TXD_USED | GMAC_TXD_LAST)
+#endif
+
 /**
  * GMAC driver structure.
  */
@@ -106,13 +148,20 @@ struct gmac_device {
 	gmac_tx_descriptor_t tx_desc[GMAC_TX_BUFFERS];
 	/** RX pbuf pointer list. */
 	struct pbuf *rx_pbuf[GMAC_RX_BUFFERS];
+#if ETHERNET_CONF_TX_ZERO_COPY
+	/** TX pbuf pointer list, set for the first descriptor of each frame. */
+	struct pbuf *tx_pbuf[GMAC_TX_BUFFERS];
+#else
 	/** TX buffers. */
 	uint8_t tx_buf[GMAC_TX_BUFFERS][GMAC_TX_UNITSIZE];
+#endif
 
 	/** RX index for current processing TD. */
 	uint32_t us_rx_idx;
 	/** Circular buffer head pointer by upper layer (buffer to be sent). */
 	uint32_t us_tx_idx;
+	/** Circular buffer tail pointer (first descriptor of oldest frame in flight). */
+	uint32_t us_tx_tail;
 
 	/** Reference to lwIP netif structure. */
 	struct netif *netif;
@@ -166,6 +215,12 @@ void GMAC_Handler(void)
 
 	/* RX interrupts. */
 	if (ul_isr & GMAC_INT_GROUP) {
+#if ETHERNET_CONF_RX_COALESCE
+		/* No further RCOMP interrupts until the RX ring is drained. */
+		if (ul_isr & GMAC_ISR_RCOMP) {
+			gmac_disable_interrupt(GMAC, GMAC_IDR_RCOMP);
+		}
+#endif
 		xSemaphoreGiveFromISR(gs_gmac_dev.rx_sem, &xGMACTaskWoken);
 	}
 
@@ -176,6 +231,12 @@ void GMAC_Handler(void)
 /**
  * \brief Populate the RX descriptor ring buffers with pbufs.
  *
+ * This is called once per batch of received frames and refills all empty
+ * descriptors in ring order, starting at the consumer index us_rx_idx. The
+ * first empty descriptor is the one GMAC waits for, so if PBUF_POOL runs
+ * empty the refilled descriptors are still contiguous. A descriptor without
+ * pbuf stays owned by software, GMAC stops there until the next refill.
+ *
  * \note Make sure that the p->payload pointer is 32 bits aligned.
  * (since the lsb are used as status bits by GMAC).
  *
@@ -183,11 +244,12 @@ void GMAC_Handler(void)
  */
 static void gmac_rx_populate_queue(struct gmac_device *p_gmac_dev)
 {
-	uint32_t ul_index = 0;
+	uint32_t ul_index = p_gmac_dev->us_rx_idx;
+	uint32_t ul_count = 0;
 	struct pbuf *p = 0;
 
 	/* Set up the RX descriptors. */
-	for (ul_index = 0; ul_index < GMAC_RX_BUFFERS; ul_index++) {
+	for (ul_count = 0; ul_count < GMAC_RX_BUFFERS; ul_count++, ul_index = (ul_index + 1) % GMAC_RX_BUFFERS) {
 		if (p_gmac_dev->rx_pbuf[ul_index] == 0) {
 
 			/* Allocate a new pbuf with the maximum size. */
@@ -204,16 +266,17 @@ static void gmac_rx_populate_queue(struct gmac_device *p_gmac_dev)
 			LWIP_ASSERT("gmac_rx_populate_queue: unaligned p->payload buffer address",
 					(((uint32_t)p->payload & 0xFFFFFFFC) == (uint32_t)p->payload));
 
-			if (ul_index == GMAC_RX_BUFFERS - 1)
-				p_gmac_dev->rx_desc[ul_index].addr.val = (u32_t) p->payload | GMAC_RXD_WRAP;
-			else
-				p_gmac_dev->rx_desc[ul_index].addr.val = (u32_t) p->payload;
+			/* Save pbuf pointer to be sent to lwIP upper layer. */
+			p_gmac_dev->rx_pbuf[ul_index] = p;
 
 			/* Reset status value. */
 			p_gmac_dev->rx_desc[ul_index].status.val = 0;
 
-			/* Save pbuf pointer to be sent to lwIP upper layer. */
-			p_gmac_dev->rx_pbuf[ul_index] = p;
+			/* Hand the descriptor to GMAC (ownership bit cleared). */
+			if (ul_index == GMAC_RX_BUFFERS - 1)
+				p_gmac_dev->rx_desc[ul_index].addr.val = (u32_t) p->payload | GMAC_RXD_WRAP;
+			else
+				p_gmac_dev->rx_desc[ul_index].addr.val = (u32_t) p->payload;
 
 			LWIP_DEBUGF(NETIF_DEBUG,
 					("gmac_rx_populate_queue: new pbuf allocated: %p [idx=%u]\n",
@@ -236,10 +299,10 @@ static void gmac_rx_init(struct gmac_device *ps_gmac_dev)
 	/* Init RX index. */
 	ps_gmac_dev->us_rx_idx = 0;
 
-	/* Set up the RX descriptors. */
+	/* Set up the RX descriptors, owned by software until they have a pbuf. */
 	for (ul_index = 0; ul_index < GMAC_RX_BUFFERS; ul_index++) {
 		ps_gmac_dev->rx_pbuf[ul_index] = 0;
-		ps_gmac_dev->rx_desc[ul_index].addr.val = 0;
+		ps_gmac_dev->rx_desc[ul_index].addr.val = GMAC_RXD_OWNERSHIP;
 		ps_gmac_dev->rx_desc[ul_index].status.val = 0;
 	}
 	ps_gmac_dev->rx_desc[ul_index - 1].addr.val |= GMAC_RXD_WRAP;
@@ -262,13 +325,19 @@ static void gmac_tx_init(struct gmac_device *ps_gmac_dev)
 {
 	uint32_t ul_index;
 
-	/* Init TX index pointer. */
+	/* Init TX index pointers. */
 	ps_gmac_dev->us_tx_idx = 0;
+	ps_gmac_dev->us_tx_tail = 0;
 
 	/* Set up the TX descriptors. */
 	for (ul_index = 0; ul_index < GMAC_TX_BUFFERS; ul_index++) {
+#if ETHERNET_CONF_TX_ZERO_COPY
+		ps_gmac_dev->tx_desc[ul_index].addr = 0;
+		ps_gmac_dev->tx_pbuf[ul_index] = 0;
+#else
 		ps_gmac_dev->tx_desc[ul_index].addr = (uint32_t)&ps_gmac_dev->tx_buf[ul_index][0];
-		ps_gmac_dev->tx_desc[ul_index].status.val = GMAC_TXD_USED | GMAC_TXD_LAST;
+#endif
+		ps_gmac_dev->tx_desc[ul_index].status.val = GMAC_TXD_FREE;
 	}
 	ps_gmac_dev->tx_desc[ul_index - 1].status.val |= GMAC_TXD_WRAP;
 
@@ -276,6 +345,121 @@ static void gmac_tx_init(struct gmac_device *ps_gmac_dev)
 	gmac_set_tx_queue(GMAC, (uint32_t) &ps_gmac_dev->tx_desc[0]);
 }
 
+/**
+ * \brief Give the descriptors of all frames that were sent by GMAC back to
+ * the ring (and free their pbufs with zero-copy TX).
+ *
+ * \note GMAC only sets the used bit of the first descriptor of a frame. This
+ * is called from ethernetif_input() on TCOMP and before each transmission,
+ * pbuf_free() must not be called from the interrupt itself.
+ *
+ * \param ps_gmac_dev Pointer to driver data structure.
+ */
+static void gmac_tx_reclaim(struct gmac_device *ps_gmac_dev)
+{
+	SYS_ARCH_DECL_PROTECT(lev);
+	uint32_t ul_index;
+	uint32_t ul_status;
+#if ETHERNET_CONF_TX_ZERO_COPY
+	struct pbuf *p;
+#endif
+
+	while (1) {
+		SYS_ARCH_PROTECT(lev);
+
+		ul_index = ps_gmac_dev->us_tx_tail;
+		if ((ul_index == ps_gmac_dev->us_tx_idx) ||
+				((ps_gmac_dev->tx_desc[ul_index].status.val & GMAC_TXD_USED) == 0)) {
+			/* Ring is empty or oldest frame is still in flight. */
+			SYS_ARCH_UNPROTECT(lev);
+			break;
+		}
+
+		if (ps_gmac_dev->tx_desc[ul_index].status.val & GMAC_TX_DESC_ERRORS) {
+			LINK_STATS_INC(link.err);
+			LINK_STATS_INC(link.drop);
+		}
+
+#if ETHERNET_CONF_TX_ZERO_COPY
+		p = ps_gmac_dev->tx_pbuf[ul_index];
+		ps_gmac_dev->tx_pbuf[ul_index] = 0;
+#endif
+
+		/* Release all descriptors of the frame, the used bit stops the DMA there. */
+		do {
+			ul_status = ps_gmac_dev->tx_desc[ul_index].status.val;
+			ps_gmac_dev->tx_desc[ul_index].status.val = GMAC_TXD_FREE | (ul_status & GMAC_TXD_WRAP);
+			ul_index = (ul_index + 1) % GMAC_TX_BUFFERS;
+		} while ((ul_status & GMAC_TXD_LAST) == 0);
+
+		ps_gmac_dev->us_tx_tail = ul_index;
+
+		SYS_ARCH_UNPROTECT(lev);
+
+#if ETHERNET_CONF_TX_ZERO_COPY
+		pbuf_free(p);
+#endif
+	}
+}
+
+/**
+ * \brief Move the frames that are not sent yet to the start of the ring.
+ *
+ * \note After a TX error GMAC restarts at the queue base address. Instead of
+ * reinitializing the ring (and losing the frames in flight) the pending
+ * descriptors are rotated, so they are sent after the restart.
+ *
+ * \param ps_gmac_dev Pointer to driver data structure.
+ */
+static void gmac_tx_requeue(struct gmac_device *ps_gmac_dev)
+{
+	SYS_ARCH_DECL_PROTECT(lev);
+	gmac_tx_descriptor_t tx_desc[GMAC_TX_BUFFERS];
+#if ETHERNET_CONF_TX_ZERO_COPY
+	struct pbuf *tx_pbuf[GMAC_TX_BUFFERS];
+#endif
+	uint32_t ul_index;
+	uint32_t ul_from;
+
+	SYS_ARCH_PROTECT(lev);
+
+	for (ul_index = 0; ul_index < GMAC_TX_BUFFERS; ul_index++) {
+		ul_from = (ps_gmac_dev->us_tx_tail + ul_index) % GMAC_TX_BUFFERS;
+		tx_desc[ul_index] = ps_gmac_dev->tx_desc[ul_from];
+		tx_desc[ul_index].status.val &= ~GMAC_TXD_WRAP;
+#if ETHERNET_CONF_TX_ZERO_COPY
+		tx_pbuf[ul_index] = ps_gmac_dev->tx_pbuf[ul_from];
+#endif
+	}
+	tx_desc[GMAC_TX_BUFFERS - 1].status.val |= GMAC_TXD_WRAP;
+
+	memcpy(ps_gmac_dev->tx_desc, tx_desc, sizeof(tx_desc));
+#if ETHERNET_CONF_TX_ZERO_COPY
+	memcpy(ps_gmac_dev->tx_pbuf, tx_pbuf, sizeof(tx_pbuf));
+#endif
+
+	ps_gmac_dev->us_tx_idx = (ps_gmac_dev->us_tx_idx + GMAC_TX_BUFFERS - ps_gmac_dev->us_tx_tail) % GMAC_TX_BUFFERS;
+	ps_gmac_dev->us_tx_tail = 0;
+
+	SYS_ARCH_UNPROTECT(lev);
+
+	gmac_set_tx_queue(GMAC, (uint32_t) &ps_gmac_dev->tx_desc[0]);
+}
+
+#if ETHERNET_CONF_TX_ZERO_COPY
+/**
+ * \brief Check if GMAC can read a TX buffer with DMA (only internal SRAM).
+ *
+ * \param payload Pointer to buffer.
+ *
+ * \return 1 if the buffer can be used directly, 0 otherwise.
+ */
+static inline uint8_t gmac_tx_is_dma_capable(const void *payload)
+{
+	return ((uint32_t)payload >= IRAM_ADDR) && ((uint32_t)payload < IRAM_ADDR + IRAM_SIZE);
+}
+#endif
+
 /**
  * \brief Initialize GMAC and PHY.
  *
@@ -392,19 +576,28 @@ static err_t gmac_low_level_output(struct netif *netif, struct pbuf *p)
 {
 	struct gmac_device *ps_gmac_dev = netif->state;
 	struct pbuf *q = NULL;
+	SYS_ARCH_DECL_PROTECT(lev);
+#if ETHERNET_CONF_TX_ZERO_COPY
+	uint32_t ul_count = 0;
+	uint32_t ul_free = 0;
+	uint32_t ul_index = 0;
+	uint32_t ul_first = 0;
+	uint32_t ul_status = 0;
+#else
 	uint8_t *buffer = 0;
+#endif
 
 	/* Handle GMAC underrun or AHB errors. */
 	if (gmac_get_tx_status(GMAC) & GMAC_TX_ERRORS) {
-		LWIP_DEBUGF(NETIF_DEBUG, ("gmac_low_level_output: GMAC ERROR, reinit TX...\n"));
+		LWIP_DEBUGF(NETIF_DEBUG, ("gmac_low_level_output: GMAC ERROR, requeue TX...\n"));
 
 		gmac_enable_transmit(GMAC, false);
 
 		LINK_STATS_INC(link.err);
-		LINK_STATS_INC(link.drop);
 
-		/* Reinit TX descriptors. */
-		gmac_tx_init(ps_gmac_dev);
+		/* Free sent frames and restart with the frames that are still pending. */
+		gmac_tx_reclaim(ps_gmac_dev);
+		gmac_tx_requeue(ps_gmac_dev);
 
 		/* Clear error status. */
 		gmac_clear_tx_status(GMAC, GMAC_TX_ERRORS);
@@ -412,6 +605,93 @@ static err_t gmac_low_level_output(struct netif *netif, struct pbuf *p)
 		gmac_enable_transmit(GMAC, true);
 	}
 
+	/* Give descriptors of frames that are already sent back to the ring. */
+	gmac_tx_reclaim(ps_gmac_dev);
+
+#if ETHERNET_CONF_TX_ZERO_COPY
+	/* Count the descriptors needed, one per non-empty pbuf. */
+	for (q = p; q != NULL; q = q->next) {
+		if (q->len == 0) {
+			continue;
+		}
+
+		if (!gmac_tx_is_dma_capable(q->payload)) {
+			ul_count = GMAC_TX_BUFFERS;
+			break;
+		}
+		ul_count++;
+	}
+
+	if (ul_count >= GMAC_TX_BUFFERS) {
+		/* Chain too long for the ring or payload not readable by GMAC (e.g.
+		   PBUF_ROM in flash): Send a contiguous copy instead. */
+		q = pbuf_clone(PBUF_RAW, PBUF_RAM, p);
+		if (q == NULL) {
+			LINK_STATS_INC(link.memerr);
+			return ERR_MEM;
+		}
+		ul_count = 1;
+	} else {
+		/* Keep the pbufs alive until the GMAC has sent them. */
+		pbuf_ref(p);
+		q = p;
+	}
+
+	SYS_ARCH_PROTECT(lev);
+
+	/* One descriptor always stays free, head == tail means empty ring. */
+	ul_free = (ps_gmac_dev->us_tx_tail + GMAC_TX_BUFFERS - ps_gmac_dev->us_tx_idx - 1) % GMAC_TX_BUFFERS;
+	if (ul_count > ul_free) {
+		/* Ring is full, lwIP has to retry later. */
+		SYS_ARCH_UNPROTECT(lev);
+		pbuf_free(q);
+		LINK_STATS_INC(link.memerr);
+		return ERR_MEM;
+	}
+
+	/* Chain the payloads, the first descriptor stays used until the frame is complete. */
+	ul_first = ps_gmac_dev->us_tx_idx;
+	ul_index = ul_first;
+	ps_gmac_dev->tx_pbuf[ul_first] = q;
+	for (; q != NULL; q = q->next) {
+		if (q->len == 0) {
+			continue;
+		}
+
+		ul_status = q->len & GMAC_TXD_LEN_MASK;
+		if (ul_index == ul_first) {
+			ul_status |= GMAC_TXD_USED;
+		}
+		if (--ul_count == 0) {
+			ul_status |= GMAC_TXD_LAST;
+		}
+		if (ul_index == GMAC_TX_BUFFERS - 1) {
+			ul_status |= GMAC_TXD_WRAP;
+		}
+
+		ps_gmac_dev->tx_desc[ul_index].addr = (uint32_t)q->payload;
+		ps_gmac_dev->tx_desc[ul_index].status.val = ul_status;
+		ul_index = (ul_index + 1) % GMAC_TX_BUFFERS;
+	}
+	ps_gmac_dev->us_tx_idx = ul_index;
+
+	/* Hand the frame to GMAC. */
+	__DMB();
+	ps_gmac_dev->tx_desc[ul_first].status.val &= ~GMAC_TXD_USED;
+
+	SYS_ARCH_UNPROTECT(lev);
+
+	LWIP_DEBUGF(NETIF_DEBUG,
+			("gmac_low_level_output: DMA chain sent, size=%d [idx=%u]\n",
+			p->tot_len, ul_first));
+#else
+	/* One descriptor always stays free, head == tail means empty ring. */
+	if (((ps_gmac_dev->us_tx_idx + 1) % GMAC_TX_BUFFERS) == ps_gmac_dev->us_tx_tail) {
+		/* Ring is full, lwIP has to retry later. */
+		LINK_STATS_INC(link.memerr);
+		return ERR_MEM;
+	}
+
 	buffer = (uint8_t*)ps_gmac_dev->tx_desc[ps_gmac_dev->us_tx_idx].addr;
 
 	/* Copy pbuf chain into TX buffer. */
@@ -420,6 +700,8 @@ static err_t gmac_low_level_output(struct netif *netif, struct pbuf *p)
 		buffer += q->len;
 	}
 
+	SYS_ARCH_PROTECT(lev);
+
 	/* Set len and mark the buffer to be sent by GMAC. */
 	ps_gmac_dev->tx_desc[ps_gmac_dev->us_tx_idx].status.bm.b_len = p->tot_len;
 	ps_gmac_dev->tx_desc[ps_gmac_dev->us_tx_idx].status.bm.b_used = 0;
@@ -430,6 +712,9 @@ static err_t gmac_low_level_output(struct netif *netif, struct pbuf *p)
 
 	ps_gmac_dev->us_tx_idx = (ps_gmac_dev->us_tx_idx + 1) % GMAC_TX_BUFFERS;
 
+	SYS_ARCH_UNPROTECT(lev);
+#endif
+
 	/* Now start to transmission. */
 	gmac_start_transmission(GMAC);
 
@@ -442,22 +727,14 @@ static err_t gmac_low_level_output(struct netif *netif, struct pbuf *p)
 }
 
 /**
- * \brief Use pre-allocated pbuf as DMA source and return the incoming packet.
- *
- * \param netif the lwIP network interface structure for this ethernetif.
+ * \brief Handle GMAC RX overrun or AHB errors by reinitializing the RX ring.
  *
- * \return a pbuf filled with the received packet (including MAC header).
- * 0 on memory error.
+ * \param ps_gmac_dev Pointer to driver data structure.
  */
-static struct pbuf *gmac_low_level_input(struct netif *netif)
+static void gmac_rx_handle_errors(struct gmac_device *ps_gmac_dev)
 {
-	struct gmac_device *ps_gmac_dev = netif->state;
-	struct pbuf *p = 0;
-	uint32_t length = 0;
 	uint32_t ul_index = 0;
-	gmac_rx_descriptor_t *p_rx = &ps_gmac_dev->rx_desc[ps_gmac_dev->us_rx_idx];
 
-	/* Handle GMAC overrun or AHB errors. */
 	if (gmac_get_rx_status(GMAC) & GMAC_RX_ERRORS) {
 
 		gmac_enable_receive(GMAC, false);
@@ -473,7 +750,7 @@ static struct pbuf *gmac_low_level_input(struct netif *netif)
 			}
 		}
 
-		/* Reinit TX descriptors. */
+		/* Reinit RX descriptors. */
 		gmac_rx_init(ps_gmac_dev);
 
 		/* Clear error status. */
@@ -481,83 +758,72 @@ static struct pbuf *gmac_low_level_input(struct netif *netif)
 
 		gmac_enable_receive(GMAC, true);
 	}
+}
 
-	/* Check that a packet has been received and processed by GMAC. */
-	if ((p_rx->addr.val & GMAC_RXD_OWNERSHIP) == GMAC_RXD_OWNERSHIP) {
-		/* Packet is a SOF since packet size is set to maximum. */
-		length = p_rx->status.val & GMAC_RXD_LEN_MASK;
+/**
+ * \brief Take up to ul_budget received frames out of the RX descriptor ring.
+ * The pre-allocated pbufs that were used as DMA target are returned, the
+ * descriptors are refilled later in one go by gmac_rx_populate_queue().
+ *
+ * \param ps_gmac_dev Pointer to driver data structure.
+ * \param pp_frames Array that is filled with the received frames
+ * (including MAC header).
+ * \param ul_budget Maximum number of frames to take.
+ *
+ * \return Number of frames in pp_frames.
+ */
+static uint32_t gmac_rx_poll(struct gmac_device *ps_gmac_dev, struct pbuf **pp_frames, uint32_t ul_budget)
+{
+	struct pbuf *p = 0;
+	uint32_t length = 0;
+	uint32_t ul_count = 0;
+	gmac_rx_descriptor_t *p_rx;
 
-		/* Fetch pre-allocated pbuf. */
+	while (ul_count < ul_budget) {
+		p_rx = &ps_gmac_dev->rx_desc[ps_gmac_dev->us_rx_idx];
 		p = ps_gmac_dev->rx_pbuf[ps_gmac_dev->us_rx_idx];
-		p->len = length;
 
-		/* Remove this pbuf from its desriptor. */
+		/* Check that a packet has been received and processed by GMAC. */
+		if (((p_rx->addr.val & GMAC_RXD_OWNERSHIP) == 0) || (p == 0)) {
+			break;
+		}
+
+		/* Packet is a SOF since packet size is set to maximum. */
+		length = p_rx->status.val & GMAC_RXD_LEN_MASK;
+
+		/* Remove this pbuf from its desriptor, it stays owned by software until refilled. */
 		ps_gmac_dev->rx_pbuf[ps_gmac_dev->us_rx_idx] = 0;
 
 		LWIP_DEBUGF(NETIF_DEBUG,
-				("gmac_low_level_input: DMA buffer %p received, size=%u [idx=%u]\n",
+				("gmac_rx_poll: DMA buffer %p received, size=%u [idx=%u]\n",
 				p, length, ps_gmac_dev->us_rx_idx));
 
 		/* Set pbuf total packet size. */
+		p->len = length;
 		p->tot_len = length;
 		LINK_STATS_INC(link.recv);
 
-		/* Fill empty descriptors with new pbufs. */
-		gmac_rx_populate_queue(ps_gmac_dev);
-
-		/* Mark the descriptor ready for transfer. */
-		p_rx->addr.val &= ~(GMAC_RXD_OWNERSHIP);
+		pp_frames[ul_count++] = p;
 
 		ps_gmac_dev->us_rx_idx = (ps_gmac_dev->us_rx_idx + 1) % GMAC_RX_BUFFERS;
 
 #if LWIP_STATS
-	lwip_rx_count += length;
+		lwip_rx_count += length;
 #endif
 	}
 
-	return p;
-}
-
-#if NO_SYS == 0
-/**
- * \brief GMAC task function. This function waits for the notification
- * semaphore from the interrupt, processes the incoming packet and then
- * passes it to the lwIP stack.
- *
- * \param pvParameters A pointer to the gmac_device instance.
- */
-static void gmac_task(void *pvParameters)
-{
-	struct gmac_device *ps_gmac_dev = pvParameters;
-
-	while (1) {
-		/* Wait for the RX notification semaphore. */
-		sys_arch_sem_wait(&ps_gmac_dev->rx_sem, 0);
-
-		/* Process the incoming packet. */
-		ethernetif_input(ps_gmac_dev->netif);
-	}
+	return ul_count;
 }
-#endif
 
 /**
- * \brief This function should be called when a packet is ready to be
- * read from the interface. It uses the function gmac_low_level_input()
- * that handles the actual reception of bytes from the network interface.
- * Then the type of the received packet is determined and the appropriate
- * input function is called.
+ * \brief Pass a received frame to lwIP according to its ethernet type.
  *
  * \param netif the lwIP network interface structure for this ethernetif.
+ * \param p the received frame.
  */
-void ethernetif_input(struct netif *netif)
+static void gmac_input_frame(struct netif *netif, struct pbuf *p)
 {
 	struct eth_hdr *ethhdr;
-	struct pbuf *p;
-
-	/* Move received packet into a new pbuf. */
-	p = gmac_low_level_input(netif);
-	if (p == NULL)
-		return;
 
 	/* Points to packet payload, which starts with an Ethernet header. */
 	ethhdr = p->payload;
@@ -584,6 +850,104 @@ void ethernetif_input(struct netif *netif)
 	}
 }
 
+/**
+ * \brief Process one batch of up to ETHERNET_CONF_RX_BUDGET received frames.
+ *
+ * \param netif the lwIP network interface structure for this ethernetif.
+ *
+ * \return Number of frames processed, ETHERNET_CONF_RX_BUDGET if more
+ * frames may be waiting.
+ */
+static uint32_t gmac_input_batch(struct netif *netif)
+{
+	struct gmac_device *ps_gmac_dev = netif->state;
+	struct pbuf *p_frames[ETHERNET_CONF_RX_BUDGET];
+	uint32_t ul_count;
+	uint32_t ul_index;
+
+	/* Give descriptors of sent frames back to the ring (TCOMP). */
+	gmac_tx_reclaim(ps_gmac_dev);
+
+	gmac_rx_handle_errors(ps_gmac_dev);
+
+	ul_count = gmac_rx_poll(ps_gmac_dev, p_frames, ETHERNET_CONF_RX_BUDGET);
+
+	/* Fill empty descriptors with new pbufs before lwIP processes the frames.
+	   If the next descriptor has no pbuf (PBUF_POOL was empty), GMAC stopped
+	   there and it has to be refilled even if nothing was received. */
+	if ((ul_count > 0) || (ps_gmac_dev->rx_pbuf[ps_gmac_dev->us_rx_idx] == 0)) {
+		gmac_rx_populate_queue(ps_gmac_dev);
+	}
+
+	for (ul_index = 0; ul_index < ul_count; ul_index++) {
+		gmac_input_frame(netif, p_frames[ul_index]);
+	}
+
+	return ul_count;
+}
+
+#if NO_SYS == 0
+/**
+ * \brief Check if GMAC has written a frame to the next RX descriptor.
+ *
+ * \param ps_gmac_dev Pointer to driver data structure.
+ *
+ * \return true if gmac_rx_poll() would take a frame.
+ */
+static bool gmac_rx_frame_pending(struct gmac_device *ps_gmac_dev)
+{
+	return (ps_gmac_dev->rx_pbuf[ps_gmac_dev->us_rx_idx] != 0) &&
+			(ps_gmac_dev->rx_desc[ps_gmac_dev->us_rx_idx].addr.val & GMAC_RXD_OWNERSHIP);
+}
+
+/**
+ * \brief GMAC task function. This function waits for the notification
+ * semaphore from the interrupt, processes the incoming packet and then
+ * passes it to the lwIP stack.
+ *
+ * \param pvParameters A pointer to the gmac_device instance.
+ */
+static void gmac_task(void *pvParameters)
+{
+	struct gmac_device *ps_gmac_dev = pvParameters;
+
+	while (1) {
+		/* Wait for the RX notification semaphore. If the next descriptor is
+		   still waiting for a pbuf, retry the refill after a timeout. */
+		sys_arch_sem_wait(&ps_gmac_dev->rx_sem,
+				(ps_gmac_dev->rx_pbuf[ps_gmac_dev->us_rx_idx] == 0) ? ETHERNET_CONF_RX_REFILL_RETRY_MS : 0);
+
+		do {
+			/* Process the incoming packets until the RX ring is drained. */
+			while (gmac_input_batch(ps_gmac_dev->netif) == ETHERNET_CONF_RX_BUDGET) {
+			}
+
+#if ETHERNET_CONF_RX_COALESCE
+			gmac_enable_interrupt(GMAC, GMAC_IER_RCOMP);
+#endif
+			/* A frame that arrived while RCOMP was masked does not necessarily
+			   raise the interrupt after unmasking: ISR is clear on read, so the
+			   flag may already have been consumed by another interrupt (e.g.
+			   TCOMP). Check the ring again before blocking. */
+		} while (gmac_rx_frame_pending(ps_gmac_dev));
+	}
+}
+#endif
+
+/**
+ * \brief This function should be called when a packet is ready to be
+ * read from the interface. It uses the function gmac_rx_poll() that takes
+ * up to ETHERNET_CONF_RX_BUDGET received frames from the RX ring. Then the
+ * type of each received packet is determined and the appropriate input
+ * function is called.
+ *
+ * \param netif the lwIP network interface structure for this ethernetif.
+ */
+void ethernetif_input(struct netif *netif)
+{
+	gmac_input_batch(netif);
+}
+
 /**
  * \brief Should be called at the beginning of the program to set up the
  * network interface. It calls the function gmac_low_level_init() to do the
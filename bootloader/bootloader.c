@@ -24,6 +24,8 @@
 #include "configs/config.h"
 
 #include "bricklib2/hal/system_timer/system_timer.h"
+#include "bricklib2/protocols/tfp/tfp_statistics.h"
+#include "bricklib2/os/coop_task.h"
 #include "communication.h"
 
 const uint32_t end_of_regular_firmware_magic_number __attribute__ ((used, section(".end_of_regular_firmware_magic_number"))) = 0x12345678; // Put 0x12345678 at end of firmware, so the flash tools knows that it only has to flash up to here
@@ -119,6 +121,23 @@ void bootloader_tinydma_channel_init(const uint8_t channel_id, TinyDmaChannelCon
 }
 #endif
 
+#if defined(TFP_STATISTICS_ENABLED) || defined(COOP_TASK_DEBUG_STATISTICS)
+#define BOOTLOADER_HANDLE_MESSAGE_WITH_STATISTICS
+
+// Wraps the firmware handle_message function that is called by the bootloader,
+// so we can record the statistics without any changes in the bootloader itself.
+static BootloaderHandleMessageResponse bootloader_handle_message_with_statistics(const void *message, void *response) {
+	if(TFP_STATISTICS_HANDLE_MESSAGE(message, response) || COOP_TASK_STATISTICS_HANDLE_MESSAGE(message, response)) {
+		return HANDLE_MESSAGE_RESPONSE_NEW_MESSAGE;
+	}
+
+	TFP_STATISTICS_START(statistics_start_us);
+	const BootloaderHandleMessageResponse handle_message_return = handle_message(message, response);
+	TFP_STATISTICS_STOP(tfp_get_fid_from_message(message), statistics_start_us, (handle_message_return == HANDLE_MESSAGE_RESPONSE_NOT_SUPPORTED) || (handle_message_return == HANDLE_MESSAGE_RESPONSE_INVALID_PARAMETER));
+
+	return handle_message_return;
+}
+#endif
 
 void bootloader_init(void) {
 #ifdef __SAM0__
@@ -132,7 +151,11 @@ void bootloader_init(void) {
 	bootloader_status.led_flicker_state.config  = LED_FLICKER_CONFIG_STATUS;
 	bootloader_status.led_flicker_state.counter = 0;
 	bootloader_status.led_flicker_state.start   = 0;
+#ifdef BOOTLOADER_HANDLE_MESSAGE_WITH_STATISTICS
+	bootloader_status.firmware_handle_message_func = bootloader_handle_message_with_statistics;
+#else
 	bootloader_status.firmware_handle_message_func = handle_message;
+#endif
 
 	bootloader_firmware_entry(&bootloader_functions, &bootloader_status);
 }
@@ -34,6 +34,23 @@
 #define XMC_USIC_CH_FIFO_SIZE_32WORDS 5
 #define XMC_USIC_CH_FIFO_SIZE_64WORDS 6
 #include "bootloader.h"
+#include "bricklib2/hal/usic_fifo/usic_fifo.h"
+
+#ifndef BOOTLOADER_USE_MEMORY_OPTIMIZED_IRQ_HANDLER
+#if   SPITFP_TX_SIZE == XMC_USIC_CH_FIFO_SIZE_2WORDS
+#define SPITFP_TX_FIFO_WORDS 2
+#elif SPITFP_TX_SIZE == XMC_USIC_CH_FIFO_SIZE_4WORDS
+#define SPITFP_TX_FIFO_WORDS 4
+#elif SPITFP_TX_SIZE == XMC_USIC_CH_FIFO_SIZE_8WORDS
+#define SPITFP_TX_FIFO_WORDS 8
+#elif SPITFP_TX_SIZE == XMC_USIC_CH_FIFO_SIZE_16WORDS
+#define SPITFP_TX_FIFO_WORDS 16
+#elif SPITFP_TX_SIZE == XMC_USIC_CH_FIFO_SIZE_32WORDS
+#define SPITFP_TX_FIFO_WORDS 32
+#else
+	#error "Invalid spitfp tx size"
+#endif
+#endif
 
 // The irqs are compiled for bootloader as well as firmware
 #ifndef SPITFP_IRQ_RX_HANDLER
@@ -115,20 +132,7 @@ void __attribute__((optimize("-O3"))) __attribute__((section (".ram_code"))) SPI
 
 	const uint8_t to_send = buffer_send_pointer_end - buffer_send_pointer;
 
-#if   SPITFP_TX_SIZE == XMC_USIC_CH_FIFO_SIZE_2WORDS
-	const uint8_t fifo_level = 2  - XMC_USIC_CH_TXFIFO_GetLevel(SPITFP_USIC);
-#elif SPITFP_TX_SIZE == XMC_USIC_CH_FIFO_SIZE_4WORDS
-	const uint8_t fifo_level = 4  - XMC_USIC_CH_TXFIFO_GetLevel(SPITFP_USIC);
-#elif SPITFP_TX_SIZE == XMC_USIC_CH_FIFO_SIZE_8WORDS
-	const uint8_t fifo_level = 8  - XMC_USIC_CH_TXFIFO_GetLevel(SPITFP_USIC);
-#elif SPITFP_TX_SIZE == XMC_USIC_CH_FIFO_SIZE_16WORDS
-	const uint8_t fifo_level = 16 - XMC_USIC_CH_TXFIFO_GetLevel(SPITFP_USIC);
-#elif SPITFP_TX_SIZE == XMC_USIC_CH_FIFO_SIZE_32WORDS
-	const uint8_t fifo_level = 32 - XMC_USIC_CH_TXFIFO_GetLevel(SPITFP_USIC);
-#else
-	#error "Invalid spitfp tx size"
-#endif
-
+	const uint8_t fifo_level = SPITFP_TX_FIFO_WORDS - XMC_USIC_CH_TXFIFO_GetLevel(SPITFP_USIC);
 	const uint8_t length = MIN(to_send, fifo_level);
 
 	// Use local pointer to save the time for accessing the struct
@@ -151,57 +155,12 @@ void __attribute__((optimize("-O3"))) __attribute__((section (".ram_code"))) SPI
 	__disable_irq();
 #endif
 
-#pragma GCC diagnostic push
-#pragma GCC diagnostic ignored "-Wimplicit-fallthrough"
-	switch(length) {
-#if (SPITFP_TX_SIZE == XMC_USIC_CH_FIFO_SIZE_32WORDS)
-		case 32: SPITFP_USIC_IN_PTR[0] = *buffer_send_pointer; buffer_send_pointer++;
-		case 31: SPITFP_USIC_IN_PTR[0] = *buffer_send_pointer; buffer_send_pointer++;
-		case 30: SPITFP_USIC_IN_PTR[0] = *buffer_send_pointer; buffer_send_pointer++;
-		case 29: SPITFP_USIC_IN_PTR[0] = *buffer_send_pointer; buffer_send_pointer++;
-		case 28: SPITFP_USIC_IN_PTR[0] = *buffer_send_pointer; buffer_send_pointer++;
-		case 27: SPITFP_USIC_IN_PTR[0] = *buffer_send_pointer; buffer_send_pointer++;
-		case 26: SPITFP_USIC_IN_PTR[0] = *buffer_send_pointer; buffer_send_pointer++;
-		case 25: SPITFP_USIC_IN_PTR[0] = *buffer_send_pointer; buffer_send_pointer++;
-		case 24: SPITFP_USIC_IN_PTR[0] = *buffer_send_pointer; buffer_send_pointer++;
-		case 23: SPITFP_USIC_IN_PTR[0] = *buffer_send_pointer; buffer_send_pointer++;
-		case 22: SPITFP_USIC_IN_PTR[0] = *buffer_send_pointer; buffer_send_pointer++;
-		case 21: SPITFP_USIC_IN_PTR[0] = *buffer_send_pointer; buffer_send_pointer++;
-		case 20: SPITFP_USIC_IN_PTR[0] = *buffer_send_pointer; buffer_send_pointer++;
-		case 19: SPITFP_USIC_IN_PTR[0] = *buffer_send_pointer; buffer_send_pointer++;
-		case 18: SPITFP_USIC_IN_PTR[0] = *buffer_send_pointer; buffer_send_pointer++;
-		case 17: SPITFP_USIC_IN_PTR[0] = *buffer_send_pointer; buffer_send_pointer++;
-#endif
-
-#if (SPITFP_TX_SIZE == XMC_USIC_CH_FIFO_SIZE_16WORDS) || (SPITFP_TX_SIZE == XMC_USIC_CH_FIFO_SIZE_32WORDS)
-		case 16: SPITFP_USIC_IN_PTR[0] = *buffer_send_pointer; buffer_send_pointer++;
-		case 15: SPITFP_USIC_IN_PTR[0] = *buffer_send_pointer; buffer_send_pointer++;
-		case 14: SPITFP_USIC_IN_PTR[0] = *buffer_send_pointer; buffer_send_pointer++;
-		case 13: SPITFP_USIC_IN_PTR[0] = *buffer_send_pointer; buffer_send_pointer++;
-		case 12: SPITFP_USIC_IN_PTR[0] = *buffer_send_pointer; buffer_send_pointer++;
-		case 11: SPITFP_USIC_IN_PTR[0] = *buffer_send_pointer; buffer_send_pointer++;
-		case 10: SPITFP_USIC_IN_PTR[0] = *buffer_send_pointer; buffer_send_pointer++;
-		case 9:  SPITFP_USIC_IN_PTR[0] = *buffer_send_pointer; buffer_send_pointer++;
-#endif
-
-#if (SPITFP_TX_SIZE == XMC_USIC_CH_FIFO_SIZE_8WORDS) || (SPITFP_TX_SIZE == XMC_USIC_CH_FIFO_SIZE_16WORDS) || (SPITFP_TX_SIZE == XMC_USIC_CH_FIFO_SIZE_32WORDS)
-		case 8:  SPITFP_USIC_IN_PTR[0] = *buffer_send_pointer; buffer_send_pointer++;
-		case 7:  SPITFP_USIC_IN_PTR[0] = *buffer_send_pointer; buffer_send_pointer++;
-		case 6:  SPITFP_USIC_IN_PTR[0] = *buffer_send_pointer; buffer_send_pointer++;
-		case 5:  SPITFP_USIC_IN_PTR[0] = *buffer_send_pointer; buffer_send_pointer++;
-#endif
-
-#if (SPITFP_TX_SIZE == XMC_USIC_CH_FIFO_SIZE_4WORDS) || (SPITFP_TX_SIZE == XMC_USIC_CH_FIFO_SIZE_8WORDS) || (SPITFP_TX_SIZE == XMC_USIC_CH_FIFO_SIZE_16WORDS) || (SPITFP_TX_SIZE == XMC_USIC_CH_FIFO_SIZE_32WORDS)
-		case 4:  SPITFP_USIC_IN_PTR[0] = *buffer_send_pointer; buffer_send_pointer++;
-		case 3:  SPITFP_USIC_IN_PTR[0] = *buffer_send_pointer; buffer_send_pointer++;
-#endif
-
-		case 2:  SPITFP_USIC_IN_PTR[0] = *buffer_send_pointer; buffer_send_pointer++;
-		case 1:  SPITFP_USIC_IN_PTR[0] = *buffer_send_pointer; buffer_send_pointer++;
-
-		default: case 0: break;
+	// Tell GCC that length can't be bigger than the FIFO, so it only keeps the needed
+	// part of the unrolled write (this handler runs from RAM, size matters)
+	if(length > SPITFP_TX_FIFO_WORDS) {
+		__builtin_unreachable();
 	}
-#pragma GCC diagnostic pop
+	buffer_send_pointer = (uint8_t *)usic_fifo_write_block(SPITFP_USIC_IN_PTR, buffer_send_pointer, length);
 
 #ifndef SPITFP_NOT_ALLOWED_TO_DISABLE_IRQ
 	__enable_irq();
@@ -1 +1,6 @@
 #include "bricklib2/asf/common/components/memory/sd_mmc/sd_mmc.h"
+
+// Added in asf_overwrite/common/components/memory/sd_mmc/sd_mmc.c:
+// Read/write nb_block blocks with one CMD18/CMD25 (e.g. for FatFs disk_read/disk_write with count > 1)
+sd_mmc_err_t sd_mmc_read_blocks(uint8_t slot, uint32_t start, void *dest, uint16_t nb_block);
+sd_mmc_err_t sd_mmc_write_blocks(uint8_t slot, uint32_t start, const void *src, uint16_t nb_block);
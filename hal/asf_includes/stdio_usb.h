@@ -1 +1,13 @@
 #include "bricklib2/asf/common/utils/stdio/stdio_usb/stdio_usb.h"
+
+#if __has_include("configs/config_asf_overwrite.h")
+#include "configs/config_asf_overwrite.h"
+#endif
+
+#ifdef STDIO_USB_BUFFERED
+// Added in asf_overwrite/common/utils/stdio/stdio_usb/stdio_usb.c:
+// Moves buffered output to the CDC endpoint, call from UDC_SOF_EVENT and UDI_CDC_TX_EMPTY_NOTIFY
+void stdio_usb_flush(void);
+// Number of bytes dropped because the buffer was full or the CDC interface was disabled
+uint32_t stdio_usb_get_dropped(void);
+#endif
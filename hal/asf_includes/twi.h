@@ -1 +1,57 @@
 #include "bricklib2/asf/sam/drivers/twi/twi.h"
+
+#if __has_include("configs/config_asf_overwrite.h")
+#include "configs/config_asf_overwrite.h"
+#endif
+
+#ifdef TWI_ASYNC_ENABLE
+// Added in asf_overwrite/sam/drivers/twi/twi.c:
+// Interrupt/PDC driven master transfers. Transfers are queued with twi_async_submit and
+// completed from twi_async_handler (call it from TWIx_Handler). twi_async_tick has to be
+// called periodically from the main loop, it aborts transfers that take longer than the
+// timeout and recovers the bus (9 clock pulses plus STOP on the SCL/SDA pins).
+// Timeouts and the recovery clock use the DWT cycle counter, not SysTick.
+#include "pio.h"
+
+typedef struct twi_async_transfer twi_async_transfer_t;
+typedef void (*twi_async_callback_t)(twi_async_transfer_t *p_transfer);
+
+// A transfer has to stay valid until it is done
+struct twi_async_transfer {
+	twi_packet_t packet;            // chip, internal address, buffer and length
+	bool read;
+	twi_async_callback_t callback;  // Called from interrupt/tick context, can be NULL
+	void *opaque;
+
+	volatile bool done;
+	volatile uint32_t status;       // TWI_SUCCESS, TWI_RECEIVE_NACK, TWI_ARBITRATION_LOST or TWI_ERROR_TIMEOUT
+
+	twi_async_transfer_t *next;
+};
+
+typedef struct {
+	Twi *p_twi;
+	Pio *p_pio;                     // PIO of SCL/SDA for bus recovery, can be NULL
+	uint32_t ul_scl_mask;
+	uint32_t ul_sda_mask;
+	uint32_t ul_timeout_cycles;     // Transfer timeout in DWT cycle counter ticks
+
+	twi_async_transfer_t *volatile p_head; // Active transfer
+	twi_async_transfer_t *p_tail;
+	volatile bool b_recovery;       // twi_async_tick is recovering the bus, nothing is started
+	uint32_t ul_state;
+	uint32_t ul_start_cycles;
+	uint32_t ul_cwgr;               // Clock waveform to restore after a peripheral reset
+} twi_async_t;
+
+void twi_async_init(twi_async_t *p_async, Twi *p_twi, Pio *p_pio, uint32_t ul_scl_mask, uint32_t ul_sda_mask, uint32_t ul_timeout_ms);
+uint32_t twi_async_submit(twi_async_t *p_async, twi_async_transfer_t *p_transfer);
+void twi_async_handler(twi_async_t *p_async);
+void twi_async_tick(twi_async_t *p_async);
+uint32_t twi_bus_recovery(Pio *p_pio, uint32_t ul_scl_mask, uint32_t ul_sda_mask);
+
+static inline bool twi_async_is_idle(twi_async_t *p_async)
+{
+	return (p_async->p_head == NULL) && !p_async->b_recovery;
+}
+#endif
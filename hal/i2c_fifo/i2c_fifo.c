@@ -27,6 +27,7 @@
 
 #include "bricklib2/hal/system_timer/system_timer.h"
 #include "bricklib2/logging/logging.h"
+#include "bricklib2/utility/util_definitions.h"
 
 #ifndef I2C_FIFO_TIMEOUT
 #define I2C_FIFO_TIMEOUT 10 // in ms
@@ -281,6 +282,12 @@ void i2c_fifo_init(I2CFifo *i2c_fifo) {
 	XMC_USIC_CH_TXFIFO_Configure(i2c_fifo->i2c, i2c_fifo->sda_fifo_pointer, i2c_fifo->sda_fifo_size, 0);
 	XMC_USIC_CH_RXFIFO_Configure(i2c_fifo->i2c, i2c_fifo->scl_fifo_pointer, i2c_fifo->scl_fifo_size, 0);
 
+#ifdef I2C_FIFO_QUEUE_IRQ_ENABLE
+	// The events are only enabled while a queued transaction is running, the NVIC is configured by the user
+	XMC_USIC_CH_TXFIFO_SetInterruptNodePointer(i2c_fifo->i2c, XMC_USIC_CH_TXFIFO_INTERRUPT_NODE_POINTER_STANDARD, i2c_fifo->queue_tx_service_request);
+	XMC_USIC_CH_RXFIFO_SetInterruptNodePointer(i2c_fifo->i2c, XMC_USIC_CH_RXFIFO_INTERRUPT_NODE_POINTER_STANDARD, i2c_fifo->queue_rx_service_request);
+#endif
+
 	XMC_I2C_CH_Start(i2c_fifo->i2c);
 
 	XMC_GPIO_Init(i2c_fifo->sda_port, i2c_fifo->sda_pin, &sda_pin_config);
@@ -486,4 +493,375 @@ uint32_t i2c_fifo_coop_write_direct(I2CFifo *i2c_fifo, const uint32_t length, co
 	}
 }
 
-#endif
\ No newline at end of file
+#endif
+
+
+#ifdef I2C_FIFO_QUEUE_ENABLE
+
+#define I2C_FIFO_WORDS(size) (1 << (size))
+
+#define I2C_FIFO_STATUS_ERROR_MASK (XMC_I2C_CH_STATUS_FLAG_NACK_RECEIVED | \
+                                    XMC_I2C_CH_STATUS_FLAG_ARBITRATION_LOST | \
+                                    XMC_I2C_CH_STATUS_FLAG_ERROR | \
+                                    XMC_I2C_CH_STATUS_FLAG_WRONG_TDF_CODE_FOUND)
+
+// Command sequence of a transaction:
+// start, [register bytes, [restart (read)]], data/ACK..NACK, [stop]
+static uint16_t i2c_fifo_queue_command_length(const I2CFifoTransaction *t) {
+	uint16_t length = 1 + t->length;
+	if(t->flags & I2C_FIFO_TRANSACTION_FLAG_REGISTER) {
+		length += I2C_FIFO_REG_SIZE;
+		if(t->flags & I2C_FIFO_TRANSACTION_FLAG_READ) {
+			length++;
+		}
+	}
+	if(!(t->flags & I2C_FIFO_TRANSACTION_FLAG_NO_STOP)) {
+		length++;
+	}
+
+	return length;
+}
+
+// Returns the TDF command at index. Sets receive to true for ACK/NACK commands.
+static uint32_t i2c_fifo_queue_command(const I2CFifo *i2c_fifo, const I2CFifoTransaction *t, uint16_t index, bool *receive) {
+	const bool read = t->flags & I2C_FIFO_TRANSACTION_FLAG_READ;
+	*receive = false;
+
+	if(index == 0) {
+		const uint32_t start = i2c_fifo->queue_restart ? XMC_I2C_CH_TDF_MASTER_RESTART : XMC_I2C_CH_TDF_MASTER_START;
+		if(read && !(t->flags & I2C_FIFO_TRANSACTION_FLAG_REGISTER)) {
+			return start | XMC_I2C_CH_CMD_READ | (t->address << 1);
+		}
+		return start | (t->address << 1);
+	}
+	index--;
+
+	if(t->flags & I2C_FIFO_TRANSACTION_FLAG_REGISTER) {
+		if(index < I2C_FIFO_REG_SIZE) {
+			return XMC_I2C_CH_TDF_MASTER_SEND | ((t->reg >> ((I2C_FIFO_REG_SIZE - 1 - index)*8)) & 0xFF);
+		}
+		index -= I2C_FIFO_REG_SIZE;
+
+		if(read) {
+			if(index == 0) {
+				return XMC_I2C_CH_TDF_MASTER_RESTART | XMC_I2C_CH_CMD_READ | (t->address << 1);
+			}
+			index--;
+		}
+	}
+
+	if(index < t->length) {
+		if(read) {
+			*receive = true;
+			return (index == t->length - 1) ? XMC_I2C_CH_TDF_MASTER_RECEIVE_NACK : XMC_I2C_CH_TDF_MASTER_RECEIVE_ACK;
+		}
+		return XMC_I2C_CH_TDF_MASTER_SEND | t->data[index];
+	}
+
+	return XMC_I2C_CH_TDF_MASTER_STOP;
+}
+
+static void i2c_fifo_queue_finish(I2CFifo *i2c_fifo, const uint32_t status) {
+	I2CFifoTransaction *t = i2c_fifo->queue_head;
+
+	i2c_fifo->queue_head = t->next;
+	if(i2c_fifo->queue_head == NULL) {
+		i2c_fifo->queue_tail = NULL;
+	}
+	i2c_fifo->queue_active  = NULL;
+	i2c_fifo->queue_restart = (status == 0) && (t->flags & I2C_FIFO_TRANSACTION_FLAG_NO_STOP);
+
+	t->next   = NULL;
+	t->status = status;
+	t->done   = true;
+	if(t->done_func != NULL) {
+		t->done_func(t);
+	}
+#ifdef I2C_FIFO_COOP_ENABLE
+	coop_task_wait_queue_notify(&t->wait_queue);
+#endif
+}
+
+// Fails the running transaction and the rest of its repeated start sequence
+static void i2c_fifo_queue_fail(I2CFifo *i2c_fifo, const uint32_t status) {
+	bool no_stop;
+	do {
+		no_stop = i2c_fifo->queue_head->flags & I2C_FIFO_TRANSACTION_FLAG_NO_STOP;
+		i2c_fifo_queue_finish(i2c_fifo, status);
+	} while(no_stop && (i2c_fifo->queue_head != NULL));
+
+	i2c_fifo->i2c_status = status;
+}
+
+static void i2c_fifo_queue_disable_events(I2CFifo *i2c_fifo) {
+#ifdef I2C_FIFO_QUEUE_IRQ_ENABLE
+	XMC_USIC_CH_TXFIFO_DisableEvent(i2c_fifo->i2c, XMC_USIC_CH_TXFIFO_EVENT_CONF_STANDARD);
+	XMC_USIC_CH_RXFIFO_DisableEvent(i2c_fifo->i2c, XMC_USIC_CH_RXFIFO_EVENT_CONF_STANDARD);
+#endif
+}
+
+static void i2c_fifo_queue_drain(I2CFifo *i2c_fifo, I2CFifoTransaction *t) {
+	while(!XMC_USIC_CH_RXFIFO_IsEmpty(i2c_fifo->i2c)) {
+		const uint8_t data = XMC_I2C_CH_GetReceivedData(i2c_fifo->i2c);
+		if((t->flags & I2C_FIFO_TRANSACTION_FLAG_READ) && (i2c_fifo->queue_rx_index < t->length)) {
+			t->data[i2c_fifo->queue_rx_index++] = data;
+			i2c_fifo->last_activity = system_timer_get_ms();
+		}
+	}
+}
+
+static void i2c_fifo_queue_fill(I2CFifo *i2c_fifo, I2CFifoTransaction *t) {
+	const uint16_t rx_size = I2C_FIFO_WORDS(i2c_fifo->scl_fifo_size);
+
+	while((i2c_fifo->queue_command_index < i2c_fifo->queue_command_length) && !XMC_USIC_CH_TXFIFO_IsFull(i2c_fifo->i2c)) {
+		bool receive;
+		const uint32_t command = i2c_fifo_queue_command(i2c_fifo, t, i2c_fifo->queue_command_index, &receive);
+		if(receive) {
+			// Never request more bytes than the RX FIFO can take
+			if((i2c_fifo->queue_rx_requested - i2c_fifo->queue_rx_index) >= rx_size) {
+				break;
+			}
+			i2c_fifo->queue_rx_requested++;
+		}
+
+		i2c_fifo->i2c->IN[0] = command;
+		i2c_fifo->queue_command_index++;
+		i2c_fifo->last_activity = system_timer_get_ms();
+	}
+}
+
+// Returns true if the transaction is done
+static bool i2c_fifo_queue_is_transaction_done(I2CFifo *i2c_fifo, I2CFifoTransaction *t) {
+	if(i2c_fifo->queue_command_index < i2c_fifo->queue_command_length) {
+		return false;
+	}
+
+	if(t->flags & I2C_FIFO_TRANSACTION_FLAG_READ) {
+		return i2c_fifo->queue_rx_index >= t->length;
+	}
+
+	// Same as i2c_fifo_next_state: A write is done if all commands left the FIFO
+	return XMC_USIC_CH_TXFIFO_IsEmpty(i2c_fifo->i2c);
+}
+
+#ifdef I2C_FIFO_QUEUE_IRQ_ENABLE
+// Configures the FIFO limits for the next event.
+// Returns false if the event condition is already met and we have to handle it directly.
+static bool i2c_fifo_queue_set_events(I2CFifo *i2c_fifo, I2CFifoTransaction *t) {
+	const uint16_t rx_size = I2C_FIFO_WORDS(i2c_fifo->scl_fifo_size);
+	const uint16_t tx_size = I2C_FIFO_WORDS(i2c_fifo->sda_fifo_size);
+
+	const uint16_t rx_pending = i2c_fifo->queue_rx_requested - i2c_fifo->queue_rx_index;
+	const bool commands_left  = i2c_fifo->queue_command_index < i2c_fifo->queue_command_length;
+
+	// The standard transmit event is triggered if the level falls below the limit.
+	// If all commands are written we want to know when the FIFO is empty (write done),
+	// otherwise when it is half empty (refill). If the refill waits for free space
+	// in the RX FIFO, only the receive event can help.
+	if((commands_left && (rx_pending < rx_size)) || (!commands_left && !(t->flags & I2C_FIFO_TRANSACTION_FLAG_READ))) {
+		const uint8_t limit = commands_left ? tx_size/2 : 1;
+		XMC_USIC_CH_TXFIFO_SetSizeTriggerLimit(i2c_fifo->i2c, i2c_fifo->sda_fifo_size, limit);
+		XMC_USIC_CH_TXFIFO_EnableEvent(i2c_fifo->i2c, XMC_USIC_CH_TXFIFO_EVENT_CONF_STANDARD);
+		if(XMC_USIC_CH_TXFIFO_GetLevel(i2c_fifo->i2c) < limit) {
+			return false;
+		}
+	} else {
+		XMC_USIC_CH_TXFIFO_DisableEvent(i2c_fifo->i2c, XMC_USIC_CH_TXFIFO_EVENT_CONF_STANDARD);
+	}
+
+	// The standard receive event is triggered if the level goes from limit to limit+1,
+	// wait for half of the requested bytes (like usic_fifo)
+	if(rx_pending > 0) {
+		const uint8_t limit = MIN(rx_pending, rx_size/2) - 1;
+		XMC_USIC_CH_RXFIFO_SetSizeTriggerLimit(i2c_fifo->i2c, i2c_fifo->scl_fifo_size, limit);
+		XMC_USIC_CH_RXFIFO_EnableEvent(i2c_fifo->i2c, XMC_USIC_CH_RXFIFO_EVENT_CONF_STANDARD);
+		if(XMC_USIC_CH_RXFIFO_GetLevel(i2c_fifo->i2c) > limit) {
+			return false;
+		}
+	} else {
+		XMC_USIC_CH_RXFIFO_DisableEvent(i2c_fifo->i2c, XMC_USIC_CH_RXFIFO_EVENT_CONF_STANDARD);
+	}
+
+	return true;
+}
+#endif
+
+// Has to be called with interrupts disabled or from the FIFO IRQ
+static void i2c_fifo_queue_handle(I2CFifo *i2c_fifo) {
+	i2c_fifo->queue_in_handler = true;
+
+	// Nothing is started until i2c_fifo_queue_tick did the USIC reset
+	while((i2c_fifo->queue_head != NULL) && !i2c_fifo->queue_reset_pending) {
+		I2CFifoTransaction *t = i2c_fifo->queue_head;
+		if(i2c_fifo->queue_active != t) {
+			// Start next transaction
+			if(!i2c_fifo->queue_restart) {
+				XMC_I2C_CH_ClearStatusFlag(i2c_fifo->i2c, 0xFFFFFFFF);
+			}
+			i2c_fifo->queue_active         = t;
+			i2c_fifo->queue_command_index  = 0;
+			i2c_fifo->queue_command_length = i2c_fifo_queue_command_length(t);
+			i2c_fifo->queue_rx_requested   = 0;
+			i2c_fifo->queue_rx_index       = 0;
+			i2c_fifo->last_activity        = system_timer_get_ms();
+		}
+
+		const uint32_t status = XMC_I2C_CH_GetStatusFlag(i2c_fifo->i2c);
+		if(status & I2C_FIFO_STATUS_ERROR_MASK) {
+			loge("I2C FIFO queue I2C error %d (address %d)\n\r", status, t->address);
+			i2c_fifo_queue_disable_events(i2c_fifo);
+			i2c_fifo_queue_fail(i2c_fifo, status);
+
+			// The commands of the failed transaction may still be in the FIFO.
+			// Reconfiguring USIC and GPIOs is not done here (IRQ context),
+			// it is done by i2c_fifo_queue_tick.
+			i2c_fifo->queue_reset_pending = true;
+			break;
+		}
+
+		i2c_fifo_queue_drain(i2c_fifo, t);
+		i2c_fifo_queue_fill(i2c_fifo, t);
+
+		if(i2c_fifo_queue_is_transaction_done(i2c_fifo, t)) {
+			i2c_fifo_queue_finish(i2c_fifo, 0);
+			continue;
+		}
+
+#ifdef I2C_FIFO_QUEUE_IRQ_ENABLE
+		if(!i2c_fifo_queue_set_events(i2c_fifo, t)) {
+			continue;
+		}
+#endif
+		break;
+	}
+
+	if(i2c_fifo->queue_head == NULL) {
+		i2c_fifo_queue_disable_events(i2c_fifo);
+	}
+
+	i2c_fifo->queue_in_handler = false;
+}
+
+// Appends the transaction (and all transactions chained with next) to the queue.
+// The transaction is done if done is true, the result is in status.
+void i2c_fifo_queue_submit(I2CFifo *i2c_fifo, I2CFifoTransaction *transaction) {
+	I2CFifoTransaction *last = transaction;
+	for(I2CFifoTransaction *t = transaction; t != NULL; t = t->next) {
+		t->done   = false;
+		t->status = 0;
+#ifdef I2C_FIFO_COOP_ENABLE
+		coop_task_wait_queue_init(&t->wait_queue);
+#endif
+		last = t;
+	}
+
+	const uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+
+	if(i2c_fifo->queue_tail == NULL) {
+		i2c_fifo->queue_head = transaction;
+	} else {
+		i2c_fifo->queue_tail->next = transaction;
+	}
+	i2c_fifo->queue_tail = last;
+
+	// If we are called from a done_func the running handler picks the transaction up
+	if(!i2c_fifo->queue_in_handler) {
+		i2c_fifo_queue_handle(i2c_fifo);
+	}
+
+	__set_PRIMASK(primask);
+}
+
+// Drives the queue if I2C_FIFO_QUEUE_IRQ_ENABLE is not used, handles timeouts
+// and resets USIC after an I2C error or a timeout.
+// Call this regularly while transactions are queued.
+void i2c_fifo_queue_tick(I2CFifo *i2c_fifo) {
+	if((i2c_fifo->queue_head == NULL) && !i2c_fifo->queue_reset_pending) {
+		return;
+	}
+
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+
+	i2c_fifo_queue_handle(i2c_fifo);
+
+	if(!i2c_fifo->queue_reset_pending && (i2c_fifo->queue_head != NULL) && system_timer_is_time_elapsed_ms(i2c_fifo->last_activity, I2C_FIFO_TIMEOUT)) {
+		loge("I2C FIFO queue timeout (address %d)\n\r", i2c_fifo->queue_head->address);
+		i2c_fifo_queue_disable_events(i2c_fifo);
+		i2c_fifo->queue_in_handler = true;
+		i2c_fifo_queue_fail(i2c_fifo, I2C_FIFO_STATUS_TIMEOUT);
+		i2c_fifo->queue_in_handler = false;
+		i2c_fifo->queue_reset_pending = true;
+	}
+
+	__set_PRIMASK(primask);
+
+	if(!i2c_fifo->queue_reset_pending) {
+		return;
+	}
+
+#ifdef I2C_FIFO_COOP_USE_MUTEX
+	// i2c_fifo_init does nothing while a coop transfer holds the mutex, try again with the next tick
+	if(i2c_fifo->mutex) {
+		return;
+	}
+#endif
+
+	// Resets USIC and FIFOs and clears the bus after a timeout, this takes some time.
+	// Don't do it with interrupts disabled. The queue does not start anything and
+	// all events are disabled while the reset is pending.
+	i2c_fifo_init(i2c_fifo);
+
+	primask = __get_PRIMASK();
+	__disable_irq();
+	i2c_fifo->queue_reset_pending = false;
+	i2c_fifo_queue_handle(i2c_fifo);
+	__set_PRIMASK(primask);
+}
+
+// Has to be called from the IRQ handlers of queue_tx_service_request and queue_rx_service_request
+void i2c_fifo_queue_irq_handler(I2CFifo *i2c_fifo) {
+	if(i2c_fifo->queue_head == NULL) {
+		i2c_fifo_queue_disable_events(i2c_fifo);
+		return;
+	}
+
+	i2c_fifo_queue_handle(i2c_fifo);
+}
+
+#ifdef I2C_FIFO_COOP_ENABLE
+// Submits the transaction(s) and yields until the last one is done.
+// Returns the status of the last transaction.
+uint32_t i2c_fifo_coop_queue_transfer(I2CFifo *i2c_fifo, I2CFifoTransaction *transaction) {
+	I2CFifoTransaction *last = transaction;
+	while(last->next != NULL) {
+		last = last->next;
+	}
+
+	i2c_fifo_queue_submit(i2c_fifo, transaction);
+
+	while(!last->done) {
+#ifdef I2C_FIFO_QUEUE_IRQ_ENABLE
+		// Woken up by the IRQ, the tick is only needed for the timeout and the reset after an error
+		if(i2c_fifo->queue_reset_pending || !coop_task_wait_queue_wait(&last->wait_queue, I2C_FIFO_TIMEOUT)) {
+			i2c_fifo_queue_tick(i2c_fifo);
+		}
+#else
+		i2c_fifo_queue_tick(i2c_fifo);
+		if(!last->done) {
+			coop_task_yield();
+		}
+#endif
+	}
+
+	// Reset USIC directly if the transaction failed, the queue is stalled until then
+	if(i2c_fifo->queue_reset_pending) {
+		i2c_fifo_queue_tick(i2c_fifo);
+	}
+
+	return last->status;
+}
+#endif
+
+#endif
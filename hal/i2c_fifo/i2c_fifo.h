@@ -27,6 +27,13 @@
  * The actual i2c transfer is done completely in hardware, there
  * is no interrupt or similar in use.
  *
+ * With I2C_FIFO_QUEUE_ENABLE there is additionally a transaction queue
+ * (see i2c_fifo_queue_submit). Transactions of arbitrary length are
+ * queued and the FIFO is refilled/drained while they are running,
+ * either by polling i2c_fifo_queue_tick or, with I2C_FIFO_QUEUE_IRQ_ENABLE,
+ * by the FIFO limit events. Don't mix the queue with the direct
+ * read/write functions while transactions are queued.
+ *
 **/
 
 #ifndef I2C_FIFO_H
@@ -48,6 +55,37 @@
 #define I2C_FIFO_STATUS_TIMEOUT 0xFFFFFFFF
 #define I2C_FIFO_STATUS_MUTEX   0xFFFFFFFE
 
+#ifdef I2C_FIFO_QUEUE_ENABLE
+#define I2C_FIFO_TRANSACTION_FLAG_READ     (1 << 0) // Read length bytes into data, otherwise write them
+#define I2C_FIFO_TRANSACTION_FLAG_REGISTER (1 << 1) // Write reg first (read: followed by repeated start)
+#define I2C_FIFO_TRANSACTION_FLAG_NO_STOP  (1 << 2) // Next transaction starts with repeated start
+
+struct I2CFifoTransaction;
+typedef void (*i2c_fifo_transaction_done_func_t)(struct I2CFifoTransaction *transaction);
+
+// A transaction has to stay valid until it is done. Transactions can be
+// chained with next and are then submitted together. Use NO_STOP to combine
+// them into one sequence with repeated starts.
+typedef struct I2CFifoTransaction {
+	uint8_t address;
+	uint8_t flags;
+	I2C_FIFO_REG_TYPE reg;
+	uint16_t length;
+	uint8_t *data;
+
+	i2c_fifo_transaction_done_func_t done_func; // Called from IRQ/tick, can be NULL
+	void *opaque;
+
+	volatile bool done;
+	volatile uint32_t status;                   // 0 or i2c status flags/I2C_FIFO_STATUS_TIMEOUT
+#ifdef I2C_FIFO_COOP_ENABLE
+	CoopTaskWaitQueue wait_queue;
+#endif
+
+	struct I2CFifoTransaction *next;
+} I2CFifoTransaction;
+#endif
+
 typedef enum {
 	I2C_FIFO_STATE_IDLE                 = 0,
 	I2C_FIFO_STATE_READY                = 1 << 6,
@@ -102,6 +140,23 @@ typedef struct {
 #ifdef I2C_FIFO_COOP_USE_MUTEX
 	bool mutex;
 #endif
+
+#ifdef I2C_FIFO_QUEUE_ENABLE
+#ifdef I2C_FIFO_QUEUE_IRQ_ENABLE
+	uint8_t queue_tx_service_request;
+	uint8_t queue_rx_service_request;
+#endif
+	I2CFifoTransaction *volatile queue_head;
+	I2CFifoTransaction *queue_tail;
+	I2CFifoTransaction *queue_active;   // Transaction of which the commands are in the FIFO
+	bool queue_restart;                 // Last transaction did not send a stop
+	bool queue_in_handler;
+	volatile bool queue_reset_pending;  // USIC reset after error/timeout, done by i2c_fifo_queue_tick
+	uint16_t queue_command_index;       // Next command to write to the TX FIFO
+	uint16_t queue_command_length;
+	uint16_t queue_rx_requested;        // ACK/NACK commands written to the TX FIFO
+	uint16_t queue_rx_index;            // Bytes read from the RX FIFO
+#endif
 } I2CFifo;
 
 
@@ -120,4 +175,18 @@ uint32_t i2c_fifo_coop_read_direct(I2CFifo *i2c_fifo, const uint32_t length, uin
 uint32_t i2c_fifo_coop_write_direct(I2CFifo *i2c_fifo, const uint32_t length, const uint8_t *data, const bool send_stop);
 #endif
 
+#ifdef I2C_FIFO_QUEUE_ENABLE
+void i2c_fifo_queue_submit(I2CFifo *i2c_fifo, I2CFifoTransaction *transaction);
+void i2c_fifo_queue_tick(I2CFifo *i2c_fifo);
+void i2c_fifo_queue_irq_handler(I2CFifo *i2c_fifo);
+
+static inline bool i2c_fifo_queue_is_idle(I2CFifo *i2c_fifo) {
+	return (i2c_fifo->queue_head == NULL) && !i2c_fifo->queue_reset_pending;
+}
+
+#ifdef I2C_FIFO_COOP_ENABLE
+uint32_t i2c_fifo_coop_queue_transfer(I2CFifo *i2c_fifo, I2CFifoTransaction *transaction);
+#endif
+#endif
+
 #endif
@@ -26,6 +26,13 @@
  *
  * The actual SPI transfer is done completely in hardware, there
  * is no interrupt or similar in use.
+ *
+ * With SPI_FIFO_STREAM_ENABLE there is additionally a streaming mode
+ * for transfers of arbitrary length (see spi_fifo_stream_start).
+ * It uses the RX FIFO limit event (usic_fifo), the IRQ handler of
+ * stream_service_request has to call spi_fifo_stream_irq_handler.
+ * All FIFO sizes up to 64 words can be used, usic_fifo splits bigger
+ * RX FIFO levels into several block reads.
  * 
 **/
 
@@ -263,5 +270,95 @@ void spi_fifo_init(SPIFifo *spi_fifo) {
 
 	XMC_USIC_CH_RXFIFO_Flush(spi_fifo->channel);
 
+#ifdef SPI_FIFO_STREAM_ENABLE
+	usic_fifo_init(&spi_fifo->stream, spi_fifo->channel, spi_fifo->tx_fifo_size, spi_fifo->rx_fifo_size);
+	XMC_USIC_CH_RXFIFO_SetInterruptNodePointer(spi_fifo->channel, XMC_USIC_CH_RXFIFO_INTERRUPT_NODE_POINTER_STANDARD, spi_fifo->stream_service_request);
+#ifdef SPI_FIFO_COOP_ENABLE
+	coop_task_wait_queue_init(&spi_fifo->stream_wait_queue);
+#endif
+#endif
+
 	spi_fifo->state = SPI_FIFO_STATE_IDLE;
 }
+
+#ifdef SPI_FIFO_STREAM_ENABLE
+// Called from IRQ when the last byte is received
+static void spi_fifo_stream_done(void *opaque) {
+	SPIFifo *spi_fifo = opaque;
+
+	XMC_SPI_CH_DisableSlaveSelect(spi_fifo->channel);
+
+	if(spi_fifo->stream_done_func != NULL) {
+		spi_fifo->stream_done_func(spi_fifo->stream_done_opaque);
+	}
+#ifdef SPI_FIFO_COOP_ENABLE
+	coop_task_wait_queue_notify(&spi_fifo->stream_wait_queue);
+#endif
+}
+
+// Starts a full-duplex transfer of length bytes, the TX FIFO is refilled and the
+// RX FIFO is drained in the RX FIFO limit interrupt. mosi can be NULL (0xFF is sent),
+// miso can be NULL (received data is discarded). The buffers have to stay valid until
+// the transfer is done, done_func is called from the interrupt and can be NULL.
+void spi_fifo_stream_start(SPIFifo *spi_fifo, const uint16_t length, const uint8_t *mosi, uint8_t *miso, usic_fifo_done_func_t done_func, void *done_opaque) {
+	spi_fifo->stream_descriptor.mosi   = mosi;
+	spi_fifo->stream_descriptor.miso   = miso;
+	spi_fifo->stream_descriptor.length = length;
+	spi_fifo->stream_descriptor.next   = NULL;
+	spi_fifo->stream_done_func         = done_func;
+	spi_fifo->stream_done_opaque       = done_opaque;
+
+	XMC_USIC_CH_RXFIFO_Flush(spi_fifo->channel);
+	XMC_SPI_CH_EnableSlaveSelect(spi_fifo->channel, spi_fifo->slave);
+
+	usic_fifo_start(&spi_fifo->stream, &spi_fifo->stream_descriptor, spi_fifo_stream_done, spi_fifo);
+}
+
+void spi_fifo_stream_abort(SPIFifo *spi_fifo) {
+	usic_fifo_abort(&spi_fifo->stream);
+	XMC_SPI_CH_DisableSlaveSelect(spi_fifo->channel);
+}
+
+void spi_fifo_stream_irq_handler(SPIFifo *spi_fifo) {
+	usic_fifo_irq_handler(&spi_fifo->stream);
+}
+
+#ifdef SPI_FIFO_COOP_ENABLE
+// Streaming version of spi_fifo_coop_transceive without length limit.
+// The task waits until it is woken by the interrupt. The transfer is aborted
+// if there was no progress (no interrupt) for SPI_FIFO_TIMEOUT ms.
+bool spi_fifo_coop_stream_transceive(SPIFifo *spi_fifo, const uint16_t length, const uint8_t *mosi, uint8_t *miso) {
+#ifdef SPI_FIFO_COOP_USE_MUTEX
+	while(spi_fifo->mutex) {
+		coop_task_yield();
+	}
+	spi_fifo->mutex = true;
+#endif
+
+	coop_task_wait_queue_init(&spi_fifo->stream_wait_queue);
+	spi_fifo_stream_start(spi_fifo, length, mosi, miso, NULL, NULL);
+
+	bool ret = true;
+	uint32_t irq_count = spi_fifo->stream.irq_count;
+	while(!spi_fifo_stream_is_done(spi_fifo)) {
+		if(coop_task_wait_queue_wait(&spi_fifo->stream_wait_queue, SPI_FIFO_TIMEOUT)) {
+			continue;
+		}
+
+		if(spi_fifo->stream.irq_count == irq_count) {
+			spi_fifo_stream_abort(spi_fifo);
+			spi_fifo->spi_status = SPI_FIFO_STATUS_TIMEOUT;
+			ret = false;
+			break;
+		}
+		irq_count = spi_fifo->stream.irq_count;
+	}
+
+#ifdef SPI_FIFO_COOP_USE_MUTEX
+	spi_fifo->mutex = false;
+#endif
+
+	return ret;
+}
+#endif
+#endif
@@ -28,6 +28,13 @@
 #include "xmc_spi.h"
 #include "xmc_gpio.h"
 
+#ifdef SPI_FIFO_STREAM_ENABLE
+#include "bricklib2/hal/usic_fifo/usic_fifo.h"
+#ifdef SPI_FIFO_COOP_ENABLE
+#include "bricklib2/os/coop_task.h"
+#endif
+#endif
+
 #define SPI_FIFO_STATUS_TIMEOUT 0xFFFFFFFF
 
 typedef enum {
@@ -84,6 +91,17 @@ typedef struct {
 #ifdef SPI_FIFO_COOP_USE_MUTEX
 	bool mutex;
 #endif
+
+#ifdef SPI_FIFO_STREAM_ENABLE
+	uint8_t stream_service_request;            // Service request of the standard RX FIFO event
+	USICFifo stream;
+	USICFifoDescriptor stream_descriptor;
+	usic_fifo_done_func_t stream_done_func;
+	void *stream_done_opaque;
+#ifdef SPI_FIFO_COOP_ENABLE
+	CoopTaskWaitQueue stream_wait_queue;
+#endif
+#endif
 } SPIFifo;
 
 #ifdef SPI_FIFO_COOP_ENABLE
@@ -96,4 +114,18 @@ SPIFifoState spi_fifo_next_state(SPIFifo *spi_fifo);
 
 void spi_fifo_init(SPIFifo *i2c_fifo);
 
+#ifdef SPI_FIFO_STREAM_ENABLE
+void spi_fifo_stream_start(SPIFifo *spi_fifo, const uint16_t length, const uint8_t *mosi, uint8_t *miso, usic_fifo_done_func_t done_func, void *done_opaque);
+void spi_fifo_stream_abort(SPIFifo *spi_fifo);
+void spi_fifo_stream_irq_handler(SPIFifo *spi_fifo);
+
+static inline bool spi_fifo_stream_is_done(SPIFifo *spi_fifo) {
+	return usic_fifo_is_done(&spi_fifo->stream);
+}
+
+#ifdef SPI_FIFO_COOP_ENABLE
+bool spi_fifo_coop_stream_transceive(SPIFifo *spi_fifo, const uint16_t length, const uint8_t *mosi, uint8_t *miso);
+#endif
+#endif
+
 #endif
\ No newline at end of file
@@ -99,6 +99,36 @@ system_timer_get_us(void) {
 }
 #endif
 
+// 32 bit us timestamp that is available with and without SYSTEM_TIMER_USE_64BIT_US.
+// It wraps around after about 71 minutes, so it should only be used for time differences
+// (e.g. for debug statistics).
+uint32_t system_timer_get_us32(void) {
+	uint32_t ms1 = 0;
+	uint32_t ms2 = 0;
+	uint32_t val = 0;
+	bool pending = false;
+
+	// Make sure that the SysTick interrupt is not triggered between we read tick and VAL
+	do {
+		ms1     = (uint32_t)system_timer_tick;
+		val     = SysTick->VAL;
+		pending = SCB->ICSR & SCB_ICSR_PENDSTSET_Msk;
+		ms2     = (uint32_t)system_timer_tick;
+	} while(ms1 != ms2);
+
+	const uint32_t load = SysTick->LOAD + 1;
+
+	// If we are called with interrupts disabled or from an interrupt with higher
+	// priority, the SysTick may have wrapped around without the tick being
+	// incremented yet. VAL restarts at LOAD after the wrap, so a large VAL
+	// together with the pending interrupt means that VAL was read after the wrap.
+	if(pending && (val >= load/2)) {
+		ms1++;
+	}
+
+	return ms1*1000 + ((load - 1 - val)*1000)/load;
+}
+
 // This will work even with wrap-around up to UINT32_MAX/2 difference.
 // E.g.: end - start = 0x00000010 - 0xfffffff = 0x00000011 etc
 inline bool
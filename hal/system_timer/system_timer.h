@@ -31,6 +31,7 @@ void system_timer_init(const uint32_t main_clock_frequency, const uint32_t syste
 uint32_t system_timer_get_ms(void);
 bool system_timer_is_time_elapsed_ms(const uint32_t start_measurement, const uint32_t time_to_be_elapsed);
 void system_timer_sleep_ms(const uint32_t sleep);
+uint32_t system_timer_get_us32(void);
 
 
 #ifdef SYSTEM_TIMER_USE_64BIT_US
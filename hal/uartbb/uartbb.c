@@ -36,6 +36,7 @@
 #include <stdlib.h>
 #include <stdarg.h>
 #include <stdbool.h>
+#include <stddef.h>
 
 #ifndef UARTBB_TX_PIN
 #define UARTBB_TX_PIN 17
@@ -161,76 +162,281 @@ void uartbb_init(void) {
 
 }
 
-void uartbb_tx(const uint8_t value) {
-#if defined(__SAM0__)
-	PortGroup *const port = &PORT->Group[0];
-#elif defined(__XMC1__)
-#endif
-
-  uint16_t value16 = 0 | (value << 1) | 1 << 9;
-
-  int32_t start;
-  uint8_t bit_count = 10;
-
+static inline void uartbb_irq_disable(void) {
 #if defined(__SAM0__)
 	cpu_irq_disable();
 #elif defined(__XMC1__) || defined(STM32F0)
 	CUSTOM_DISABLE_IRQ();
 #endif
+}
 
-  start = UARTBB_COUNT_TO_IN_1MS - (int32_t)SysTick->VAL;
+static inline void uartbb_irq_enable(void) {
+#if defined(__SAM0__)
+	cpu_irq_enable();
+#elif defined(__XMC1__) || defined(STM32F0)
+	CUSTOM_ENABLE_IRQ();
+#endif
+}
 
-  do {
-    if(value16 & 1) {
+static inline void uartbb_set_pin(const bool high) {
+	if(high) {
 #if defined(__SAM0__)
-      port->OUTSET.reg = (1 << UARTBB_TX_PIN);
+		PORT->Group[0].OUTSET.reg = (1 << UARTBB_TX_PIN);
 #elif defined(__XMC1__)
-	XMC_GPIO_SetOutputHigh(UARTBB_TX_PIN);
+		XMC_GPIO_SetOutputHigh(UARTBB_TX_PIN);
 #elif defined(STM32F0)
-	HAL_GPIO_WritePin(UARTBB_TX_PORT, UARTBB_TX_PIN, GPIO_PIN_SET);
+		HAL_GPIO_WritePin(UARTBB_TX_PORT, UARTBB_TX_PIN, GPIO_PIN_SET);
 #endif
-    } else {
+	} else {
 #if defined(__SAM0__)
-      port->OUTCLR.reg = (1 << UARTBB_TX_PIN);
+		PORT->Group[0].OUTCLR.reg = (1 << UARTBB_TX_PIN);
 #elif defined(__XMC1__)
-      XMC_GPIO_SetOutputLow(UARTBB_TX_PIN);
+		XMC_GPIO_SetOutputLow(UARTBB_TX_PIN);
 #elif defined(STM32F0)
-	HAL_GPIO_WritePin(UARTBB_TX_PORT, UARTBB_TX_PIN, GPIO_PIN_RESET);
+		HAL_GPIO_WritePin(UARTBB_TX_PORT, UARTBB_TX_PIN, GPIO_PIN_RESET);
 #endif
-    }
+	}
+}
 
-    uartbb_wait_1bit(start);
-    start += UARTBB_BIT_TIME;
+// Sends the lowest bits of frame (LSB first), busy-waits for every bit.
+// Has to be called with disabled interrupts.
+static void uartbb_tx_bits(uint16_t frame, uint8_t bits) {
+	int32_t start = UARTBB_COUNT_TO_IN_1MS - (int32_t)SysTick->VAL;
 
-    value16 >>= 1;
-  } while (--bit_count);
+	while(bits > 0) {
+		uartbb_set_pin(frame & 1);
 
-#if defined(__SAM0__)
-	cpu_irq_enable();
-#elif defined(__XMC1__) || defined(STM32F0)
-	CUSTOM_ENABLE_IRQ();
+		uartbb_wait_1bit(start);
+		start += UARTBB_BIT_TIME;
+
+		frame >>= 1;
+		bits--;
+	}
+}
+
+// Sends one byte, busy-waits with disabled interrupts for the complete frame
+static void uartbb_tx_blocking(const uint8_t value) {
+	uartbb_irq_disable();
+	uartbb_tx_bits(0 | (value << 1) | 1 << 9, 10);
+	uartbb_irq_enable();
+}
+
+#ifdef UARTBB_BUFFERED
+
+// In buffered mode the output is written to a ringbuffer and
+// send bit by bit from uartbb_irq_handler. The firmware has to call
+// uartbb_irq_handler from a timer interrupt with the baudrate
+// (e.g. 115200Hz), preferably with the highest priority (see uartbb.h for the cost).
+// Messages that don't fit in the ringbuffer are dropped and counted.
+
+#ifndef UARTBB_BUFFER_SIZE
+#define UARTBB_BUFFER_SIZE 256 // has to be power of 2
+#endif
+
+#ifndef UARTBB_LINE_SIZE
+#define UARTBB_LINE_SIZE 64
 #endif
+
+#define UARTBB_BUFFER_MASK (UARTBB_BUFFER_SIZE - 1)
+
+// Every call of a public function (printf/puts/putu/...) collects its message in its own
+// line on the stack and writes it to the ringbuffer as a whole. Messages from interrupts
+// thus can't interleave with a message from the main loop. Longer messages are written
+// in chunks of UARTBB_LINE_SIZE, only the chunks are atomic.
+typedef struct {
+	uint8_t data[UARTBB_LINE_SIZE];
+	uint8_t length;
+	bool dropped;
+} UARTBBLine;
+
+static uint8_t uartbb_buffer[UARTBB_BUFFER_SIZE];
+static volatile uint16_t uartbb_buffer_start = 0;
+static volatile uint16_t uartbb_buffer_end = 0;      // End of data that can be send
+static volatile uint16_t uartbb_buffer_reserved = 0; // End of space reserved by writers
+static volatile uint8_t uartbb_buffer_writers = 0;   // Writers that are still copying
+static volatile uint32_t uartbb_dropped = 0;
+
+static uint16_t uartbb_frame = 0;
+static volatile uint8_t uartbb_frame_bits = 0;
+static volatile bool uartbb_flushing = false;
+
+// The space is reserved with interrupts disabled and the data is copied with
+// interrupts enabled, so the bit timer interrupt is only delayed for a few cycles.
+// A writer from an interrupt can reserve behind a writer that it interrupted,
+// uartbb_buffer_end is only moved forward when the last writer is done copying.
+static bool uartbb_buffer_write(const uint8_t *data, const uint16_t length) {
+	uartbb_irq_disable();
+	const uint16_t free = (uartbb_buffer_start - uartbb_buffer_reserved - 1) & UARTBB_BUFFER_MASK;
+	if(length > free) {
+		uartbb_irq_enable();
+		return false;
+	}
+
+	uint16_t pos = uartbb_buffer_reserved;
+	uartbb_buffer_reserved = (pos + length) & UARTBB_BUFFER_MASK;
+	uartbb_buffer_writers++;
+	uartbb_irq_enable();
+
+	for(uint16_t i = 0; i < length; i++) {
+		uartbb_buffer[pos] = data[i];
+		pos = (pos + 1) & UARTBB_BUFFER_MASK;
+	}
+
+	uartbb_irq_disable();
+	uartbb_buffer_writers--;
+	if(uartbb_buffer_writers == 0) {
+		uartbb_buffer_end = uartbb_buffer_reserved;
+	}
+	uartbb_irq_enable();
+
+	return true;
 }
 
-void uartbb_putarru8(const char *name, const uint8_t *data, const uint32_t length) {
-	uartbb_puts(name); uartbb_puts(": ");
-	for(uint32_t i = 0; i < length; i++) {
-		uartbb_putu(data[i]); uartbb_puts(", ");
+void uartbb_write(const uint8_t *data, const uint16_t length) {
+	if(!uartbb_buffer_write(data, length)) {
+		uartbb_dropped++;
 	}
-	uartbb_putnl();
 }
 
-void uartbb_puts(const char *str) {
+// If one chunk of a message does not fit, the rest of the message is dropped too
+static void uartbb_line_write(UARTBBLine *line) {
+	if(!line->dropped && !uartbb_buffer_write(line->data, line->length)) {
+		line->dropped = true;
+		uartbb_dropped++;
+	}
+	line->length = 0;
+}
+
+static void uartbb_line_begin(UARTBBLine *line) {
+	line->length  = 0;
+	line->dropped = false;
+}
+
+static void uartbb_line_end(UARTBBLine *line) {
+	uartbb_line_write(line);
+}
+
+static void uartbb_line_tx(UARTBBLine *line, const uint8_t value) {
+	line->data[line->length++] = value;
+	if(line->length == UARTBB_LINE_SIZE) {
+		uartbb_line_write(line);
+	}
+}
+
+void uartbb_tx(const uint8_t value) {
+	uartbb_write(&value, 1);
+}
+
+// Sends one bit per call, has to be called with the baudrate
+void uartbb_irq_handler(void) {
+	if(uartbb_frame_bits == 0) {
+		if(uartbb_flushing || (uartbb_buffer_start == uartbb_buffer_end)) {
+			return;
+		}
+
+		uartbb_frame       = 0 | (uartbb_buffer[uartbb_buffer_start] << 1) | 1 << 9;
+		uartbb_frame_bits  = 10;
+		uartbb_buffer_start = (uartbb_buffer_start + 1) & UARTBB_BUFFER_MASK;
+	}
+
+	uartbb_set_pin(uartbb_frame & 1);
+	uartbb_frame >>= 1;
+	uartbb_frame_bits--;
+}
+
+// Sends everything that is in the buffer blocking (e.g. before a reset or in a fault handler).
+// Can be called with disabled interrupts, they stay disabled in that case.
+void uartbb_flush(void) {
+	uartbb_flushing = true;
+
+	// Give the interrupt the time to finish the current frame (if interrupts are enabled)
+	int32_t start = UARTBB_COUNT_TO_IN_1MS - (int32_t)SysTick->VAL;
+	for(uint8_t i = 0; (i < 11) && (uartbb_frame_bits > 0); i++) {
+		uartbb_wait_1bit(start);
+		start += UARTBB_BIT_TIME;
+	}
+
+	// If the interrupt could not run (disabled interrupts or stopped timer),
+	// the rest of the current frame is send here instead of being cut off
+	const bool irq_enabled = __get_PRIMASK() == 0;
+	uartbb_irq_disable();
+	uartbb_tx_bits(uartbb_frame, uartbb_frame_bits);
+	uartbb_frame_bits = 0;
+	if(irq_enabled) {
+		uartbb_irq_enable();
+	}
+
+	while(uartbb_buffer_start != uartbb_buffer_end) {
+		uartbb_irq_disable();
+		uartbb_tx_bits(0 | (uartbb_buffer[uartbb_buffer_start] << 1) | 1 << 9, 10);
+		if(irq_enabled) {
+			uartbb_irq_enable();
+		}
+		uartbb_buffer_start = (uartbb_buffer_start + 1) & UARTBB_BUFFER_MASK;
+	}
+
+	uartbb_flushing = false;
+}
+
+uint32_t uartbb_get_dropped(void) {
+	return uartbb_dropped;
+}
+
+#else
+
+// Without buffer every byte is send directly, the line is not used
+typedef struct {
+	uint8_t unused;
+} UARTBBLine;
+
+static inline void uartbb_line_begin(UARTBBLine *line) {}
+static inline void uartbb_line_end(UARTBBLine *line) {}
+
+static inline void uartbb_line_tx(UARTBBLine *line, const uint8_t value) {
+	uartbb_tx_blocking(value);
+}
+
+void uartbb_tx(const uint8_t value) {
+	uartbb_tx_blocking(value);
+}
+
+#endif
+
+static void uartbb_line_puts(UARTBBLine *line, const char *str) {
 	uint32_t i = 0;
 	while(str[i] != '\0') {
-		uartbb_tx(str[i]);
+		uartbb_line_tx(line, str[i]);
 		i++;
 	}
 }
 
+static void uartbb_line_putu(UARTBBLine *line, const uint32_t value) {
+	char str[16] = {'\0'};
+	utoa(value, str, 10);
+	uartbb_line_puts(line, str);
+}
+
+void uartbb_putarru8(const char *name, const uint8_t *data, const uint32_t length) {
+	UARTBBLine line;
+	uartbb_line_begin(&line);
+	uartbb_line_puts(&line, name); uartbb_line_puts(&line, ": ");
+	for(uint32_t i = 0; i < length; i++) {
+		uartbb_line_putu(&line, data[i]); uartbb_line_puts(&line, ", ");
+	}
+	uartbb_line_puts(&line, "\n\r");
+	uartbb_line_end(&line);
+}
+
+void uartbb_puts(const char *str) {
+	UARTBBLine line;
+	uartbb_line_begin(&line);
+	uartbb_line_puts(&line, str);
+	uartbb_line_end(&line);
+}
+
 #ifdef UARTBB_PRINTF_ADVANCED
 
-void uartbb_puts_advanced(const char *str, const uint32_t zero_padding, const uint32_t grouping) {
+static void uartbb_line_puts_advanced(UARTBBLine *line, const char *str, const uint32_t zero_padding, const uint32_t grouping) {
 	uint32_t i;
 	uint32_t k = grouping + 1;
 
@@ -249,10 +455,10 @@ void uartbb_puts_advanced(const char *str, const uint32_t zero_padding, const ui
 		for(i = 0; i < padding_length; i++) {
 			if(grouping > 0 && --k == 0) {
 				k = grouping;
-				uartbb_tx('_');
+				uartbb_line_tx(line, '_');
 			}
 
-			uartbb_tx('0');
+			uartbb_line_tx(line, '0');
 		}
 
 	} else if(grouping > 0) {
@@ -266,33 +472,32 @@ void uartbb_puts_advanced(const char *str, const uint32_t zero_padding, const ui
 	for(i = 0; str[i] != '\0'; ++i) {
 		if(grouping > 0 && --k == 0) {
 			k = grouping;
-			uartbb_tx('_');
+			uartbb_line_tx(line, '_');
 		}
 
-		uartbb_tx(str[i]);
+		uartbb_line_tx(line, str[i]);
 	}
 }
 
+void uartbb_puts_advanced(const char *str, const uint32_t zero_padding, const uint32_t grouping) {
+	UARTBBLine line;
+	uartbb_line_begin(&line);
+	uartbb_line_puts_advanced(&line, str, zero_padding, grouping);
+	uartbb_line_end(&line);
+}
+
 #endif
 
 void uartbb_puti(const int32_t value) {
 	char str[16] = {'\0'};
 	itoa(value, str, 10);
-	uint32_t i = 0;
-	while(str[i] != '\0') {
-		uartbb_tx(str[i]);
-		i++;
-	}
+	uartbb_puts(str);
 }
 
 void uartbb_putu(const uint32_t value) {
 	char str[16] = {'\0'};
 	utoa(value, str, 10);
-	uint32_t i = 0;
-	while(str[i] != '\0') {
-		uartbb_tx(str[i]);
-		i++;
-	}
+	uartbb_puts(str);
 }
 
 void uartbb_putnl(void) {
@@ -304,6 +509,9 @@ void uartbb_printf(char const *fmt, ...) {
 	va_list va;
 	va_start(va, fmt);
 
+	UARTBBLine line;
+	uartbb_line_begin(&line);
+
 	// Evaluates to 33. The + 1 is required to fit the null-terminator written by utoa when printing 32 binary digits.
 	char buffer[sizeof(int) * 8 + 1];
 	char character;
@@ -314,7 +522,7 @@ void uartbb_printf(char const *fmt, ...) {
 
 	while((character = *(fmt++))) {
 		if(character != '%') {
-			uartbb_tx(character);
+			uartbb_line_tx(&line, character);
 		} else {
 			character = *(fmt++);
 
@@ -344,7 +552,7 @@ void uartbb_printf(char const *fmt, ...) {
 
 			switch(character) {
 				case '\0': {
-					return;
+					goto end;
 				}
 
 				case 'u': {
@@ -352,9 +560,9 @@ void uartbb_printf(char const *fmt, ...) {
 
 					utoa(value, buffer, 10);
 #ifdef UARTBB_PRINTF_ADVANCED
-					uartbb_puts_advanced(buffer, zero_padding, grouping);
+					uartbb_line_puts_advanced(&line, buffer, zero_padding, grouping);
 #else
-					uartbb_puts(buffer);
+					uartbb_line_puts(&line, buffer);
 #endif
 					break;
 				}
@@ -364,9 +572,9 @@ void uartbb_printf(char const *fmt, ...) {
 
 					utoa(value, buffer, 2);
 #ifdef UARTBB_PRINTF_ADVANCED
-					uartbb_puts_advanced(buffer, zero_padding, grouping);
+					uartbb_line_puts_advanced(&line, buffer, zero_padding, grouping);
 #else
-					uartbb_puts(buffer);
+					uartbb_line_puts(&line, buffer);
 #endif
 					break;
 				}
@@ -376,9 +584,9 @@ void uartbb_printf(char const *fmt, ...) {
 
 					itoa(value, buffer, 10);
 #ifdef UARTBB_PRINTF_ADVANCED
-					uartbb_puts_advanced(buffer, zero_padding, grouping);
+					uartbb_line_puts_advanced(&line, buffer, zero_padding, grouping);
 #else
-					uartbb_puts(buffer);
+					uartbb_line_puts(&line, buffer);
 #endif
 					break;
 				}
@@ -388,29 +596,31 @@ void uartbb_printf(char const *fmt, ...) {
 
 					utoa(value, buffer, 16);
 #ifdef UARTBB_PRINTF_ADVANCED
-					uartbb_puts_advanced(buffer, zero_padding, grouping);
+					uartbb_line_puts_advanced(&line, buffer, zero_padding, grouping);
 #else
-					uartbb_puts(buffer);
+					uartbb_line_puts(&line, buffer);
 #endif
 					break;
 				}
 
 				case 'c' : {
-					uartbb_tx((char)(va_arg(va, int)));
+					uartbb_line_tx(&line, (char)(va_arg(va, int)));
 					break;
 				}
 
 				case 's' : {
-					uartbb_puts(va_arg(va, char*));
+					uartbb_line_puts(&line, va_arg(va, char*));
 					break;
 				}
 
 				default:
-					uartbb_tx(character);
+					uartbb_line_tx(&line, character);
 					break;
 			}
 		}
 	}
 
+end:
+	uartbb_line_end(&line);
     va_end(va);
 }
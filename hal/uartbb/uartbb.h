@@ -22,6 +22,8 @@
 #ifndef UARTBB_H
 #define UARTBB_H
 
+#include "configs/config.h"
+
 #include <stdint.h>
 
 void uartbb_init(void);
@@ -33,4 +35,17 @@ void uartbb_putu(const uint32_t value);
 void uartbb_putnl(void);
 void uartbb_printf(char const *fmt, ...);
 
+#ifdef UARTBB_BUFFERED
+// Buffered mode: uartbb_irq_handler has to be called from a timer interrupt
+// with the baudrate (115200Hz by default), and the timer runs all the time,
+// also if there is nothing to send. With about 60 cycles for entry, exit and
+// handler this costs roughly 15% of the CPU at 48MHz (20% at 32MHz).
+// It is meant for debugging, use the blocking mode if the CPU time is needed.
+// uartbb_flush sends the buffer blocking and can be used with disabled interrupts.
+void uartbb_write(const uint8_t *data, const uint16_t length);
+void uartbb_irq_handler(void);
+void uartbb_flush(void);
+uint32_t uartbb_get_dropped(void);
+#endif
+
 #endif
@@ -0,0 +1,201 @@
+/* bricklib2
+ * Copyright (C) 2026 Olaf Lüke <olaf@tinkerforge.com>
+ *
+ * usic_fifo.c: FIFO event chained transfers for XMC1 USIC
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ *
+ *
+ * XMC1 has no DMA. To still be able to move larger amounts of data without
+ * an interrupt per byte, the transfer is described by a chain of descriptors
+ * and is only driven by the RX FIFO limit event:
+ *
+ * Every event drains the complete RX FIFO into the current descriptor and
+ * refills the TX FIFO from the descriptor chain. The RX limit is then moved
+ * to half of the bytes that are still in flight, so there is always data in
+ * the TX FIFO while we wait for the next event and the last event is
+ * triggered exactly when the last byte is received.
+ *
+ * With a 16 word FIFO this results in one interrupt per 8 bytes.
+ * This works for all full-duplex USIC modes (SPI), where each byte written
+ * to TX results in one byte in RX.
+ *
+ * The interrupt node pointer and the NVIC are configured by the user,
+ * the IRQ handler has to call usic_fifo_irq_handler.
+ *
+ * Scope: The engine is used for master transfers with a known length
+ * (WEM sdmmc). SPITFP only shares the unrolled usic_fifo_write_block for
+ * its TX handler. The SPITFP RX path is a slave stream of unknown length
+ * into the bootloader ring buffer and still takes one interrupt per RX
+ * FIFO limit as configured by the bootloader, so SPITFP messages get no
+ * IRQ reduction from this engine.
+**/
+
+#include "usic_fifo.h"
+
+#include "bricklib2/utility/util_definitions.h"
+
+// Each event can move at most 32 bytes (usic_fifo_read_block/write_block)
+#define USIC_FIFO_MAX_CHUNK 32
+
+#define USIC_FIFO_WORDS(size) (1 << (size))
+
+static inline __attribute__((always_inline)) const USICFifoDescriptor *usic_fifo_skip_empty(const USICFifoDescriptor *descriptor) {
+	while((descriptor != NULL) && (descriptor->length == 0)) {
+		descriptor = descriptor->next;
+	}
+
+	return descriptor;
+}
+
+static inline __attribute__((always_inline)) void usic_fifo_drain(USICFifo *usic_fifo) {
+	uint8_t level = XMC_USIC_CH_RXFIFO_GetLevel(usic_fifo->channel);
+	usic_fifo->in_flight -= MIN(level, usic_fifo->in_flight);
+
+	while(level > 0) {
+		const USICFifoDescriptor *descriptor = usic_fifo->rx_descriptor;
+		if(descriptor == NULL) {
+			// More data than expected, throw it away
+			while(level > 0) {
+				volatile uint8_t __attribute__((unused)) _ = usic_fifo->channel->OUTR;
+				level--;
+			}
+			break;
+		}
+
+		// With a 64 word RX FIFO the level can be bigger than one block read
+		const uint8_t chunk = MIN(MIN(level, USIC_FIFO_MAX_CHUNK), descriptor->length - usic_fifo->rx_index);
+		if(descriptor->miso != NULL) {
+			usic_fifo_read_block(&usic_fifo->channel->OUTR, descriptor->miso + usic_fifo->rx_index, chunk);
+		} else {
+			for(uint8_t i = 0; i < chunk; i++) {
+				volatile uint8_t __attribute__((unused)) _ = usic_fifo->channel->OUTR;
+			}
+		}
+
+		level               -= chunk;
+		usic_fifo->rx_index += chunk;
+		if(usic_fifo->rx_index == descriptor->length) {
+			usic_fifo->rx_descriptor = usic_fifo_skip_empty(descriptor->next);
+			usic_fifo->rx_index      = 0;
+		}
+	}
+}
+
+static inline __attribute__((always_inline)) void usic_fifo_fill(USICFifo *usic_fifo) {
+	// Never write more than the RX FIFO can take, otherwise we lose data if the interrupt is late
+	const uint8_t tx_free = USIC_FIFO_WORDS(usic_fifo->tx_fifo_size) - XMC_USIC_CH_TXFIFO_GetLevel(usic_fifo->channel);
+	const uint8_t rx_free = USIC_FIFO_WORDS(usic_fifo->rx_fifo_size) - usic_fifo->in_flight;
+	uint8_t room = MIN(MIN(tx_free, rx_free), USIC_FIFO_MAX_CHUNK);
+
+	while((room > 0) && (usic_fifo->tx_descriptor != NULL)) {
+		const USICFifoDescriptor *descriptor = usic_fifo->tx_descriptor;
+		const uint8_t chunk = MIN(room, descriptor->length - usic_fifo->tx_index);
+		if(descriptor->mosi != NULL) {
+			usic_fifo_write_block(usic_fifo->channel->IN, descriptor->mosi + usic_fifo->tx_index, chunk);
+		} else {
+			for(uint8_t i = 0; i < chunk; i++) {
+				usic_fifo->channel->IN[0] = usic_fifo->fill;
+			}
+		}
+
+		room                 -= chunk;
+		usic_fifo->in_flight += chunk;
+		usic_fifo->tx_index  += chunk;
+		if(usic_fifo->tx_index == descriptor->length) {
+			usic_fifo->tx_descriptor = usic_fifo_skip_empty(descriptor->next);
+			usic_fifo->tx_index      = 0;
+		}
+	}
+}
+
+static inline __attribute__((always_inline)) void usic_fifo_handle(USICFifo *usic_fifo) {
+	while(true) {
+		usic_fifo_drain(usic_fifo);
+		usic_fifo_fill(usic_fifo);
+
+		if(usic_fifo->in_flight == 0) {
+			XMC_USIC_CH_RXFIFO_DisableEvent(usic_fifo->channel, XMC_USIC_CH_RXFIFO_EVENT_CONF_STANDARD);
+			usic_fifo->done = true;
+			if(usic_fifo->done_func != NULL) {
+				usic_fifo->done_func(usic_fifo->done_opaque);
+			}
+			return;
+		}
+
+		// The standard receive event is triggered if the level goes from limit to limit+1.
+		// If the bytes arrived while we changed the limit, we have to handle them here.
+		const uint8_t limit = MIN(usic_fifo->in_flight, USIC_FIFO_WORDS(usic_fifo->rx_fifo_size)/2) - 1;
+		XMC_USIC_CH_RXFIFO_SetSizeTriggerLimit(usic_fifo->channel, usic_fifo->rx_fifo_size, limit);
+		if(XMC_USIC_CH_RXFIFO_GetLevel(usic_fifo->channel) <= limit) {
+			return;
+		}
+	}
+}
+
+void __attribute__((optimize("-O3"))) __attribute__((section (".ram_code"))) usic_fifo_irq_handler(USICFifo *usic_fifo) {
+	if(usic_fifo->done) {
+		return;
+	}
+
+	usic_fifo->irq_count++;
+	usic_fifo_handle(usic_fifo);
+}
+
+// Starts the transfer of the descriptor chain. The descriptors and the buffers
+// have to stay valid until the transfer is done. done_func is called from the
+// interrupt when the last byte is received, it can be NULL if usic_fifo_is_done is polled.
+void usic_fifo_start(USICFifo *usic_fifo, const USICFifoDescriptor *descriptor, usic_fifo_done_func_t done_func, void *done_opaque) {
+	descriptor = usic_fifo_skip_empty(descriptor);
+
+	usic_fifo->tx_descriptor = descriptor;
+	usic_fifo->tx_index      = 0;
+	usic_fifo->rx_descriptor = descriptor;
+	usic_fifo->rx_index      = 0;
+	usic_fifo->in_flight     = 0;
+	usic_fifo->done_func     = done_func;
+	usic_fifo->done_opaque   = done_opaque;
+	usic_fifo->done          = false;
+
+	// Fill the TX FIFO and set the RX limit, from then on the interrupt takes over
+	const uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	XMC_USIC_CH_RXFIFO_EnableEvent(usic_fifo->channel, XMC_USIC_CH_RXFIFO_EVENT_CONF_STANDARD);
+	usic_fifo_handle(usic_fifo);
+	__set_PRIMASK(primask);
+}
+
+// Stops the transfer (e.g. after a timeout), the FIFOs are flushed
+void usic_fifo_abort(USICFifo *usic_fifo) {
+	XMC_USIC_CH_RXFIFO_DisableEvent(usic_fifo->channel, XMC_USIC_CH_RXFIFO_EVENT_CONF_STANDARD);
+	usic_fifo->tx_descriptor = NULL;
+	usic_fifo->rx_descriptor = NULL;
+	usic_fifo->in_flight     = 0;
+	usic_fifo->done          = true;
+
+	XMC_USIC_CH_TXFIFO_Flush(usic_fifo->channel);
+	XMC_USIC_CH_RXFIFO_Flush(usic_fifo->channel);
+}
+
+void usic_fifo_init(USICFifo *usic_fifo, XMC_USIC_CH_t *channel, const XMC_USIC_CH_FIFO_SIZE_t tx_fifo_size, const XMC_USIC_CH_FIFO_SIZE_t rx_fifo_size) {
+	usic_fifo->channel      = channel;
+	usic_fifo->tx_fifo_size = tx_fifo_size;
+	usic_fifo->rx_fifo_size = rx_fifo_size;
+	usic_fifo->fill         = 0xFF;
+	usic_fifo->done         = true;
+	usic_fifo->irq_count    = 0;
+}
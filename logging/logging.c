@@ -36,6 +36,45 @@ static struct usart_module logging_usart_instance;
 #include "stdio_usb.h"
 #endif
 
+#ifdef LOGGING_TRACE
+#if defined(__SAM0__)
+#include "interrupt.h"
+#elif defined(STM32F0)
+#include "bricklib2/stm32cubef0/Drivers/CMSIS/Include/core_cm0.h"
+#else
+#include "bricklib2/xmclib/CMSIS/Include/core_cm0.h"
+#endif
+
+#ifndef LOGGING_TRACE_BUFFER_SIZE
+#define LOGGING_TRACE_BUFFER_SIZE 512 // has to be power of 2
+#endif
+
+#define LOGGING_TRACE_BUFFER_MASK (LOGGING_TRACE_BUFFER_SIZE - 1)
+
+static uint8_t logging_trace_buffer[LOGGING_TRACE_BUFFER_SIZE];
+static volatile uint16_t logging_trace_start = 0;
+static volatile uint16_t logging_trace_end = 0;
+static volatile uint32_t logging_trace_dropped = 0;
+
+static inline uint32_t logging_trace_critical_enter(void) {
+#if defined(__SAM0__)
+	return cpu_irq_save();
+#else
+	const uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	return primask;
+#endif
+}
+
+static inline void logging_trace_critical_exit(const uint32_t primask) {
+#if defined(__SAM0__)
+	cpu_irq_restore(primask);
+#else
+	__set_PRIMASK(primask);
+#endif
+}
+#endif
+
 void logging_init(void) {
 #ifdef LOGGING_UARTBB
 	uartbb_init();
@@ -117,3 +156,77 @@ void log_array_u64(const uint64_t *arr, const int32_t length, const bool end_of_
 		LOGGING_PRINT("\n\r");
 	}
 }
+
+#ifdef LOGGING_TRACE
+// Record: sync, id (uint16), header (level << 4 | flags | argc), [timestamp (uint32)], args (uint32 each).
+// Everything is little endian. A record that does not fit is dropped completely.
+void logging_trace_write(const uint32_t id, const uint8_t header, const uint32_t *args) {
+	uint8_t record[4 + 4 + LOGGING_TRACE_ARGS_MAX*4];
+	uint8_t length = 0;
+
+#ifdef LOGGING_HAVE_SYSTEM_TIME
+	const uint32_t timestamp = LOGGING_SYSTEM_TIME_FUNCTION();
+	record[length++] = LOGGING_TRACE_SYNC_TIMESTAMP;
+#else
+	record[length++] = LOGGING_TRACE_SYNC;
+#endif
+	record[length++] = id & 0xFF;
+	record[length++] = (id >> 8) & 0xFF;
+	record[length++] = header;
+#ifdef LOGGING_HAVE_SYSTEM_TIME
+	memcpy(&record[length], &timestamp, 4);
+	length += 4;
+#endif
+	const uint8_t argc = header & 0x0F;
+	memcpy(&record[length], args, argc*4);
+	length += argc*4;
+
+	const uint32_t primask = logging_trace_critical_enter();
+	const uint16_t free = (logging_trace_start - logging_trace_end - 1) & LOGGING_TRACE_BUFFER_MASK;
+	if(length > free) {
+		logging_trace_dropped++;
+	} else {
+		uint16_t end = logging_trace_end;
+		for(uint8_t i = 0; i < length; i++) {
+			logging_trace_buffer[end] = record[i];
+			end = (end + 1) & LOGGING_TRACE_BUFFER_MASK;
+		}
+		logging_trace_end = end;
+	}
+	logging_trace_critical_exit(primask);
+}
+
+// Can be used by the firmware to send the trace through its own channel (e.g. TFP)
+uint16_t logging_trace_read(uint8_t *data, const uint16_t length) {
+	uint16_t i = 0;
+	while((i < length) && (logging_trace_start != logging_trace_end)) {
+		data[i++] = logging_trace_buffer[logging_trace_start];
+		logging_trace_start = (logging_trace_start + 1) & LOGGING_TRACE_BUFFER_MASK;
+	}
+
+	return i;
+}
+
+uint32_t logging_trace_get_dropped(void) {
+	return logging_trace_dropped;
+}
+
+// Moves the trace to the normal logging output, call this from the main loop
+void logging_trace_tick(void) {
+	uint8_t data[16];
+	uint16_t length;
+	while((length = logging_trace_read(data, sizeof(data))) > 0) {
+#ifdef LOGGING_UARTBB
+#ifdef UARTBB_BUFFERED
+		uartbb_write(data, length);
+#else
+		for(uint16_t i = 0; i < length; i++) {
+			uartbb_tx(data[i]);
+		}
+#endif
+#else
+		fwrite(data, 1, length, stdout);
+#endif
+	}
+}
+#endif
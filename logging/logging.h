@@ -56,7 +56,20 @@ void logging_init(void);
 #define DEBUG_STARTUP 0
 #endif
 
-#ifdef COMPILE_FOR_RELEASE
+#if defined(LOGGING_TRACE)
+// Binary trace mode: Only an ID of the format string and the raw arguments
+// are written to a ringbuffer (see logging_trace_write). The format strings
+// are put into the non-allocated section .logging_trace, they don't use flash.
+// The ID is the offset of the string in this section, the host-side
+// logging_trace_decode.py maps it back to the string with the help of the ELF.
+//
+// Every argument is cast to uint32_t. Floats, doubles and 64 bit values are
+// rejected at compile time (see LOGGING_TRACE_ARG). %s arguments have to point
+// to constant strings in flash, the decoder reads them from the ELF. This can't
+// be checked at compile time, a string in RAM decodes to garbage.
+// In trace mode logd is also available with COMPILE_FOR_RELEASE.
+#define LOGGING_PRINT(str, ...) LOGGING_TRACE_WRITE(LOGGING_NONE, LOGGING_TRACE_FLAG_NO_HEADER, str, ##__VA_ARGS__)
+#elif defined(COMPILE_FOR_RELEASE)
 #define LOGGING_PRINT(...) \
 	do{ \
 		sdlog_printf(__VA_ARGS__); \
@@ -86,44 +99,100 @@ void logging_init(void);
 #define LOGGING_TIMESTAMP_VALUE
 #endif
 
-#ifdef COMPILE_FOR_RELEASE
+#ifdef LOGGING_TRACE
+#include <stdint.h>
+
+#define LOGGING_TRACE_SYNC                0xA5 // Record without timestamp
+#define LOGGING_TRACE_SYNC_TIMESTAMP      0xA6 // Record with uint32 timestamp
+#define LOGGING_TRACE_FLAG_NO_HEADER      (1 << 7)
+#define LOGGING_TRACE_ARGS_MAX            8
+
+#define LOGGING_TRACE_STRINGIFY_(x) #x
+#define LOGGING_TRACE_STRINGIFY(x) LOGGING_TRACE_STRINGIFY_(x)
+#define LOGGING_TRACE_CONCAT_(a, b) a##b
+#define LOGGING_TRACE_CONCAT(a, b) LOGGING_TRACE_CONCAT_(a, b)
+
+#define LOGGING_TRACE_NARGS_(_0, _1, _2, _3, _4, _5, _6, _7, _8, n, ...) n
+#define LOGGING_TRACE_NARGS(...) LOGGING_TRACE_NARGS_(0, ##__VA_ARGS__, 8, 7, 6, 5, 4, 3, 2, 1, 0)
+
+// Casts the argument to uint32_t. A float or a value that does not fit into
+// 32 bit would be silently truncated, so it is a compile error instead.
+#define LOGGING_TRACE_ARG(a) \
+	((uint32_t)(a) + 0*sizeof(struct { \
+		_Static_assert(sizeof((a) + 0) <= sizeof(uint32_t), "Trace arguments have to fit into 32 bit"); \
+		_Static_assert(!__builtin_types_compatible_p(__typeof__((a) + 0), float), "Trace arguments can't be float"); \
+		int unused; \
+	}))
+
+#define LOGGING_TRACE_ARGS_0()
+#define LOGGING_TRACE_ARGS_1(a)      LOGGING_TRACE_ARG(a)
+#define LOGGING_TRACE_ARGS_2(a, ...) LOGGING_TRACE_ARG(a), LOGGING_TRACE_ARGS_1(__VA_ARGS__)
+#define LOGGING_TRACE_ARGS_3(a, ...) LOGGING_TRACE_ARG(a), LOGGING_TRACE_ARGS_2(__VA_ARGS__)
+#define LOGGING_TRACE_ARGS_4(a, ...) LOGGING_TRACE_ARG(a), LOGGING_TRACE_ARGS_3(__VA_ARGS__)
+#define LOGGING_TRACE_ARGS_5(a, ...) LOGGING_TRACE_ARG(a), LOGGING_TRACE_ARGS_4(__VA_ARGS__)
+#define LOGGING_TRACE_ARGS_6(a, ...) LOGGING_TRACE_ARG(a), LOGGING_TRACE_ARGS_5(__VA_ARGS__)
+#define LOGGING_TRACE_ARGS_7(a, ...) LOGGING_TRACE_ARG(a), LOGGING_TRACE_ARGS_6(__VA_ARGS__)
+#define LOGGING_TRACE_ARGS_8(a, ...) LOGGING_TRACE_ARG(a), LOGGING_TRACE_ARGS_7(__VA_ARGS__)
+
+// The string in .logging_trace is "file\0line\0format"
+#define LOGGING_TRACE_WRITE(level, flags, str, ...) \
+	do{ \
+		static const char _logging_trace_str[] __attribute__((section(".logging_trace"), used)) = \
+			__FILE__ "\0" LOGGING_TRACE_STRINGIFY(__LINE__) "\0" str; \
+		const uint32_t _logging_trace_args[] = {0, LOGGING_TRACE_CONCAT(LOGGING_TRACE_ARGS_, LOGGING_TRACE_NARGS(__VA_ARGS__))(__VA_ARGS__)}; \
+		logging_trace_write((uint32_t)_logging_trace_str, ((level) << 4) | (flags) | LOGGING_TRACE_NARGS(__VA_ARGS__), &_logging_trace_args[1]); \
+	} while(0)
+
+#define LOGGING_HEADER(level_char, level, str, ...) LOGGING_TRACE_WRITE(level, 0, str, ##__VA_ARGS__)
+#define LOGGING_NO_HEADER(level, str, ...) LOGGING_TRACE_WRITE(level, LOGGING_TRACE_FLAG_NO_HEADER, str, ##__VA_ARGS__)
+
+void logging_trace_write(const uint32_t id, const uint8_t header, const uint32_t *args);
+uint16_t logging_trace_read(uint8_t *data, const uint16_t length);
+uint32_t logging_trace_get_dropped(void);
+void logging_trace_tick(void);
+#else
+#define LOGGING_HEADER(level_char, level, str, ...) LOGGING_PRINT("<" LOGGING_TIMESTAMP_FORMAT level_char " %s:%d> " str, LOGGING_TIMESTAMP_VALUE LOGGING_BASENAME(__FILE__), __LINE__, ##__VA_ARGS__)
+#define LOGGING_NO_HEADER(level, str, ...) LOGGING_PRINT(str, ##__VA_ARGS__)
+#endif
+
+#if defined(COMPILE_FOR_RELEASE) && !defined(LOGGING_TRACE)
 #define logd(str,  ...) {}
 #define logwohd(str,  ...) {}
 #elif LOGGING_LEVEL <= LOGGING_DEBUG
-#define logd(str,  ...) do{ LOGGING_PRINT("<" LOGGING_TIMESTAMP_FORMAT "D %s:%d> " str, LOGGING_TIMESTAMP_VALUE LOGGING_BASENAME(__FILE__), __LINE__, ##__VA_ARGS__); }while(0)
-#define logwohd(str,  ...) do{ LOGGING_PRINT(str, ##__VA_ARGS__); }while(0)
+#define logd(str,  ...) do{ LOGGING_HEADER("D", LOGGING_DEBUG, str, ##__VA_ARGS__); }while(0)
+#define logwohd(str,  ...) do{ LOGGING_NO_HEADER(LOGGING_DEBUG, str, ##__VA_ARGS__); }while(0)
 #else
 #define logd(str,  ...) {}
 #define logwohd(str,  ...) {}
 #endif
 
 #if LOGGING_LEVEL <= LOGGING_INFO
-#define logi(str,  ...) do{ LOGGING_PRINT("<" LOGGING_TIMESTAMP_FORMAT "I %s:%d> " str, LOGGING_TIMESTAMP_VALUE LOGGING_BASENAME(__FILE__), __LINE__, ##__VA_ARGS__); }while(0)
-#define logwohi(str,  ...) do{ LOGGING_PRINT(str, ##__VA_ARGS__); }while(0)
+#define logi(str,  ...) do{ LOGGING_HEADER("I", LOGGING_INFO, str, ##__VA_ARGS__); }while(0)
+#define logwohi(str,  ...) do{ LOGGING_NO_HEADER(LOGGING_INFO, str, ##__VA_ARGS__); }while(0)
 #else
 #define logi(str,  ...) {}
 #define logwohi(str,  ...) {}
 #endif
 
 #if LOGGING_LEVEL <= LOGGING_WARNING
-#define logw(str,  ...) do{ LOGGING_PRINT("<" LOGGING_TIMESTAMP_FORMAT "W %s:%d> " str, LOGGING_TIMESTAMP_VALUE LOGGING_BASENAME(__FILE__), __LINE__, ##__VA_ARGS__); }while(0)
-#define logwohw(str,  ...) do{ LOGGING_PRINT(str, ##__VA_ARGS__); }while(0)
+#define logw(str,  ...) do{ LOGGING_HEADER("W", LOGGING_WARNING, str, ##__VA_ARGS__); }while(0)
+#define logwohw(str,  ...) do{ LOGGING_NO_HEADER(LOGGING_WARNING, str, ##__VA_ARGS__); }while(0)
 #else
 #define logw(str,  ...) {}
 #define logwohw(str,  ...) {}
 #endif
 
 #if LOGGING_LEVEL <= LOGGING_ERROR
-#define loge(str,  ...) do{ LOGGING_PRINT("<" LOGGING_TIMESTAMP_FORMAT "E %s:%d> " str, LOGGING_TIMESTAMP_VALUE LOGGING_BASENAME(__FILE__), __LINE__, ##__VA_ARGS__); }while(0)
-#define logwohe(str,  ...) do{ LOGGING_PRINT(str, ##__VA_ARGS__); }while(0)
+#define loge(str,  ...) do{ LOGGING_HEADER("E", LOGGING_ERROR, str, ##__VA_ARGS__); }while(0)
+#define logwohe(str,  ...) do{ LOGGING_NO_HEADER(LOGGING_ERROR, str, ##__VA_ARGS__); }while(0)
 #else
 #define loge(str,  ...) {}
 #define logwohe(str,  ...) {}
 #endif
 
 #if LOGGING_LEVEL <= LOGGING_FATAL
-#define logf(str,  ...) do{ LOGGING_PRINT("<" LOGGING_TIMESTAMP_FORMAT "F %s:%d> " str, LOGGING_TIMESTAMP_VALUE LOGGING_BASENAME(__FILE__), __LINE__, ##__VA_ARGS__); }while(0)
-#define logwohf(str,  ...) do{ LOGGING_PRINT(str, ##__VA_ARGS__); }while(0)
+#define logf(str,  ...) do{ LOGGING_HEADER("F", LOGGING_FATAL, str, ##__VA_ARGS__); }while(0)
+#define logwohf(str,  ...) do{ LOGGING_NO_HEADER(LOGGING_FATAL, str, ##__VA_ARGS__); }while(0)
 #else
 #define logf(str,  ...) {}
 #define logwohf(str,  ...) {}
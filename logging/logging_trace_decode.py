@@ -0,0 +1,200 @@
+#!/usr/bin/env python3
+# -*- coding: utf-8 -*-
+
+# bricklib2
+# Copyright (C) 2026 Olaf Lüke <olaf@tinkerforge.com>
+#
+# logging_trace_decode.py: Decoder for binary trace (LOGGING_TRACE)
+#
+# This library is free software; you can redistribute it and/or
+# modify it under the terms of the GNU Lesser General Public
+# License as published by the Free Software Foundation; either
+# version 2 of the License, or (at your option) any later version.
+#
+# This library is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+# Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public
+# License along with this library; if not, write to the
+# Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+# Boston, MA 02111-1307, USA.
+
+# Usage:
+#   logging_trace_decode.py firmware.elf trace.bin
+#   logging_trace_decode.py firmware.elf /dev/ttyUSB0 --baudrate 115200  (needs pyserial)
+#   cat trace.bin | logging_trace_decode.py firmware.elf -
+
+import argparse
+import os
+import re
+import struct
+import sys
+
+SYNC = 0xA5
+SYNC_TIMESTAMP = 0xA6
+FLAG_NO_HEADER = 1 << 7
+LEVELS = ['D', 'I', 'W', 'E', 'F', 'N']
+SHF_ALLOC = 0x2
+SHT_NOBITS = 8
+
+FORMAT_RE = re.compile(r'%([-+ #0]*)(\d*|_\d+)(?:\.(\d+))?(hh|h|ll|l|z)?([diuxXbcsp%])')
+
+class ELF:
+    def __init__(self, path):
+        with open(path, 'rb') as f:
+            self.data = f.read()
+
+        if self.data[:4] != b'\x7fELF':
+            raise ValueError('{0} is not an ELF file'.format(path))
+
+        # 32 bit for the firmware, 64 bit is supported for host builds
+        if self.data[4] == 1:
+            shoff, = struct.unpack_from('<I', self.data, 0x20)
+            shentsize, shnum, shstrndx = struct.unpack_from('<HHH', self.data, 0x2E)
+            section_format = '<IIIIII'
+        else:
+            shoff, = struct.unpack_from('<Q', self.data, 0x28)
+            shentsize, shnum, shstrndx = struct.unpack_from('<HHH', self.data, 0x3A)
+            section_format = '<IIQQQQ'
+
+        sections = []
+        for i in range(shnum):
+            name, type_, flags, addr, offset, size = struct.unpack_from(section_format, self.data, shoff + i*shentsize)
+            sections.append([name, type_, flags, addr, offset, size])
+
+        strtab_offset = sections[shstrndx][4]
+        self.sections = {}
+        for name, type_, flags, addr, offset, size in sections:
+            end = self.data.index(b'\0', strtab_offset + name)
+            self.sections[self.data[strtab_offset + name:end].decode()] = (type_, flags, addr, offset, size)
+
+        if '.logging_trace' not in self.sections:
+            raise ValueError('{0} has no .logging_trace section, is LOGGING_TRACE enabled?'.format(path))
+
+    # Returns (file, line, format) for an ID
+    def get_trace_string(self, trace_id):
+        _, _, _, offset, size = self.sections['.logging_trace']
+        if trace_id >= size:
+            return None
+
+        start = offset + trace_id
+        parts = []
+        for _ in range(3):
+            end = self.data.index(b'\0', start)
+            parts.append(self.data[start:end].decode('utf-8', 'replace'))
+            start = end + 1
+
+        return parts[0], parts[1], parts[2]
+
+    # Reads a constant string from flash (for %s)
+    def get_string(self, address):
+        for type_, flags, addr, offset, size in self.sections.values():
+            if (flags & SHF_ALLOC) and type_ != SHT_NOBITS and addr <= address < addr + size:
+                start = offset + address - addr
+                end = self.data.index(b'\0', start)
+                return self.data[start:end].decode('utf-8', 'replace')
+
+        return '<0x{0:08x}>'.format(address)
+
+def count_arguments(fmt):
+    return len([m for m in FORMAT_RE.finditer(fmt) if m.group(5) != '%'])
+
+def format_message(elf, fmt, args):
+    args = list(args)
+
+    def replace(m):
+        flags, width, precision, _, conversion = m.groups()
+        if conversion == '%':
+            return '%'
+
+        value = args.pop(0) if len(args) > 0 else 0
+        if width.startswith('_'): # uartbb grouping is not supported, ignore it
+            width = ''
+
+        spec = '%' + flags + width + ('.' + precision if precision else '')
+        if conversion in 'di':
+            return (spec + 'd') % (value - (1 << 32) if value & (1 << 31) else value)
+        elif conversion == 'u':
+            return (spec + 'd') % value
+        elif conversion in 'xX':
+            return (spec + conversion) % value
+        elif conversion == 'p':
+            return '0x{0:08x}'.format(value)
+        elif conversion == 'b':
+            return (spec + 's') % format(value, 'b')
+        elif conversion == 'c':
+            return (spec + 'c') % (value & 0xFF)
+        elif conversion == 's':
+            return (spec + 's') % elf.get_string(value)
+
+    return FORMAT_RE.sub(replace, fmt)
+
+def decode(elf, stream, out):
+    buf = bytearray()
+
+    while True:
+        data = stream.read(64)
+        if not data:
+            break
+        buf += data
+
+        while len(buf) > 0:
+            if buf[0] not in (SYNC, SYNC_TIMESTAMP):
+                del buf[0] # resync after dropped bytes
+                continue
+
+            header_length = 4 + (4 if buf[0] == SYNC_TIMESTAMP else 0)
+            if len(buf) < header_length:
+                break
+
+            trace_id, header = struct.unpack_from('<HB', buf, 1)
+            argc = header & 0x0F
+            level = (header >> 4) & 0x07
+            length = header_length + argc*4
+            trace = elf.get_trace_string(trace_id)
+
+            if trace is None or argc > 8 or count_arguments(trace[2]) != argc:
+                del buf[0] # not a valid record, resync
+                continue
+
+            if len(buf) < length:
+                break
+
+            timestamp = struct.unpack_from('<I', buf, 4)[0] if buf[0] == SYNC_TIMESTAMP else None
+            args = struct.unpack_from('<{0}I'.format(argc), buf, header_length)
+            del buf[:length]
+
+            message = format_message(elf, trace[2], args)
+            if not (header & FLAG_NO_HEADER):
+                prefix = '' if timestamp is None else '{0} '.format(timestamp)
+                message = '<{0}{1} {2}:{3}> {4}'.format(prefix, LEVELS[min(level, 5)], os.path.basename(trace[0]), trace[1], message)
+
+            out.write(message.replace('\n\r', '\n'))
+            out.flush()
+
+def main():
+    parser = argparse.ArgumentParser(description='Decode binary LOGGING_TRACE output')
+    parser.add_argument('elf', help='ELF file of the firmware that produced the trace')
+    parser.add_argument('input', help='file with raw trace data, serial port or - for stdin')
+    parser.add_argument('--baudrate', type=int, default=115200, help='baudrate if input is a serial port')
+    args = parser.parse_args()
+
+    elf = ELF(args.elf)
+
+    if args.input == '-':
+        stream = sys.stdin.buffer
+    elif args.input.startswith('/dev/') or args.input.upper().startswith('COM'):
+        import serial
+        stream = serial.Serial(args.input, args.baudrate)
+    else:
+        stream = open(args.input, 'rb')
+
+    try:
+        decode(elf, stream, sys.stdout)
+    except KeyboardInterrupt:
+        pass
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,107 @@
+/* bricklib2
+ * Copyright (C) 2026 Olaf Lüke <olaf@tinkerforge.com>
+ *
+ * coop_protothread.h: Stackless (protothread-style) tasks for simple
+ *                     state machines that do not need a coop_task stack
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+**/
+
+#ifndef COOP_PROTOTHREAD_H
+#define COOP_PROTOTHREAD_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "bricklib2/hal/system_timer/system_timer.h"
+
+// A protothread is a function that is called from the main loop (like the
+// usual *_tick functions) and resumes at the position where it last yielded.
+// It only needs a few byte of RAM for the resume position instead of a
+// complete coop_task stack.
+//
+// Restrictions:
+// * Local variables are not preserved between yields, use static or struct members.
+// * Yield/wait is only possible directly in the protothread function, not in sub functions.
+// * No switch statement can be used around a yield/wait.
+//
+// Example:
+//
+// static CoopProtothread meter_pt;
+// static CoopProtothreadState meter_task(CoopProtothread *pt) {
+//     COOP_PT_BEGIN(pt);
+//     while(true) {
+//         meter_start_request();
+//         COOP_PT_WAIT_UNTIL(pt, meter_is_response_ready());
+//         meter_handle_response();
+//         COOP_PT_SLEEP_MS(pt, 100);
+//     }
+//     COOP_PT_END(pt);
+// }
+//
+// void meter_tick(void) {
+//     meter_task(&meter_pt);
+// }
+
+typedef enum {
+	COOP_PT_STATE_WAITING = 0,
+	COOP_PT_STATE_YIELDED,
+	COOP_PT_STATE_ENDED
+} CoopProtothreadState;
+
+typedef struct {
+	uint16_t line;
+	uint32_t time;
+} CoopProtothread;
+
+#define COOP_PT_INIT(pt) do { (pt)->line = 0; (pt)->time = 0; } while(0)
+
+#define COOP_PT_BEGIN(pt) switch((pt)->line) { case 0:
+
+#define COOP_PT_END(pt) } (pt)->line = 0; return COOP_PT_STATE_ENDED
+
+#define COOP_PT_YIELD(pt) \
+	do { \
+		(pt)->line = __LINE__; \
+		return COOP_PT_STATE_YIELDED; \
+		case __LINE__:; \
+	} while(0)
+
+#define COOP_PT_WAIT_UNTIL(pt, condition) \
+	do { \
+		(pt)->line = __LINE__; \
+		__attribute__((fallthrough)); \
+		case __LINE__: \
+		if(!(condition)) { \
+			return COOP_PT_STATE_WAITING; \
+		} \
+	} while(0)
+
+#define COOP_PT_WAIT_WHILE(pt, condition) COOP_PT_WAIT_UNTIL(pt, !(condition))
+
+#define COOP_PT_SLEEP_MS(pt, sleep) \
+	do { \
+		(pt)->time = system_timer_get_ms(); \
+		COOP_PT_WAIT_UNTIL(pt, system_timer_is_time_elapsed_ms((pt)->time, (sleep))); \
+	} while(0)
+
+#define COOP_PT_RESTART(pt) \
+	do { \
+		(pt)->line = 0; \
+		return COOP_PT_STATE_YIELDED; \
+	} while(0)
+
+#endif
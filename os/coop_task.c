@@ -33,24 +33,115 @@
 #include <string.h>
 
 // Use uint32_t for coop_task_main (we only need to save the stack pointer for main task.
-// All other tasks are of type CoopTaskStack and they contain the stack, the
-// stack frame as well as the stack pointer.
-// In CoopTaskStack the stack pointer is always at the first position (so it is compatible)
-// to the main task uint32_t. From there the stack and stack frame is 8-byte aligned
-// packed directly below the stack pointer.
-// This may seem a bit like a hack, but it works well and makes debugging a lot easier,
-// since all of the stack, stack frame and pointer of all tasks are always at the
-// same offset to each other.
+// All other tasks are of type CoopTask, which has the stack pointer at the first
+// position (so it is compatible to the main task uint32_t).
+// The stack itself is either the CoopTaskStack embedded in the CoopTask (coop_task_init)
+// or an external buffer of arbitrary size (coop_task_init_with_stack).
 volatile uint32_t coop_task_main = 0;
 volatile void *coop_task_current = &coop_task_main;
 volatile void *coop_task_next = NULL;
 
+// Task that is currently running (NULL if main task is running)
+static CoopTask *coop_task_running = NULL;
+
+// Scheduler lists. The ready list is FIFO, the sleep list is sorted by wake time.
+// Both can be changed from IRQ context (through the wait queue notify), so they
+// are only accessed inside of a critical section.
+static CoopTask *coop_task_ready_head = NULL;
+static CoopTask *coop_task_ready_tail = NULL;
+static CoopTask *coop_task_sleep_head = NULL;
+
+#ifdef COOP_TASK_DEBUG_STATISTICS
+static CoopTask *coop_task_statistics_tasks[COOP_TASK_STATISTICS_MAX_TASKS] = {NULL};
+static uint8_t coop_task_statistics_task_count = 0;
+static uint32_t coop_task_statistics_switch_count = 0;
+static uint32_t coop_task_statistics_switch_count_last_second = 0;
+static uint32_t coop_task_statistics_second_start = 0;
+#endif
+
 static void coop_task_default_return_from_task(void) {
 	while(true);
 }
 
+static inline uint32_t coop_task_critical_enter(void) {
+	const uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	return primask;
+}
+
+static inline void coop_task_critical_exit(const uint32_t primask) {
+	__set_PRIMASK(primask);
+}
+
+// Has to be called inside of critical section
+static void coop_task_ready_list_append(CoopTask *task) {
+	task->state = COOP_TASK_STATE_READY;
+	task->next  = NULL;
+	if(coop_task_ready_tail == NULL) {
+		coop_task_ready_head = task;
+	} else {
+		coop_task_ready_tail->next = task;
+	}
+	coop_task_ready_tail = task;
+}
+
+// Has to be called inside of critical section
+static void coop_task_sleep_list_insert(CoopTask *task) {
+	CoopTask **pos = &coop_task_sleep_head;
+	// Insert behind all tasks with same or earlier wake time (wrap-around safe)
+	while((*pos != NULL) && ((int32_t)((*pos)->wake_time - task->wake_time) <= 0)) {
+		pos = &(*pos)->next;
+	}
+	task->next = *pos;
+	*pos = task;
+}
+
+// Has to be called inside of critical section
+static void coop_task_sleep_list_remove(CoopTask *task) {
+	for(CoopTask **pos = &coop_task_sleep_head; *pos != NULL; pos = &(*pos)->next) {
+		if(*pos == task) {
+			*pos = task->next;
+			task->next = NULL;
+			return;
+		}
+	}
+}
+
+// Has to be called inside of critical section
+static void coop_task_wait_queue_remove(CoopTaskWaitQueue *queue, CoopTask *task) {
+	CoopTask *prev = NULL;
+	for(CoopTask *t = queue->head; t != NULL; prev = t, t = t->wait_next) {
+		if(t == task) {
+			if(prev == NULL) {
+				queue->head = t->wait_next;
+			} else {
+				prev->wait_next = t->wait_next;
+			}
+			if(queue->tail == t) {
+				queue->tail = prev;
+			}
+			t->wait_next  = NULL;
+			t->wait_queue = NULL;
+			return;
+		}
+	}
+}
+
 // This function can not be called from "main task"
 void coop_task_sleep_ms(const uint32_t sleep) {
+	CoopTask *task = coop_task_running;
+	if((task != NULL) && task->scheduled) {
+		// The scheduler does not switch to this task again until the wake time is reached
+		const uint32_t primask = coop_task_critical_enter();
+		task->wake_time = system_timer_get_ms() + sleep;
+		task->state     = COOP_TASK_STATE_SLEEPING;
+		coop_task_sleep_list_insert(task);
+		coop_task_critical_exit(primask);
+
+		coop_task_yield();
+		return;
+	}
+
 	const uint32_t time = system_timer_get_ms();
 	while(!system_timer_is_time_elapsed_ms(time, sleep)) {
 		coop_task_yield();
@@ -75,14 +166,19 @@ void coop_task_tick(CoopTask *task) {
 #ifdef COOP_TASK_DEBUG_STACK_LOW_WATERMARK
 	// Calculate currently available stack and save it as low watermark if it is
 	// lower then previous low watermark.
-	uint32_t stack_free = (uint32_t)task->stack.stack_pointer - (uint32_t)task->stack.stack;
+	uint32_t stack_free = task->stack_pointer - (uint32_t)task->stack_base;
 	if(stack_free < task->stack_low_watermark) {
 		task->stack_low_watermark = stack_free;
 	}
 #endif
 
+#ifdef COOP_TASK_DEBUG_STATISTICS
+	const uint32_t run_start_us = system_timer_get_us32();
+#endif
+
 	coop_task_current = &coop_task_main;
 	coop_task_next = task;
+	coop_task_running = task;
 
 	// Trigger PendSV handler
 	SCB->ICSR |= SCB_ICSR_PENDSVSET_Msk;
@@ -90,32 +186,299 @@ void coop_task_tick(CoopTask *task) {
 	__asm__("nop");
 	__asm__("nop");
 	__asm__("nop");
+
+	coop_task_running = NULL;
+
+#ifdef COOP_TASK_DEBUG_STATISTICS
+	const uint32_t run_us = system_timer_get_us32() - run_start_us;
+	task->statistics.run_count++;
+	task->statistics.run_time_us += run_us;
+	if(run_us > task->statistics.run_max_us) {
+		task->statistics.run_max_us = run_us;
+	}
+
+	// Switch to task and back to main
+	coop_task_statistics_switch_count += 2;
+	if(system_timer_is_time_elapsed_ms(coop_task_statistics_second_start, 1000)) {
+		coop_task_statistics_second_start = system_timer_get_ms();
+		coop_task_statistics_switch_count_last_second = coop_task_statistics_switch_count;
+		coop_task_statistics_switch_count = 0;
+	}
+#endif
 }
 
-void coop_task_init(CoopTask *task, CoopTaskFunction function) {
-	task->function = function;
-	memset(&task->stack, COOP_TASK_STACK_FILL, sizeof(CoopTaskStack));
-
-	task->stack.stack_pointer = (uint32_t)(task->stack.stack + COOP_TASK_STACK_SIZE);
-
-	task->stack.stack_frame.nvic_frame.r0  = 0xfffffff0;
-	task->stack.stack_frame.nvic_frame.r1  = 0xfffffff1;
-	task->stack.stack_frame.nvic_frame.r2  = 0xfffffff2;
-	task->stack.stack_frame.nvic_frame.r3  = 0xfffffff3;
-	task->stack.stack_frame.sw_frame.r4    = 0xfffffff4;
-	task->stack.stack_frame.sw_frame.r5    = 0xfffffff5;
-	task->stack.stack_frame.sw_frame.r6    = 0xfffffff6;
-	task->stack.stack_frame.sw_frame.r7    = 0xfffffff7;
-	task->stack.stack_frame.sw_frame.r8    = 0xfffffff8;
-	task->stack.stack_frame.sw_frame.r9    = 0xfffffff9;
-	task->stack.stack_frame.sw_frame.r10   = 0xfffffffa;
-	task->stack.stack_frame.sw_frame.r11   = 0xfffffffb;
-	task->stack.stack_frame.nvic_frame.r12 = 0xfffffffc;
-	task->stack.stack_frame.nvic_frame.lr  = coop_task_default_return_from_task;
-	task->stack.stack_frame.nvic_frame.pc  = task->function;
-	task->stack.stack_frame.nvic_frame.psr = 0x21000000; // Everybody uses 0x21000000 here, seems to be the default
+// This function can only be called from main task
+void coop_task_scheduler_add(CoopTask *task) {
+	task->scheduled = true;
+
+	const uint32_t primask = coop_task_critical_enter();
+	coop_task_ready_list_append(task);
+	coop_task_critical_exit(primask);
+}
+
+// This function can only be called from main task.
+// Every task that is ready at the beginning of the tick runs exactly once.
+void coop_task_scheduler_tick(void) {
+	uint32_t primask = coop_task_critical_enter();
+
+	// Move all tasks with elapsed wake time from sleep list to ready list
+	const uint32_t now = system_timer_get_ms();
+	while((coop_task_sleep_head != NULL) && ((int32_t)(now - coop_task_sleep_head->wake_time) >= 0)) {
+		CoopTask *task = coop_task_sleep_head;
+		coop_task_sleep_head = task->next;
+
+		// A waiting task in the sleep list has a wait timeout
+		if(task->wait_queue != NULL) {
+			coop_task_wait_queue_remove(task->wait_queue, task);
+			task->wait_result = false;
+		}
+		coop_task_ready_list_append(task);
+	}
+
+	// Take the current ready list. Tasks that become ready while we run
+	// this list (e.g. notified from IRQ) are run in the next tick.
+	CoopTask *ready = coop_task_ready_head;
+	coop_task_ready_head = NULL;
+	coop_task_ready_tail = NULL;
+	coop_task_critical_exit(primask);
+
+	while(ready != NULL) {
+		CoopTask *task = ready;
+		ready = task->next;
+		task->next  = NULL;
+		task->state = COOP_TASK_STATE_RUNNING;
+
+		coop_task_tick(task);
+
+		// If the task did only yield it is still ready. Otherwise
+		// it has put itself into the sleep list or a wait queue.
+		primask = coop_task_critical_enter();
+		if(task->state == COOP_TASK_STATE_RUNNING) {
+			coop_task_ready_list_append(task);
+		}
+		coop_task_critical_exit(primask);
+	}
+}
+
+void coop_task_wait_queue_init(CoopTaskWaitQueue *queue) {
+	queue->head    = NULL;
+	queue->tail    = NULL;
+	queue->pending = 0;
+}
+
+// This function can not be called from "main task".
+// Returns true if notified and false if the timeout elapsed.
+// Use COOP_TASK_WAIT_FOREVER as timeout to wait without timeout.
+bool coop_task_wait_queue_wait(CoopTaskWaitQueue *queue, const uint32_t timeout_ms) {
+	CoopTask *task = coop_task_running;
+
+	uint32_t primask = coop_task_critical_enter();
+	if(queue->pending > 0) {
+		queue->pending--;
+		coop_task_critical_exit(primask);
+		return true;
+	}
+
+	if((task == NULL) || !task->scheduled) {
+		coop_task_critical_exit(primask);
+
+		// Without scheduler we can only poll the queue
+		const uint32_t time = system_timer_get_ms();
+		while((timeout_ms == COOP_TASK_WAIT_FOREVER) || !system_timer_is_time_elapsed_ms(time, timeout_ms)) {
+			coop_task_yield();
+
+			primask = coop_task_critical_enter();
+			if(queue->pending > 0) {
+				queue->pending--;
+				coop_task_critical_exit(primask);
+				return true;
+			}
+			coop_task_critical_exit(primask);
+		}
+
+		return false;
+	}
+
+	task->wait_queue  = queue;
+	task->wait_next   = NULL;
+	task->wait_result = false;
+	task->state       = COOP_TASK_STATE_WAITING;
+	if(queue->tail == NULL) {
+		queue->head = task;
+	} else {
+		queue->tail->wait_next = task;
+	}
+	queue->tail = task;
+
+	if(timeout_ms != COOP_TASK_WAIT_FOREVER) {
+		task->wake_time = system_timer_get_ms() + timeout_ms;
+		coop_task_sleep_list_insert(task);
+	}
+	coop_task_critical_exit(primask);
+
+	// The scheduler does not switch to this task again until
+	// it is notified or the timeout elapsed
+	coop_task_yield();
+
+	return task->wait_result;
+}
+
+// Has to be called inside of critical section
+static bool coop_task_wait_queue_wake_one(CoopTaskWaitQueue *queue) {
+	CoopTask *task = queue->head;
+	if(task == NULL) {
+		return false;
+	}
+
+	queue->head = task->wait_next;
+	if(queue->head == NULL) {
+		queue->tail = NULL;
+	}
+	task->wait_next   = NULL;
+	task->wait_queue  = NULL;
+	task->wait_result = true;
+
+	coop_task_sleep_list_remove(task);
+	coop_task_ready_list_append(task);
+
+	return true;
+}
+
+// Can be called from IRQ handler
+void coop_task_wait_queue_notify(CoopTaskWaitQueue *queue) {
+	const uint32_t primask = coop_task_critical_enter();
+	if(!coop_task_wait_queue_wake_one(queue)) {
+		queue->pending++;
+	}
+	coop_task_critical_exit(primask);
+}
+
+// Can be called from IRQ handler
+void coop_task_wait_queue_notify_all(CoopTaskWaitQueue *queue) {
+	const uint32_t primask = coop_task_critical_enter();
+	while(coop_task_wait_queue_wake_one(queue));
+	coop_task_critical_exit(primask);
+}
+
+void coop_task_init_with_stack(CoopTask *task, CoopTaskFunction function, uint8_t *stack, const uint32_t stack_size) {
+	task->function   = function;
+	task->stack_base = stack;
+	task->stack_size = stack_size;
+	memset(stack, COOP_TASK_STACK_FILL, stack_size);
+
+	// Stack on cortex-m MCUs has to be 8-byte aligned. The initial stack frame
+	// is put at the top of the stack, the PendSV handler pops it on the first switch.
+	const uint32_t stack_top = ((uint32_t)stack + stack_size) & ~((uint32_t)7);
+	CoopTaskStackFrame *stack_frame = (CoopTaskStackFrame*)(stack_top - sizeof(CoopTaskStackFrame));
+	task->stack_pointer = (uint32_t)stack_frame;
+
+	stack_frame->nvic_frame.r0  = 0xfffffff0;
+	stack_frame->nvic_frame.r1  = 0xfffffff1;
+	stack_frame->nvic_frame.r2  = 0xfffffff2;
+	stack_frame->nvic_frame.r3  = 0xfffffff3;
+	stack_frame->sw_frame.r4    = 0xfffffff4;
+	stack_frame->sw_frame.r5    = 0xfffffff5;
+	stack_frame->sw_frame.r6    = 0xfffffff6;
+	stack_frame->sw_frame.r7    = 0xfffffff7;
+	stack_frame->sw_frame.r8    = 0xfffffff8;
+	stack_frame->sw_frame.r9    = 0xfffffff9;
+	stack_frame->sw_frame.r10   = 0xfffffffa;
+	stack_frame->sw_frame.r11   = 0xfffffffb;
+	stack_frame->nvic_frame.r12 = 0xfffffffc;
+	stack_frame->nvic_frame.lr  = coop_task_default_return_from_task;
+	stack_frame->nvic_frame.pc  = task->function;
+	stack_frame->nvic_frame.psr = 0x21000000; // Everybody uses 0x21000000 here, seems to be the default
 
 #ifdef COOP_TASK_DEBUG_STACK_LOW_WATERMARK
-	task->stack_low_watermark = COOP_TASK_STACK_SIZE;
+	task->stack_low_watermark = stack_size;
+#endif
+
+#ifdef COOP_TASK_DEBUG_STATISTICS
+	task->statistics.run_count   = 0;
+	task->statistics.run_time_us = 0;
+	task->statistics.run_max_us  = 0;
+
+	bool known = false;
+	for(uint8_t i = 0; i < coop_task_statistics_task_count; i++) {
+		if(coop_task_statistics_tasks[i] == task) {
+			known = true;
+			break;
+		}
+	}
+	if(!known && (coop_task_statistics_task_count < COOP_TASK_STATISTICS_MAX_TASKS)) {
+		coop_task_statistics_tasks[coop_task_statistics_task_count++] = task;
+	}
 #endif
+
+	task->scheduled   = false;
+	task->state       = COOP_TASK_STATE_READY;
+	task->wake_time   = 0;
+	task->next        = NULL;
+	task->wait_next   = NULL;
+	task->wait_queue  = NULL;
+	task->wait_result = false;
+}
+
+#if COOP_TASK_STACK_SIZE > 0
+void coop_task_init(CoopTask *task, CoopTaskFunction function) {
+	// The embedded stack has room for the initial stack frame above the stack
+	coop_task_init_with_stack(task, function, task->stack.stack, sizeof(CoopTaskStack));
+}
+#endif
+
+#ifdef COOP_TASK_DEBUG_STATISTICS
+// Returns the maximum stack usage in byte since coop_task_init.
+// The stack is scanned from the bottom for the first byte that was overwritten.
+// Use a COOP_TASK_STACK_FILL that is unlikely to be written by the task (e.g. 0xA5),
+// with the default of 0 the result may be lower than the real stack usage.
+uint32_t coop_task_get_stack_used_max(const CoopTask *task) {
+	uint32_t untouched = 0;
+	while((untouched < task->stack_size) && (task->stack_base[untouched] == (uint8_t)COOP_TASK_STACK_FILL)) {
+		untouched++;
+	}
+
+	return task->stack_size - untouched;
 }
+
+uint32_t coop_task_get_switches_per_second(void) {
+	return coop_task_statistics_switch_count_last_second;
+}
+
+// Returns true if the message was the statistics getter and the response is filled out.
+// A too short request is answered with an invalid parameter error.
+bool coop_task_statistics_handle_message(const void *message, void *response) {
+	if(tfp_get_fid_from_message(message) != COOP_TASK_STATISTICS_FID_GET_TASK_STATISTICS) {
+		return false;
+	}
+
+	const CoopTaskGetTaskStatistics *data = message;
+	CoopTaskGetTaskStatistics_Response *r = response;
+
+	if(tfp_get_length_from_message(message) < sizeof(CoopTaskGetTaskStatistics)) {
+		r->header.length = sizeof(TFPMessageHeader);
+		r->header.error  = TFP_MESSAGE_ERROR_CODE_INVALID_PARAMETER;
+		return true;
+	}
+
+	r->header.length       = sizeof(CoopTaskGetTaskStatistics_Response);
+	r->task_count          = coop_task_statistics_task_count;
+	r->switches_per_second = coop_task_statistics_switch_count_last_second;
+
+	if(data->index < coop_task_statistics_task_count) {
+		const CoopTask *task = coop_task_statistics_tasks[data->index];
+		r->stack_size     = task->stack_size;
+		r->stack_used_max = coop_task_get_stack_used_max(task);
+		r->run_count      = task->statistics.run_count;
+		r->run_time_us    = task->statistics.run_time_us;
+		r->run_max_us     = task->statistics.run_max_us;
+	} else {
+		r->stack_size     = 0;
+		r->stack_used_max = 0;
+		r->run_count      = 0;
+		r->run_time_us    = 0;
+		r->run_max_us     = 0;
+	}
+
+	return true;
+}
+#endif
@@ -25,15 +25,24 @@
 
 #include "configs/config.h"
 
+#include <stdint.h>
+#include <stdbool.h>
+
 // Use a changeable stack fill, good for debugging!
 #ifndef COOP_TASK_STACK_FILL
 #define COOP_TASK_STACK_FILL 0
 #endif
 
+// Size of the stack that is embedded in every CoopTask and used by coop_task_init.
+// Define it as 0 in config.h if all tasks use coop_task_init_with_stack,
+// then CoopTask does not contain a stack anymore.
 #ifndef COOP_TASK_STACK_SIZE
 #define COOP_TASK_STACK_SIZE 2048
 #endif
 
+// Define an external stack buffer that can be used with coop_task_init_with_stack
+#define COOP_TASK_STACK_DEFINE(name, size) static uint8_t __attribute__((aligned(8))) name[size]
+
 typedef struct {
 	// Registers that the PendSV handler pushes on the stack,
 	// after the NVIC has pushed the registers below
@@ -62,27 +71,125 @@ typedef struct {
 	} nvic_frame;
 } __attribute__((packed)) CoopTaskStackFrame;
 
+#if COOP_TASK_STACK_SIZE > 0
 // Stack on cortex-m MCUs has to be 8-byte aligned
 typedef struct {
-	volatile uint32_t stack_pointer;
 	uint8_t __attribute__((aligned(8))) stack[COOP_TASK_STACK_SIZE];
 	CoopTaskStackFrame stack_frame;
 } __attribute__((packed)) CoopTaskStack;
+#endif
 
 
 typedef void (*CoopTaskFunction)(void) ;
 
+#ifdef COOP_TASK_DEBUG_STATISTICS
+// Maximum number of tasks that can be inspected through TFP
+#ifndef COOP_TASK_STATISTICS_MAX_TASKS
+#define COOP_TASK_STATISTICS_MAX_TASKS 4
+#endif
+
+// Reserved function ID that is used to read the statistics
+#ifndef COOP_TASK_STATISTICS_FID_GET_TASK_STATISTICS
+#define COOP_TASK_STATISTICS_FID_GET_TASK_STATISTICS 229
+#endif
+
 typedef struct {
-	CoopTaskStack stack;
+	uint32_t run_count;    // Number of switches to the task
+	uint32_t run_time_us;  // Time spent in the task (wraps around, use difference between two reads)
+	uint32_t run_max_us;   // Longest time between switch to task and yield
+} CoopTaskStatistics;
+#endif
+
+typedef enum {
+	COOP_TASK_STATE_READY = 0,
+	COOP_TASK_STATE_RUNNING,
+	COOP_TASK_STATE_SLEEPING,
+	COOP_TASK_STATE_WAITING
+} CoopTaskState;
+
+struct CoopTaskWaitQueue;
+
+typedef struct CoopTask {
+	volatile uint32_t stack_pointer; // Has to be the first member, the PendSV handler expects it at offset 0
+	uint8_t *stack_base;
+	uint32_t stack_size;
 	CoopTaskFunction function;
 #ifdef COOP_TASK_DEBUG_STACK_LOW_WATERMARK
 	uint32_t stack_low_watermark;  // low watermark of free stack in byte
 #endif
+#ifdef COOP_TASK_DEBUG_STATISTICS
+	CoopTaskStatistics statistics;
+#endif
+
+	// Only used if the task is managed by the scheduler (see coop_task_scheduler_add)
+	bool scheduled;
+	volatile CoopTaskState state;
+	uint32_t wake_time;                    // in ms, valid if task is in sleep list
+	struct CoopTask *next;                 // next task in ready list or sleep list
+	struct CoopTask *wait_next;            // next task in wait queue
+	struct CoopTaskWaitQueue *wait_queue;  // wait queue the task is currently waiting on
+	volatile bool wait_result;             // true if woken by notify, false on timeout
+
+#if COOP_TASK_STACK_SIZE > 0
+	CoopTaskStack stack;                   // Default stack, only used by coop_task_init
+#endif
 } CoopTask;
 
+// A wait queue can be notified from IRQ handlers (e.g. "SPI transfer done")
+// and wakes the waiting tasks in FIFO order. Notifications that arrive while
+// no task is waiting are counted and consumed by the next wait.
+typedef struct CoopTaskWaitQueue {
+	CoopTask *head;
+	CoopTask *tail;
+	volatile uint32_t pending;
+} CoopTaskWaitQueue;
+
 void coop_task_sleep_ms(const uint32_t sleep);
 void coop_task_yield(void);
+#if COOP_TASK_STACK_SIZE > 0
 void coop_task_init(CoopTask *task, CoopTaskFunction function);
+#endif
+void coop_task_init_with_stack(CoopTask *task, CoopTaskFunction function, uint8_t *stack, const uint32_t stack_size);
 void coop_task_tick(CoopTask *task);
 
+// Scheduler for more than one task. Only tasks that are ready are switched to,
+// sleeping and waiting tasks do not cost any context switch.
+void coop_task_scheduler_add(CoopTask *task);
+void coop_task_scheduler_tick(void);
+
+void coop_task_wait_queue_init(CoopTaskWaitQueue *queue);
+bool coop_task_wait_queue_wait(CoopTaskWaitQueue *queue, const uint32_t timeout_ms);
+void coop_task_wait_queue_notify(CoopTaskWaitQueue *queue);
+void coop_task_wait_queue_notify_all(CoopTaskWaitQueue *queue);
+
+#define COOP_TASK_WAIT_FOREVER 0xFFFFFFFF
+
+#ifdef COOP_TASK_DEBUG_STATISTICS
+#include "bricklib2/protocols/tfp/tfp.h"
+
+typedef struct {
+	TFPMessageHeader header;
+	uint8_t index;
+} __attribute__((__packed__)) CoopTaskGetTaskStatistics;
+
+typedef struct {
+	TFPMessageHeader header;
+	uint8_t task_count;
+	uint32_t switches_per_second;
+	uint32_t stack_size;
+	uint32_t stack_used_max;
+	uint32_t run_count;
+	uint32_t run_time_us;
+	uint32_t run_max_us;
+} __attribute__((__packed__)) CoopTaskGetTaskStatistics_Response;
+
+uint32_t coop_task_get_stack_used_max(const CoopTask *task);
+uint32_t coop_task_get_switches_per_second(void);
+bool coop_task_statistics_handle_message(const void *message, void *response);
+
+#define COOP_TASK_STATISTICS_HANDLE_MESSAGE(message, response) coop_task_statistics_handle_message(message, response)
+#else
+#define COOP_TASK_STATISTICS_HANDLE_MESSAGE(message, response) false
+#endif
+
 #endif
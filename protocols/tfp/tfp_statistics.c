@@ -0,0 +1,112 @@
+/* bricklib2
+ * Copyright (C) 2026 Olaf Lüke <olaf@tinkerforge.com>
+ *
+ * tfp_statistics.c: Optional per-function call statistics for TFP handlers
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include "tfp_statistics.h"
+
+#ifdef TFP_STATISTICS_ENABLED
+
+#include "bricklib2/hal/system_timer/system_timer.h"
+
+#include <string.h>
+
+TFPStatistics tfp_statistics;
+
+static TFPStatisticsSlot *tfp_statistics_get_slot(const uint8_t fid) {
+	for(uint8_t i = 0; i < tfp_statistics.slots_used; i++) {
+		if(tfp_statistics.slot[i].fid == fid) {
+			return &tfp_statistics.slot[i];
+		}
+	}
+
+	if(tfp_statistics.slots_used >= TFP_STATISTICS_SLOT_COUNT) {
+		return NULL;
+	}
+
+	TFPStatisticsSlot *slot = &tfp_statistics.slot[tfp_statistics.slots_used];
+	memset(slot, 0, sizeof(TFPStatisticsSlot));
+	slot->fid = fid;
+	tfp_statistics.slots_used++;
+
+	return slot;
+}
+
+void tfp_statistics_update(const uint8_t fid, const uint32_t start_us, const bool error) {
+	const uint32_t time_us = system_timer_get_us32() - start_us;
+
+	TFPStatisticsSlot *slot = tfp_statistics_get_slot(fid);
+	if(slot == NULL) {
+		tfp_statistics.overflow_count++;
+		return;
+	}
+
+	slot->call_count++;
+	if(error) {
+		slot->error_count++;
+	}
+	slot->time_sum_us += time_us;
+	if(time_us > slot->time_max_us) {
+		slot->time_max_us = time_us;
+	}
+}
+
+// Returns true if the message was the statistics getter and the response is filled out.
+// A too short request is answered with an invalid parameter error.
+bool tfp_statistics_handle_message(const void *message, void *response) {
+	if(tfp_get_fid_from_message(message) != TFP_STATISTICS_FID_GET_FUNCTION_STATISTICS) {
+		return false;
+	}
+
+	const TFPStatisticsGetFunctionStatistics *data = message;
+	TFPStatisticsGetFunctionStatistics_Response *r = response;
+
+	if(tfp_get_length_from_message(message) < sizeof(TFPStatisticsGetFunctionStatistics)) {
+		r->header.length = sizeof(TFPMessageHeader);
+		r->header.error  = TFP_MESSAGE_ERROR_CODE_INVALID_PARAMETER;
+		return true;
+	}
+
+	r->header.length = sizeof(TFPStatisticsGetFunctionStatistics_Response);
+	r->slots_used     = tfp_statistics.slots_used;
+	r->overflow_count = tfp_statistics.overflow_count;
+
+	if(data->index < tfp_statistics.slots_used) {
+		const TFPStatisticsSlot *slot = &tfp_statistics.slot[data->index];
+		r->fid         = slot->fid;
+		r->call_count  = slot->call_count;
+		r->error_count = slot->error_count;
+		r->time_sum_us = slot->time_sum_us;
+		r->time_max_us = slot->time_max_us;
+	} else {
+		r->fid         = 0;
+		r->call_count  = 0;
+		r->error_count = 0;
+		r->time_sum_us = 0;
+		r->time_max_us = 0;
+	}
+
+	if(data->reset) {
+		memset(&tfp_statistics, 0, sizeof(TFPStatistics));
+	}
+
+	return true;
+}
+
+#endif
@@ -0,0 +1,97 @@
+/* bricklib2
+ * Copyright (C) 2026 Olaf Lüke <olaf@tinkerforge.com>
+ *
+ * tfp_statistics.h: Optional per-function call statistics for TFP handlers
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#ifndef TFP_STATISTICS_H
+#define TFP_STATISTICS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "configs/config.h"
+#include "bricklib2/protocols/tfp/tfp.h"
+#include "bricklib2/hal/system_timer/system_timer.h"
+
+// Define TFP_STATISTICS_ENABLED in config.h to record call count, error count
+// and handler execution time per function ID. If it is not defined, all of
+// the TFP_STATISTICS_* macros below expand to nothing.
+#ifdef TFP_STATISTICS_ENABLED
+
+// Number of distinct function IDs that are tracked. A slot is assigned
+// to a function ID the first time it is called. If all slots are in use,
+// calls of further function IDs are counted in the overflow counter only.
+#ifndef TFP_STATISTICS_SLOT_COUNT
+#define TFP_STATISTICS_SLOT_COUNT 16
+#endif
+
+// Reserved function ID that is used to read the statistics
+#ifndef TFP_STATISTICS_FID_GET_FUNCTION_STATISTICS
+#define TFP_STATISTICS_FID_GET_FUNCTION_STATISTICS 230
+#endif
+
+typedef struct {
+	uint8_t fid;
+	uint32_t call_count;
+	uint32_t error_count;
+	uint32_t time_sum_us;  // Wraps around, use difference between two reads
+	uint32_t time_max_us;
+} TFPStatisticsSlot;
+
+typedef struct {
+	TFPStatisticsSlot slot[TFP_STATISTICS_SLOT_COUNT];
+	uint8_t slots_used;
+	uint32_t overflow_count;
+} TFPStatistics;
+
+typedef struct {
+	TFPMessageHeader header;
+	uint8_t index;
+	bool reset;
+} __attribute__((__packed__)) TFPStatisticsGetFunctionStatistics;
+
+typedef struct {
+	TFPMessageHeader header;
+	uint8_t fid;
+	uint8_t slots_used;
+	uint32_t call_count;
+	uint32_t error_count;
+	uint32_t time_sum_us;
+	uint32_t time_max_us;
+	uint32_t overflow_count;
+} __attribute__((__packed__)) TFPStatisticsGetFunctionStatistics_Response;
+
+extern TFPStatistics tfp_statistics;
+
+void tfp_statistics_update(const uint8_t fid, const uint32_t start_us, const bool error);
+bool tfp_statistics_handle_message(const void *message, void *response);
+
+#define TFP_STATISTICS_START(start_us) const uint32_t start_us = system_timer_get_us32()
+#define TFP_STATISTICS_STOP(fid, start_us, error) tfp_statistics_update(fid, start_us, error)
+#define TFP_STATISTICS_HANDLE_MESSAGE(message, response) tfp_statistics_handle_message(message, response)
+
+#else
+
+#define TFP_STATISTICS_START(start_us)
+#define TFP_STATISTICS_STOP(fid, start_us, error)
+#define TFP_STATISTICS_HANDLE_MESSAGE(message, response) false
+
+#endif
+
+#endif
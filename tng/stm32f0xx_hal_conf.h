@@ -110,6 +110,9 @@
 // SPI peripheral configuration
 #define USE_SPI_CRC               0
 
+// Register callbacks per handle, used by the energy monitor for the PAC193X I2C
+#define USE_HAL_I2C_REGISTER_CALLBACKS 1U
+
 // Includes
 #ifdef HAL_RCC_MODULE_ENABLED
  #include "stm32f0xx_hal_rcc.h"
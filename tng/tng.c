@@ -25,23 +25,25 @@
 
 #include "bricklib2/hal/system_timer/system_timer.h"
 #include "bricklib2/logging/logging.h"
+#include "bricklib2/os/coop_task.h"
 #include "bricklib2/tng/usb_stm32/usb.h"
 #include "bricklib2/protocols/tfp/tfp.h"
+#include "bricklib2/protocols/tfp/tfp_statistics.h"
 
 #include "communication.h"
 #include "tng_communication.h"
 #include "tng_led.h"
+#ifdef TNG_ENERGY_MONITOR_ENABLED
+#include "tng_energy_monitor.h"
+#endif
 
 #include <string.h>
 
-#define TNG_BUFFER_SIZE 256
-
-static uint8_t tng_request_data[TNG_BUFFER_SIZE] = {0};
-static uint8_t tng_response_data[TNG_BUFFER_SIZE] = {0};
-static uint16_t tng_request_length = 0;
-
-static TFPMessageHeader *tng_request_header = (TFPMessageHeader*)tng_request_data;
-static TFPMessageHeader *tng_response_header = (TFPMessageHeader*)tng_response_data;
+// Upper bound for requests per tick, so that communication_tick and the
+// firmware tick functions are not starved if the host floods us with requests
+#ifndef TNG_MAX_REQUESTS_PER_TICK
+#define TNG_MAX_REQUESTS_PER_TICK 8
+#endif
 
 bool tng_is_valid_request(TFPMessageHeader *header) {
 	if((header->uid != 0) && (tng_get_uid() != header->uid)) {
@@ -51,61 +53,87 @@ bool tng_is_valid_request(TFPMessageHeader *header) {
 	return true;
 }
 
-void tng_try_usb_recv(void) {
-	if(tng_request_length < sizeof(TFPMessageHeader)) {
-		tng_request_length += usb_recv(tng_request_data + tng_request_length, TNG_BUFFER_SIZE - tng_request_length);
+// Handles the next request in the USB OUT buffer. The request is parsed in place
+// and the response is written directly to the USB IN buffer.
+// Returns true if a request was handled.
+static bool tng_handle_request(void) {
+	uint16_t length = 0;
+	uint8_t *request = usb_recv_peek(&length);
+	if(length < sizeof(TFPMessageHeader)) {
+		return false;
 	}
 
-	if((tng_request_length >= sizeof(TFPMessageHeader)) && (tng_request_length < tng_request_header->length)) {
-		tng_request_length += usb_recv(tng_request_data + tng_request_length, TNG_BUFFER_SIZE - tng_request_length);
+	TFPMessageHeader *request_header = (TFPMessageHeader*)request;
+	if((request_header->length < TFP_MESSAGE_MIN_LENGTH) || (request_header->length > TFP_MESSAGE_MAX_LENGTH)) {
+		// We are out of sync with the host, throw away everything that we have received
+		logw("Invalid request length: %d\n\r", request_header->length);
+		usb_recv_consume(length);
+		return false;
 	}
-}
 
-void tng_tick(void) {
-	if(usb_can_recv() || (tng_request_length >= tng_request_header->length)) {
-		bool interrupt_state = usb_interrupt_disable();
-		tng_try_usb_recv();
-		usb_interrupt_enable(interrupt_state);
-
-		if(tng_request_length >= tng_request_header->length) {
-			if(tng_response_header->length == 0) {
-				if(tng_is_valid_request(tng_request_header)) {
-					memcpy(tng_response_data, tng_request_data, sizeof(TFPMessageHeader));
-					tng_response_header->length = 0;
-					TNGHandleMessageResponse handle_message_return = tng_handle_message(tng_request_data, tng_response_data);
-					if(handle_message_return == HANDLE_MESSAGE_RESPONSE_NOT_SUPPORTED) {
-						handle_message_return = handle_message(tng_request_data, tng_response_data);
-					}
-
-					if(tng_response_header->return_expected) {
-						if(tng_response_header->length == 0) {
-							tng_response_header->length = 8;
-						}
-						switch(handle_message_return) {
-							case HANDLE_MESSAGE_RESPONSE_EMPTY:             tng_response_header->error = TFP_MESSAGE_ERROR_CODE_OK;                break;
-							case HANDLE_MESSAGE_RESPONSE_NOT_SUPPORTED:     tng_response_header->error = TFP_MESSAGE_ERROR_CODE_NOT_SUPPORTED;     break;
-							case HANDLE_MESSAGE_RESPONSE_INVALID_PARAMETER: tng_response_header->error = TFP_MESSAGE_ERROR_CODE_INVALID_PARAMETER; break;
-							case HANDLE_MESSAGE_RESPONSE_NONE:              break;
-							default: break;
-						}
-					}
-				}
-
-				bool interrupt_state = usb_interrupt_disable();
-				if(tng_request_length > tng_request_header->length) {
-					memmove(tng_request_data + tng_request_header->length, tng_request_data, TNG_BUFFER_SIZE - tng_request_header->length);
-					tng_request_length -= tng_request_header->length;
-				} else {
-					tng_request_length = 0;
-				}
-				usb_interrupt_enable(interrupt_state);
+	if(length < request_header->length) {
+		return false;
+	}
+
+	if(tng_is_valid_request(request_header)) {
+		uint8_t *response = usb_send_reserve(TFP_MESSAGE_MAX_LENGTH);
+		if(response == NULL) {
+			// No space for response, try again in next tick
+			return false;
+		}
+
+		TFPMessageHeader *response_header = (TFPMessageHeader*)response;
+		memcpy(response, request, sizeof(TFPMessageHeader));
+		response_header->length = 0;
+
+		TNGHandleMessageResponse handle_message_return = HANDLE_MESSAGE_RESPONSE_NEW_MESSAGE;
+		if(!TFP_STATISTICS_HANDLE_MESSAGE(request, response) &&
+		   !COOP_TASK_STATISTICS_HANDLE_MESSAGE(request, response)) {
+			TFP_STATISTICS_START(statistics_start_us);
+			handle_message_return = tng_handle_message(request, response);
+#ifdef TNG_ENERGY_MONITOR_ENABLED
+			if(handle_message_return == HANDLE_MESSAGE_RESPONSE_NOT_SUPPORTED) {
+				handle_message_return = tng_energy_monitor_handle_message(request, response);
 			}
+#endif
+			if(handle_message_return == HANDLE_MESSAGE_RESPONSE_NOT_SUPPORTED) {
+				handle_message_return = handle_message(request, response);
+			}
+			TFP_STATISTICS_STOP(request_header->fid, statistics_start_us, (handle_message_return == HANDLE_MESSAGE_RESPONSE_NOT_SUPPORTED) || (handle_message_return == HANDLE_MESSAGE_RESPONSE_INVALID_PARAMETER));
 		}
+
+		if(response_header->return_expected) {
+			if(response_header->length == 0) {
+				response_header->length = 8;
+			}
+			switch(handle_message_return) {
+				case HANDLE_MESSAGE_RESPONSE_EMPTY:             response_header->error = TFP_MESSAGE_ERROR_CODE_OK;                break;
+				case HANDLE_MESSAGE_RESPONSE_NOT_SUPPORTED:     response_header->error = TFP_MESSAGE_ERROR_CODE_NOT_SUPPORTED;     break;
+				case HANDLE_MESSAGE_RESPONSE_INVALID_PARAMETER: response_header->error = TFP_MESSAGE_ERROR_CODE_INVALID_PARAMETER; break;
+				case HANDLE_MESSAGE_RESPONSE_NONE:              break;
+				default: break;
+			}
+		}
+
+		usb_send_commit(response_header->length >= TFP_MESSAGE_MIN_LENGTH ? response_header->length : 0);
+	}
+
+	usb_recv_consume(request_header->length);
+	return true;
+}
+
+void tng_tick(void) {
+	// The host (re-)enumerated us, the buffers are empty now
+	if(usb_handle_reset()) {
+		tng_send_initial_enumerate();
 	}
 
-	if(tng_response_header->length >= 8) {
-		if(usb_send(tng_response_data, tng_response_header->length)) {
-			tng_response_header->length = 0;
+	// Handle all complete requests that are in the OUT buffer, as long as
+	// there is space for the responses. The responses are packed together
+	// into as few USB packets as possible.
+	for(uint8_t i = 0; i < TNG_MAX_REQUESTS_PER_TICK; i++) {
+		if(!tng_handle_request()) {
+			break;
 		}
 	}
 
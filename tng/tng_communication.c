@@ -34,6 +34,8 @@
 
 #include "bricklib2/tng/usb_stm32/usb.h"
 
+#include <string.h>
+
 extern const uint32_t device_identifier;
 
 static uint32_t tng_firmware_pointer = 0;
@@ -44,6 +46,8 @@ TNGHandleMessageResponse tng_handle_message(const void *message, void *response)
 		case TNG_FID_COPY_FIRMWARE: return tng_copy_firmware(message, response);
 		case TNG_FID_SET_WRITE_FIRMWARE_POINTER: return tng_set_write_firmware_pointer(message);
 		case TNG_FID_WRITE_FIRMWARE: return tng_write_firmware(message, response);
+		case TNG_FID_WRITE_FIRMWARE_STREAM: return tng_write_firmware_stream(message);
+		case TNG_FID_GET_WRITE_FIRMWARE_STREAM_STATUS: return tng_get_write_firmware_stream_status(message, response);
 		case TNG_FID_RESET: return tng_reset(message);
 		case TNG_FID_READ_UID: return tng_read_uid(message, response);
 		case TNG_FID_WRITE_UID: return tng_write_uid(message);
@@ -79,32 +83,32 @@ TNGHandleMessageResponse tng_set_write_firmware_pointer(const TNGSetWriteFirmwar
 
 TNGHandleMessageResponse tng_write_firmware(const TNGWriteFirmware *data, TNGWriteFirmware_Response *response) {
 	response->header.length = sizeof(TNGWriteFirmware_Response);
-	HAL_FLASH_Unlock();
-	if(tng_firmware_pointer == 0) {
-		FLASH_EraseInitTypeDef erase_init = {
-			.TypeErase = FLASH_TYPEERASE_PAGES,
-			.PageAddress = STM32F0_FIRMWARE_NEW_POS_START,
-			.NbPages = STM32F0_FIRMWARE_SIZE/FLASH_PAGE_SIZE
-		};
-		uint32_t page_error = 0;
-		if(HAL_FLASHEx_Erase(&erase_init, &page_error) != HAL_OK) {
-			HAL_FLASH_Lock();
-			response->status = TNG_WRITE_FIRMWARE_STATUS_INVALID_POINTER;
-			return HANDLE_MESSAGE_RESPONSE_NEW_MESSAGE;
-		}
-	}
+	response->status        = tng_firmware_write(tng_firmware_pointer, data->data, TNG_WRITE_FIRMWARE_CHUNK_SIZE);
 
-	for(uint8_t i = 0; i < TNG_WRITE_FIRMWARE_CHUNK_SIZE; i += 4) {
-		uint32_t *data32 = (uint32_t *)&data->data[i];
-		if(HAL_FLASH_Program(FLASH_TYPEPROGRAM_WORD, STM32F0_FIRMWARE_NEW_POS_START + tng_firmware_pointer + i, *data32) != HAL_OK) {
-			HAL_FLASH_Lock();
-			response->status = TNG_WRITE_FIRMWARE_STATUS_INVALID_POINTER;
-			return HANDLE_MESSAGE_RESPONSE_NEW_MESSAGE;
-		}
+	return HANDLE_MESSAGE_RESPONSE_NEW_MESSAGE;
+}
+
+TNGHandleMessageResponse tng_write_firmware_stream(const TNGWriteFirmwareStream *data) {
+	// The host sends the chunks without waiting for a response (return expected is not set),
+	// errors are reported through get_write_firmware_stream_status.
+	// A chunk after a failed write is ignored, so the status keeps the first error.
+	if((data->pointer != 0) && (tng_firmware_write_state.status != TNG_WRITE_FIRMWARE_STATUS_OK)) {
+		return HANDLE_MESSAGE_RESPONSE_EMPTY;
 	}
-	HAL_FLASH_Lock();
 
-	response->status = TNG_WRITE_FIRMWARE_STATUS_OK;
+	tng_firmware_pointer = data->pointer;
+	tng_firmware_write(data->pointer, data->data, TNG_WRITE_FIRMWARE_CHUNK_SIZE);
+
+	return HANDLE_MESSAGE_RESPONSE_EMPTY;
+}
+
+TNGHandleMessageResponse tng_get_write_firmware_stream_status(const TNGGetWriteFirmwareStreamStatus *data, TNGGetWriteFirmwareStreamStatus_Response *response) {
+	response->header.length = sizeof(TNGGetWriteFirmwareStreamStatus_Response);
+	response->status        = tng_firmware_write_state.status;
+	response->pointer       = tng_firmware_pointer;
+	response->crc           = tng_firmware_write_state.crc;
+	response->crc_valid     = tng_firmware_write_state.crc_valid;
+
 	return HANDLE_MESSAGE_RESPONSE_NEW_MESSAGE;
 }
 
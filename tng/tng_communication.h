@@ -44,6 +44,8 @@ TNGHandleMessageResponse tng_handle_message(const void *data, void *response);
 #define TNG_WRITE_FIRMWARE_STATUS_INVALID_POINTER 1
 
 // Function and callback IDs and structs
+#define TNG_FID_WRITE_FIRMWARE_STREAM 232
+#define TNG_FID_GET_WRITE_FIRMWARE_STREAM_STATUS 233
 #define TNG_FID_GET_TIMESTAMP 234
 #define TNG_FID_COPY_FIRMWARE 235
 #define TNG_FID_SET_WRITE_FIRMWARE_POINTER 237
@@ -88,6 +90,24 @@ typedef struct {
 	uint8_t status;
 } __attribute__((__packed__)) TNGWriteFirmware_Response;
 
+typedef struct {
+	TFPMessageHeader header;
+	uint32_t pointer;
+	uint8_t data[TNG_WRITE_FIRMWARE_CHUNK_SIZE];
+} __attribute__((__packed__)) TNGWriteFirmwareStream;
+
+typedef struct {
+	TFPMessageHeader header;
+} __attribute__((__packed__)) TNGGetWriteFirmwareStreamStatus;
+
+typedef struct {
+	TFPMessageHeader header;
+	uint8_t status;
+	uint32_t pointer;
+	uint32_t crc;
+	bool crc_valid;
+} __attribute__((__packed__)) TNGGetWriteFirmwareStreamStatus_Response;
+
 typedef struct {
 	TFPMessageHeader header;
 } __attribute__((__packed__)) TNGReset;
@@ -141,6 +161,8 @@ TNGHandleMessageResponse tng_get_timestamp(const TNGGetTimestamp *data, TNGGetTi
 TNGHandleMessageResponse tng_copy_firmware(const TNGCopyFirmware *data, TNGCopyFirmware_Response *response);
 TNGHandleMessageResponse tng_set_write_firmware_pointer(const TNGSetWriteFirmwarePointer *data);
 TNGHandleMessageResponse tng_write_firmware(const TNGWriteFirmware *data, TNGWriteFirmware_Response *response);
+TNGHandleMessageResponse tng_write_firmware_stream(const TNGWriteFirmwareStream *data);
+TNGHandleMessageResponse tng_get_write_firmware_stream_status(const TNGGetWriteFirmwareStreamStatus *data, TNGGetWriteFirmwareStreamStatus_Response *response);
 TNGHandleMessageResponse tng_reset(const TNGReset *data);
 TNGHandleMessageResponse tng_read_uid(const TNGWriteUID *data, TNGReadUID_Response *response);
 TNGHandleMessageResponse tng_write_uid(const TNGWriteUID *data);
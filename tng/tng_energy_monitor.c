@@ -26,25 +26,42 @@
 #include "bricklib2/hal/system_timer/system_timer.h"
 #include "bricklib2/utility/util_definitions.h"
 
+#ifdef PAC193X_DEBUG_PRINT
+#include "bricklib2/hal/uartbb/uartbb.h"
+#endif
+
+#include <string.h>
+
+// The PAC193X needs 1ms after a REFRESH/REFRESH_V until the registers are updated
+#define PAC193X_REFRESH_WAIT_US 1000
+
+// Time between an I2C error and the reconfiguration of the PAC193X
+#define PAC193X_ERROR_WAIT_US 10000
+
 TNGEnergyMonitor tng_energy_monitor;
 
-#if 0
-void HAL_I2C_MasterTxCpltCallback(I2C_HandleTypeDef *I2cHandle) {
-	logd("HAL_I2C_MasterTxCpltCallback\n\r");
-}
+// Make data that is read/written static, it needs to be available after we leave the function for the DMA.
+static uint8_t pac193x_tx_data;
+static PAC193XReadRegister pac193x_read_register_tmp;
+static PAC193XRawRegister pac193x_raw_register_tmp;
 
-void HAL_I2C_SlaveTxCpltCallback(I2C_HandleTypeDef *I2cHandle) {
-	logd("HAL_I2C_SlaveTxCpltCallback\n\r");
-}
+static void pac193x_transfer_done(void);
+
+// The I2C callbacks are registered for the PAC193X handle only (see pac193x_init_i2c).
+// The global weak HAL_I2C_*Callback functions stay free for other I2C handles of the firmware.
+#if (USE_HAL_I2C_REGISTER_CALLBACKS != 1U)
+#error "The energy monitor needs USE_HAL_I2C_REGISTER_CALLBACKS 1U in stm32f0xx_hal_conf.h"
+#endif
 
-void HAL_I2C_MasterRxCpltCallback(I2C_HandleTypeDef *I2cHandle) {
-	logd("HAL_I2C_MasterRxCpltCallback\n\r");
+static void pac193x_i2c_transfer_done_callback(I2C_HandleTypeDef *hi2c) {
+	pac193x_transfer_done();
 }
 
-void HAL_I2C_SlaveRxCpltCallback(I2C_HandleTypeDef *I2cHandle) {
-	logd("HAL_I2C_SlaveRxCpltCallback\n\r");
+static void pac193x_i2c_error_callback(I2C_HandleTypeDef *hi2c) {
+	tng_energy_monitor.error_count++;
+	tng_energy_monitor.wait_start_time = system_timer_get_us32();
+	tng_energy_monitor.pac193x_state = PAC193X_STATE_ERROR;
 }
-#endif
 
 void I2C2_IRQHandler(void) {
 	HAL_I2C_EV_IRQHandler(&tng_energy_monitor.pac193x_i2c);
@@ -56,36 +73,149 @@ void DMA1_Channel4_5_IRQHandler(void) {
 	HAL_DMA_IRQHandler(tng_energy_monitor.pac193x_i2c.hdmatx);
 }
 
-// Blocking write register
-static void pac193x_write_register(uint8_t reg, uint8_t length, uint8_t *data) {
-	if(length > 128) {
-		return;
+static uint8_t pac193x_sample_rate_to_ctrl(const uint16_t sample_rate) {
+	switch(sample_rate) {
+		case 1024: return PAC193X_CTRL_SAMPLE_RATE_1024;
+		case 256:  return PAC193X_CTRL_SAMPLE_RATE_256;
+		case 64:   return PAC193X_CTRL_SAMPLE_RATE_64;
+		case 8:    return PAC193X_CTRL_SAMPLE_RATE_8;
+		default:   return 0xFF;
 	}
+}
 
-	uint8_t buffer[129] = {0};
-	buffer[0] = reg;
-	memcpy(&buffer[1], data, length);
-
-	HAL_StatusTypeDef status = HAL_I2C_Master_Transmit_DMA(&tng_energy_monitor.pac193x_i2c, PAC193X_ADDRESS, buffer, length+1);
+// Send REFRESH or REFRESH_V command
+static bool pac193x_start_refresh(const uint8_t command) {
+	pac193x_tx_data = command;
+	HAL_StatusTypeDef status = HAL_I2C_Master_Transmit_DMA(&tng_energy_monitor.pac193x_i2c, PAC193X_ADDRESS, &pac193x_tx_data, 1);
 	if(status != HAL_OK) {
-		loge("Error during pac193x_write_register transmit: %d\n\r", status);
+		loge("Error during PAC193X refresh %x transmit: %d\n\r", command, status);
+		return false;
 	}
-	while(HAL_I2C_GetState(&tng_energy_monitor.pac193x_i2c) != HAL_I2C_STATE_READY);
+
+	return true;
 }
 
-// Blocking read register
-static void pac193x_read_register(uint8_t reg, uint8_t length, uint8_t *data) {
-	HAL_StatusTypeDef status = HAL_I2C_Master_Transmit_DMA(&tng_energy_monitor.pac193x_i2c, PAC193X_ADDRESS, &reg, 1);
+static bool pac193x_start_write_register(const uint8_t reg, const uint8_t value) {
+	pac193x_tx_data = value;
+	HAL_StatusTypeDef status = HAL_I2C_Mem_Write_DMA(&tng_energy_monitor.pac193x_i2c, PAC193X_ADDRESS, reg, I2C_MEMADD_SIZE_8BIT, &pac193x_tx_data, 1);
 	if(status != HAL_OK) {
-		loge("Error during pac193x_read_register transmit: %d\n\r", status);
+		loge("Error during PAC193X write register %x: %d\n\r", reg, status);
+		return false;
 	}
-	while(HAL_I2C_GetState(&tng_energy_monitor.pac193x_i2c) != HAL_I2C_STATE_READY);
 
-	status = HAL_I2C_Master_Receive_DMA(&tng_energy_monitor.pac193x_i2c, PAC193X_ADDRESS, data, length);
+	return true;
+}
+
+static bool pac193x_start_read_register(const uint8_t reg, uint8_t *data, const uint16_t length) {
+	HAL_StatusTypeDef status = HAL_I2C_Mem_Read_DMA(&tng_energy_monitor.pac193x_i2c, PAC193X_ADDRESS, reg, I2C_MEMADD_SIZE_8BIT, data, length);
 	if(status != HAL_OK) {
-		loge("Error during pac193x_read_register receive: %d\n\r", status);
+		loge("Error during PAC193X read register %x: %d\n\r", reg, status);
+		return false;
+	}
+
+	return true;
+}
+
+static void pac193x_raw_sample_push(const uint32_t timestamp, const PAC193XRawRegister *reg) {
+	const uint8_t end = (tng_energy_monitor.raw_samples_end + 1) % PAC193X_RAW_SAMPLE_COUNT;
+	if(end == tng_energy_monitor.raw_samples_start) {
+		// Host does not read fast enough, drop newest sample
+		tng_energy_monitor.raw_samples_overflow++;
+		return;
+	}
+
+	PAC193XRawSample *sample = &tng_energy_monitor.raw_samples[tng_energy_monitor.raw_samples_end];
+	sample->timestamp = timestamp;
+	memcpy(&sample->reg, reg, sizeof(PAC193XRawRegister));
+	tng_energy_monitor.raw_samples_end = end;
+}
+
+// Converts the VBUSn/VSENSEn values latched at timestamp and
+// adds them to the sample ring of each channel.
+static void pac193x_sample_push(const uint32_t timestamp, const PAC193XRawRegister *reg) {
+	for(uint8_t i = 0; i < PAC193X_CHANNEL_NUM; i++) {
+		const uint8_t end = (tng_energy_monitor.samples_end[i] + 1) % PAC193X_SAMPLE_COUNT;
+		if(end == tng_energy_monitor.samples_start[i]) {
+			tng_energy_monitor.samples_overflow[i]++;
+			continue;
+		}
+
+		TNGEnergyMonitorSample *sample = &tng_energy_monitor.samples[i][tng_energy_monitor.samples_end[i]];
+		const uint8_t *x = reg->vbus[i];
+		const uint32_t voltage = ((uint32_t)((x[0] << 8) | (x[1] << 0)))*125/256;
+		x = reg->vsense[i];
+		const uint32_t current = ABS(INTN_TO_INT32((x[0] << 8) | (x[1] << 0), 16)*625/4096);
+
+		sample->timestamp = timestamp;
+		sample->voltage   = voltage;
+		sample->current   = current;
+		sample->power     = voltage*current/1000;
+		tng_energy_monitor.samples_end[i] = end;
+	}
+}
+
+// Called from I2C/DMA interrupt if a transfer is complete.
+// Advances the state machine and directly chains the next transfer where no wait is necessary.
+static void pac193x_transfer_done(void) {
+	switch(tng_energy_monitor.pac193x_state) {
+		case PAC193X_STATE_CONFIG_NEG_PWR_WAIT: {
+			tng_energy_monitor.pac193x_state = PAC193X_STATE_CONFIG_CTRL;
+			break;
+		}
+
+		case PAC193X_STATE_CONFIG_CTRL_WAIT: {
+			tng_energy_monitor.pac193x_state = PAC193X_STATE_REFRESH;
+			break;
+		}
+
+		case PAC193X_STATE_REFRESH_WAIT: {
+			// The REFRESH resets the accumulators. The values we read next
+			// are accumulated with the sample rate that was active until now,
+			// a new CTRL configuration is only used from here on.
+			tng_energy_monitor.refresh_time       = system_timer_get_us32();
+			tng_energy_monitor.sample_rate_period = tng_energy_monitor.sample_rate_chip;
+			tng_energy_monitor.sample_rate_chip   = tng_energy_monitor.sample_rate_ctrl;
+			tng_energy_monitor.raw_pending        = false;
+			tng_energy_monitor.pac193x_state      = PAC193X_STATE_READ;
+			break;
+		}
+
+		case PAC193X_STATE_READ_WAIT: {
+			tng_energy_monitor.pac193x_state = PAC193X_STATE_READ_DONE;
+			break;
+		}
+
+		case PAC193X_STATE_RAW_READ_WAIT: {
+			pac193x_raw_sample_push(tng_energy_monitor.raw_refresh_time, &pac193x_raw_register_tmp);
+			pac193x_sample_push(tng_energy_monitor.raw_refresh_time, &pac193x_raw_register_tmp);
+			tng_energy_monitor.raw_pending = false;
+
+			// Latch the next sample. If the refresh period is over we use a
+			// REFRESH instead of a REFRESH_V, this also gives us the next sample.
+			const uint32_t now = system_timer_get_us32();
+			if((uint32_t)(now - tng_energy_monitor.refresh_time) >= PAC193X_REFRESH_PERIOD_MS*1000) {
+				tng_energy_monitor.pac193x_state = PAC193X_STATE_REFRESH_WAIT;
+				if(!pac193x_start_refresh(PAC193X_REG_REFRESH)) {
+					tng_energy_monitor.pac193x_state = PAC193X_STATE_REFRESH;
+				}
+			} else {
+				tng_energy_monitor.pac193x_state = PAC193X_STATE_RAW_REFRESH_WAIT;
+				if(!pac193x_start_refresh(PAC193X_REG_REFRESH_V)) {
+					tng_energy_monitor.pac193x_state = PAC193X_STATE_SLEEP;
+				}
+			}
+			break;
+		}
+
+		case PAC193X_STATE_RAW_REFRESH_WAIT: {
+			tng_energy_monitor.raw_refresh_time = system_timer_get_us32();
+			tng_energy_monitor.raw_pending      = true;
+			tng_energy_monitor.pac193x_state    = PAC193X_STATE_SLEEP;
+			break;
+		}
+
+		default: break;
 	}
-	while(HAL_I2C_GetState(&tng_energy_monitor.pac193x_i2c) != HAL_I2C_STATE_READY);	
 }
 
 static void pac193x_init_i2c(void) {
@@ -160,25 +290,15 @@ static void pac193x_init_i2c(void) {
 		loge("HAL_I2C_Init Error %d\n\r", status);
 	}
 
-	HAL_I2CEx_ConfigAnalogFilter(&tng_energy_monitor.pac193x_i2c, I2C_ANALOGFILTER_ENABLE);
-}
-
-static void pac193x_init(void) {
-	pac193x_init_i2c();
+	HAL_I2C_RegisterCallback(&tng_energy_monitor.pac193x_i2c, HAL_I2C_MASTER_TX_COMPLETE_CB_ID, pac193x_i2c_transfer_done_callback);
+	HAL_I2C_RegisterCallback(&tng_energy_monitor.pac193x_i2c, HAL_I2C_MEM_TX_COMPLETE_CB_ID,    pac193x_i2c_transfer_done_callback);
+	HAL_I2C_RegisterCallback(&tng_energy_monitor.pac193x_i2c, HAL_I2C_MEM_RX_COMPLETE_CB_ID,    pac193x_i2c_transfer_done_callback);
+	HAL_I2C_RegisterCallback(&tng_energy_monitor.pac193x_i2c, HAL_I2C_ERROR_CB_ID,              pac193x_i2c_error_callback);
 
-#if LOGGING_LEVEL == LOGGING_DEBUG
-	uint8_t ids[3] = {0, 0, 0};
-	pac193x_read_register(0xFD, 3, ids);
-	logd("PAC193X: Product ID %x, Manufacturer ID %x, Revision ID %x\n\r", ids[0], ids[1], ids[2]);
-#endif
-
-	// Enable negative current measurements.
-	// We always use the absolute value.
-	// Because of routing-optimizations on PCB may get negative values.
-	uint8_t neg_pwr = 0b11110000;
-	pac193x_write_register(0x1D, 1, &neg_pwr);
+	HAL_I2CEx_ConfigAnalogFilter(&tng_energy_monitor.pac193x_i2c, I2C_ANALOGFILTER_ENABLE);
 }
 
+#ifdef PAC193X_DEBUG_PRINT
 static void pac193x_debug_print_reg_line(char *reg, char *name, uint8_t *data, uint8_t length) {
 	uartbb_puts("* ");
 	uartbb_puts(reg);
@@ -200,7 +320,15 @@ static void pac193x_debug_print_reg_line(char *reg, char *name, uint8_t *data, u
 	uartbb_puts("\n\r");
 }
 
+// Blocking bit-banged output, only for debugging.
+// Prints at most once per PAC193X_DEBUG_PRINT milliseconds.
 static void pac193x_debug_print(void) {
+	static uint32_t last_print_time = 0;
+	if(!system_timer_is_time_elapsed_ms(last_print_time, PAC193X_DEBUG_PRINT)) {
+		return;
+	}
+	last_print_time = system_timer_get_ms();
+
 	uartbb_printf("Register 0x01 - 0x1A:\n\r");
 	pac193x_debug_print_reg_line("0x01", "CTRL:        ", &tng_energy_monitor.pac193x_read_register.ctrl,          1);
 	pac193x_debug_print_reg_line("0x02", "ACC_COUNT:   ",  tng_energy_monitor.pac193x_read_register.acc_count,     3);
@@ -230,13 +358,28 @@ static void pac193x_debug_print(void) {
 	}
 	uartbb_puts("\n\r");
 }
+#endif
 
-static void pac193x_update_values(PAC193XReadRegister *read_reg_tmp) {
-	memcpy(&tng_energy_monitor.pac193x_read_register, read_reg_tmp, sizeof(PAC193XReadRegister));
+// Adds numerator/denominator milliwatt-seconds to the energy of the channel.
+// The remainder of the division is kept, so no energy is lost to rounding.
+static void pac193x_integrate_energy(const uint8_t channel, const uint64_t numerator, const uint64_t denominator) {
+	const uint64_t sum = tng_energy_monitor.energy_remainder[channel] + numerator;
+	tng_energy_monitor.energy[channel]          += sum / denominator;
+	tng_energy_monitor.energy_remainder[channel] = sum % denominator;
+}
 
-	for(uint8_t i = 0; i < PAC193X_CHANNEL_NUM; i++) {
-		uint8_t *x;
+static void pac193x_update_values(void) {
+	memcpy(&tng_energy_monitor.pac193x_read_register, &pac193x_read_register_tmp, sizeof(PAC193XReadRegister));
 
+	uint8_t *x = tng_energy_monitor.pac193x_read_register.acc_count;
+	const uint32_t count = (uint32_t)((x[0] << 16) | (x[1] << 8) | (x[2] << 0));
+
+#ifdef PAC193X_ENERGY_INTEGRATION_MEASURED_TIME
+	const uint32_t dt_us = tng_energy_monitor.refresh_time - tng_energy_monitor.refresh_time_last;
+#endif
+	tng_energy_monitor.refresh_time_last = tng_energy_monitor.refresh_time;
+
+	for(uint8_t i = 0; i < PAC193X_CHANNEL_NUM; i++) {
 		// 32000/65536 = 125/256
 		x = tng_energy_monitor.pac193x_read_register.vbus_avg[i];
 		tng_energy_monitor.voltage[i] = ((uint32_t)((x[0] << 8) | (x[1] << 0)))*125/256;
@@ -245,116 +388,261 @@ static void pac193x_update_values(PAC193XReadRegister *read_reg_tmp) {
 		x = tng_energy_monitor.pac193x_read_register.vsense_avg[i];
 		tng_energy_monitor.current[i] = ABS(INTN_TO_INT32((x[0] << 8) | (x[1] << 0), 16)*625/4096);
 
+		if(count == 0) {
+			continue;
+		}
+
 		// 160*1000/(134217728*count) = 625/(524288*count)
-		x = tng_energy_monitor.pac193x_read_register.acc_count;
-		const uint32_t count = (uint32_t)((x[0] << 16) | (x[1] << 8) | (x[2] << 0));
 		x = tng_energy_monitor.pac193x_read_register.vpower_acc[i];
 		const uint64_t x64[6] = {x[0], x[1], x[2], x[3], x[4], x[5]};
-		tng_energy_monitor.power[i] = ABS(INTN_TO_INT64((x64[0] << 40) | (x64[1] << 32) | (x64[2] << 24) | (x64[3] << 16) | (x64[4] << 8) | (x64[5] << 0), 48))*625/(524288*count);
-		tng_energy_monitor.energy[i] += tng_energy_monitor.power[i]/5; // (milliwatt-seconds)
+		const uint64_t acc = ABS(INTN_TO_INT64((x64[0] << 40) | (x64[1] << 32) | (x64[2] << 24) | (x64[3] << 16) | (x64[4] << 8) | (x64[5] << 0), 48));
+		tng_energy_monitor.power[i] = acc*625/(524288*count);
+
+		// The accumulators contain everything since the power-on/reconfiguration of the chip, not only the last period
+		if(tng_energy_monitor.first_read) {
+			continue;
+		}
+
+#ifdef PAC193X_ENERGY_INTEGRATION_MEASURED_TIME
+		// Average power of the period times the measured time between the two REFRESH commands
+		// energy = acc*625/(524288*count) * dt_us/1000000
+		pac193x_integrate_energy(i, acc*625/count * dt_us, 524288ULL*1000000ULL);
+#else
+		// Every accumulated sample stands for 1/sample_rate seconds, so the
+		// energy is independent of the time between two REFRESH commands
+		// energy = acc*625/524288 * 1/sample_rate
+		pac193x_integrate_energy(i, acc*625, 524288ULL*tng_energy_monitor.sample_rate_period);
+#endif
 	}
 
+	tng_energy_monitor.first_read = false;
+
+	// vbus and vsense are consecutive in the read register, same layout as the raw register
+	const PAC193XRawRegister *reg = (PAC193XRawRegister*)tng_energy_monitor.pac193x_read_register.vbus;
+	pac193x_sample_push(tng_energy_monitor.refresh_time, reg);
+	if(tng_energy_monitor.block_read) {
+		pac193x_raw_sample_push(tng_energy_monitor.refresh_time, reg);
+	}
 
+#ifdef PAC193X_DEBUG_PRINT
 	pac193x_debug_print();
+#endif
+}
+
+// Time between two samples in block-read mode
+static uint32_t pac193x_get_raw_period_us(void) {
+	return MAX(1000000/tng_energy_monitor.sample_rate_chip, PAC193X_REFRESH_WAIT_US);
 }
 
 static void pac193x_tick(void) {
-	// Make data that is read/written static, it needs to be available after we leave the function for the DMA.
-	static uint8_t data[2] = {0, 0};
-	static PAC193XReadRegister read_reg_tmp;
-	static uint32_t wait_start_time = 0;
+	const uint32_t now = system_timer_get_us32();
 
-	// Non-blocking refresh/read state-machine
-	// Do not use blocking pac193x_read/write_register in tick!
+	// Non-blocking configure/refresh/read state-machine.
+	// The transitions from the *_WAIT states are done in the I2C/DMA interrupt,
+	// the tick only starts transfers that have to wait for the PAC193X.
 	switch(tng_energy_monitor.pac193x_state) {
-		case PAC193X_STATE_REFRESH: {
-			data[0] = PAC193X_REG_REFRESH;
-			data[1] = 0;
-			HAL_StatusTypeDef status = HAL_I2C_Master_Transmit_DMA(&tng_energy_monitor.pac193x_i2c, PAC193X_ADDRESS, data, 2);
-			if(status != HAL_OK) {
-				loge("Error during PAC193X_STATE_REFRESH transmit: %d\n\r", status);
-			} else {
-				tng_energy_monitor.pac193x_state = PAC193X_STATE_REFRESH_WAIT;
+		case PAC193X_STATE_CONFIG_NEG_PWR: {
+			// Enable negative current measurements.
+			// We always use the absolute value.
+			// Because of routing-optimizations on PCB may get negative values.
+			tng_energy_monitor.pac193x_state = PAC193X_STATE_CONFIG_NEG_PWR_WAIT;
+			if(!pac193x_start_write_register(PAC193X_REG_NEG_PWR, 0b11110000)) {
+				tng_energy_monitor.pac193x_state = PAC193X_STATE_CONFIG_NEG_PWR;
 			}
 			break;
 		}
 
-		case PAC193X_STATE_REFRESH_WAIT: {
-			HAL_I2C_StateTypeDef state = HAL_I2C_GetState(&tng_energy_monitor.pac193x_i2c);
-			if(state == HAL_I2C_STATE_READY) {
-				tng_energy_monitor.pac193x_state = PAC193X_STATE_READ_TX;
-				wait_start_time = system_timer_get_ms();
+		case PAC193X_STATE_CONFIG_CTRL: {
+			// Takes effect with the next REFRESH
+			tng_energy_monitor.config_pending   = false;
+			tng_energy_monitor.sample_rate_ctrl = tng_energy_monitor.sample_rate;
+			tng_energy_monitor.pac193x_state    = PAC193X_STATE_CONFIG_CTRL_WAIT;
+			if(!pac193x_start_write_register(PAC193X_REG_CTRL, pac193x_sample_rate_to_ctrl(tng_energy_monitor.sample_rate_ctrl))) {
+				tng_energy_monitor.pac193x_state = PAC193X_STATE_CONFIG_CTRL;
 			}
 			break;
 		}
 
-		case PAC193X_STATE_READ_TX: {
-			if((wait_start_time == 0) || system_timer_is_time_elapsed_ms(wait_start_time, 2)) {
-				wait_start_time = 0;
-				data[0] = PAC193X_REG_CTRL; // Start reading from CTRL reg
-				HAL_StatusTypeDef status = HAL_I2C_Master_Transmit_DMA(&tng_energy_monitor.pac193x_i2c, PAC193X_ADDRESS, data, 1);
-				if(status != HAL_OK) {
-					loge("Error during PAC193X_STATE_READ_TX transmit: %d\n\r", status);
-				} else {
-					tng_energy_monitor.pac193x_state = PAC193X_STATE_READ_TX_WAIT;
-				}
+		case PAC193X_STATE_REFRESH: {
+			tng_energy_monitor.pac193x_state = PAC193X_STATE_REFRESH_WAIT;
+			if(!pac193x_start_refresh(PAC193X_REG_REFRESH)) {
+				tng_energy_monitor.pac193x_state = PAC193X_STATE_REFRESH;
 			}
 			break;
 		}
 
-		case PAC193X_STATE_READ_TX_WAIT: {
-			HAL_I2C_StateTypeDef state = HAL_I2C_GetState(&tng_energy_monitor.pac193x_i2c);
-			if(state == HAL_I2C_STATE_READY) {
-				tng_energy_monitor.pac193x_state = PAC193X_STATE_READ_RX;
+		case PAC193X_STATE_READ: {
+			if((uint32_t)(now - tng_energy_monitor.refresh_time) >= PAC193X_REFRESH_WAIT_US) {
+				// Read everything from CTRL to VPOWERn with one block read
+				tng_energy_monitor.pac193x_state = PAC193X_STATE_READ_WAIT;
+				if(!pac193x_start_read_register(PAC193X_REG_CTRL, (uint8_t *)&pac193x_read_register_tmp, sizeof(PAC193XReadRegister))) {
+					tng_energy_monitor.pac193x_state = PAC193X_STATE_READ;
+				}
 			}
 			break;
 		}
 
-		case PAC193X_STATE_READ_RX: {
-			memset(&read_reg_tmp, 0, sizeof(PAC193XReadRegister));
-			HAL_StatusTypeDef status = HAL_I2C_Master_Receive_DMA(&tng_energy_monitor.pac193x_i2c, PAC193X_ADDRESS, (uint8_t *)&read_reg_tmp, sizeof(PAC193XReadRegister));
-			if(status != HAL_OK) {
-				loge("Error during PAC193X_STATE_READ_RX receive: %d\n\r", status);
-			} else {
-				tng_energy_monitor.pac193x_state = PAC193X_STATE_READ_RX_WAIT;
-			}
+		case PAC193X_STATE_READ_DONE: {
+			pac193x_update_values();
+			tng_energy_monitor.pac193x_state = PAC193X_STATE_SLEEP;
 			break;
 		}
 
-		case PAC193X_STATE_READ_RX_WAIT: {
-			HAL_I2C_StateTypeDef state = HAL_I2C_GetState(&tng_energy_monitor.pac193x_i2c);
-			if(state == HAL_I2C_STATE_READY) {
-				pac193x_update_values(&read_reg_tmp);
-				tng_energy_monitor.pac193x_state = PAC193X_STATE_SLEEP;
-				wait_start_time = system_timer_get_ms();
+		case PAC193X_STATE_SLEEP: {
+			if(tng_energy_monitor.config_pending) {
+				// Values latched by a REFRESH_V are lost here, the REFRESH after the configuration latches new ones
+				tng_energy_monitor.pac193x_state = PAC193X_STATE_CONFIG_CTRL;
+				break;
+			}
+
+			if(tng_energy_monitor.block_read) {
+				// In block-read mode we read VBUSn/VSENSEn once per sample period.
+				// The read is always one period after the REFRESH_V that latched the values,
+				// so the next REFRESH_V can be sent directly after the read.
+				if(tng_energy_monitor.raw_pending) {
+					if((uint32_t)(now - tng_energy_monitor.raw_refresh_time) >= pac193x_get_raw_period_us()) {
+						tng_energy_monitor.pac193x_state = PAC193X_STATE_RAW_READ_WAIT;
+						if(!pac193x_start_read_register(PAC193X_REG_VBUS1, (uint8_t *)&pac193x_raw_register_tmp, sizeof(PAC193XRawRegister))) {
+							tng_energy_monitor.pac193x_state = PAC193X_STATE_SLEEP;
+						}
+					}
+				} else if((uint32_t)(now - tng_energy_monitor.refresh_time) >= PAC193X_REFRESH_PERIOD_MS*1000) {
+					tng_energy_monitor.pac193x_state = PAC193X_STATE_REFRESH;
+				} else if((uint32_t)(now - tng_energy_monitor.refresh_time) >= pac193x_get_raw_period_us()) {
+					tng_energy_monitor.pac193x_state = PAC193X_STATE_RAW_REFRESH_WAIT;
+					if(!pac193x_start_refresh(PAC193X_REG_REFRESH_V)) {
+						tng_energy_monitor.pac193x_state = PAC193X_STATE_SLEEP;
+					}
+				}
+			} else if((uint32_t)(now - tng_energy_monitor.refresh_time) >= PAC193X_REFRESH_PERIOD_MS*1000) {
+				tng_energy_monitor.pac193x_state = PAC193X_STATE_REFRESH;
 			}
 			break;
 		}
 
-		case PAC193X_STATE_SLEEP: {
-			// We configure to 64 samples/s, 
-			// which would be 15.625ms sleep time between measurements, we round that up to 16.
-			if((wait_start_time == 0) || system_timer_is_time_elapsed_ms(wait_start_time, 200))  { 
-				wait_start_time = 0;
-				tng_energy_monitor.pac193x_state = PAC193X_STATE_REFRESH;
+		case PAC193X_STATE_ERROR: {
+			if((uint32_t)(now - tng_energy_monitor.wait_start_time) >= PAC193X_ERROR_WAIT_US) {
+				// The PAC193X may have been reset, configure it again
+				// and don't use the accumulators of the first read
+				HAL_I2C_DeInit(&tng_energy_monitor.pac193x_i2c);
+				HAL_I2C_Init(&tng_energy_monitor.pac193x_i2c);
+				tng_energy_monitor.first_read    = true;
+				tng_energy_monitor.raw_pending   = false;
+				tng_energy_monitor.pac193x_state = PAC193X_STATE_CONFIG_NEG_PWR;
 			}
 			break;
 		}
 
+		case PAC193X_STATE_CONFIG_NEG_PWR_WAIT:
+		case PAC193X_STATE_CONFIG_CTRL_WAIT:
+		case PAC193X_STATE_REFRESH_WAIT:
+		case PAC193X_STATE_READ_WAIT:
+		case PAC193X_STATE_RAW_READ_WAIT:
+		case PAC193X_STATE_RAW_REFRESH_WAIT: {
+			// Wait for I2C/DMA interrupt
+			break;
+		}
+
 		default: {
-			tng_energy_monitor.pac193x_state = PAC193X_STATE_REFRESH;
 			loge("Unknown state: %d\n\r", tng_energy_monitor.pac193x_state);
+			tng_energy_monitor.pac193x_state = PAC193X_STATE_CONFIG_NEG_PWR;
 			break;
 		}
 	}
 }
 
+bool tng_energy_monitor_set_sample_rate(const uint16_t sample_rate) {
+	if(pac193x_sample_rate_to_ctrl(sample_rate) == 0xFF) {
+		return false;
+	}
+
+	tng_energy_monitor.sample_rate    = sample_rate;
+	tng_energy_monitor.config_pending = true;
+
+	return true;
+}
+
+void tng_energy_monitor_set_block_read(const bool block_read) {
+	tng_energy_monitor.block_read = block_read;
+}
+
+uint8_t tng_energy_monitor_read_raw_samples(PAC193XRawSample *samples, const uint8_t max_length) {
+	uint8_t length = 0;
+	while((length < max_length) && (tng_energy_monitor.raw_samples_start != tng_energy_monitor.raw_samples_end)) {
+		memcpy(&samples[length], &tng_energy_monitor.raw_samples[tng_energy_monitor.raw_samples_start], sizeof(PAC193XRawSample));
+		tng_energy_monitor.raw_samples_start = (tng_energy_monitor.raw_samples_start + 1) % PAC193X_RAW_SAMPLE_COUNT;
+		length++;
+	}
+
+	return length;
+}
+
+uint8_t tng_energy_monitor_read_samples(const uint8_t channel, TNGEnergyMonitorSample *samples, const uint8_t max_length) {
+	if(channel >= PAC193X_CHANNEL_NUM) {
+		return 0;
+	}
+
+	uint8_t length = 0;
+	while((length < max_length) && (tng_energy_monitor.samples_start[channel] != tng_energy_monitor.samples_end[channel])) {
+		memcpy(&samples[length], &tng_energy_monitor.samples[channel][tng_energy_monitor.samples_start[channel]], sizeof(TNGEnergyMonitorSample));
+		tng_energy_monitor.samples_start[channel] = (tng_energy_monitor.samples_start[channel] + 1) % PAC193X_SAMPLE_COUNT;
+		length++;
+	}
+
+	return length;
+}
+
+TNGHandleMessageResponse tng_energy_monitor_set_block_read_mode(const TNGEnergyMonitorSetBlockReadMode *data) {
+	tng_energy_monitor_set_block_read(data->block_read);
+
+	return HANDLE_MESSAGE_RESPONSE_EMPTY;
+}
+
+TNGHandleMessageResponse tng_energy_monitor_read_raw_samples_message(const TNGEnergyMonitorReadRawSamples *data, TNGEnergyMonitorReadRawSamples_Response *response) {
+	response->header.length    = sizeof(TNGEnergyMonitorReadRawSamples_Response);
+	response->samples_length   = tng_energy_monitor_read_raw_samples(response->samples, TNG_ENERGY_MONITOR_RAW_SAMPLES_PER_MESSAGE);
+	response->samples_overflow = tng_energy_monitor.raw_samples_overflow;
+
+	return HANDLE_MESSAGE_RESPONSE_NEW_MESSAGE;
+}
+
+TNGHandleMessageResponse tng_energy_monitor_read_samples_message(const TNGEnergyMonitorReadSamples *data, TNGEnergyMonitorReadSamples_Response *response) {
+	if(data->channel >= PAC193X_CHANNEL_NUM) {
+		return HANDLE_MESSAGE_RESPONSE_INVALID_PARAMETER;
+	}
+
+	response->header.length    = sizeof(TNGEnergyMonitorReadSamples_Response);
+	response->channel          = data->channel;
+	response->samples_length   = tng_energy_monitor_read_samples(data->channel, response->samples, TNG_ENERGY_MONITOR_SAMPLES_PER_MESSAGE);
+	response->samples_overflow = tng_energy_monitor.samples_overflow[data->channel];
+
+	return HANDLE_MESSAGE_RESPONSE_NEW_MESSAGE;
+}
+
+// Called by tng_handle_request if TNG_ENERGY_MONITOR_ENABLED is defined
+TNGHandleMessageResponse tng_energy_monitor_handle_message(const void *message, void *response) {
+	switch(tfp_get_fid_from_message(message)) {
+		case TNG_ENERGY_MONITOR_FID_SET_BLOCK_READ_MODE: return tng_energy_monitor_set_block_read_mode(message);
+		case TNG_ENERGY_MONITOR_FID_READ_RAW_SAMPLES: return tng_energy_monitor_read_raw_samples_message(message, response);
+		case TNG_ENERGY_MONITOR_FID_READ_SAMPLES: return tng_energy_monitor_read_samples_message(message, response);
+		default: return HANDLE_MESSAGE_RESPONSE_NOT_SUPPORTED;
+	}
+}
+
 void tng_energy_monitor_init(void) {
 	memset(&tng_energy_monitor, 0, sizeof(TNGEnergyMonitor));
 
-	pac193x_init();
+	// 1024 samples per second is the power-on default of the PAC193X
+	tng_energy_monitor.sample_rate        = PAC193X_SAMPLE_RATE;
+	tng_energy_monitor.sample_rate_ctrl   = 1024;
+	tng_energy_monitor.sample_rate_chip   = 1024;
+	tng_energy_monitor.sample_rate_period = 1024;
+	tng_energy_monitor.first_read         = true;
+	tng_energy_monitor.pac193x_state      = PAC193X_STATE_CONFIG_NEG_PWR;
+
+	pac193x_init_i2c();
 }
 
 void tng_energy_monitor_tick(void) {
 	pac193x_tick();
-}
\ No newline at end of file
+}
@@ -25,19 +25,65 @@
 #include "configs/config.h"
 
 #include <stdint.h>
+#include <stdbool.h>
+
+#include "bricklib2/protocols/tfp/tfp.h"
+#include "bricklib2/tng/tng.h"
+
+// Define TNG_ENERGY_MONITOR_ENABLED in config.h if the firmware uses the energy monitor.
+// tng then dispatches the energy monitor functions before the handle_message of the firmware.
+// The firmware still calls tng_energy_monitor_init and tng_energy_monitor_tick.
 
 #ifndef PAC193X_CHANNEL_NUM
 #define PAC193X_CHANNEL_NUM 3
 #endif
 
+// Samples per second, one of 8, 64, 256 or 1024.
+#ifndef PAC193X_SAMPLE_RATE
+#define PAC193X_SAMPLE_RATE 1024
+#endif
+
+// Period between two REFRESH commands. VPOWER_ACC is integrated over this period.
+#ifndef PAC193X_REFRESH_PERIOD_MS
+#define PAC193X_REFRESH_PERIOD_MS 200
+#endif
+
+// Size of the raw sample ring used in block-read mode
+#ifndef PAC193X_RAW_SAMPLE_COUNT
+#define PAC193X_RAW_SAMPLE_COUNT 32
+#endif
+
+// Size of the per-channel ring of converted samples
+#ifndef PAC193X_SAMPLE_COUNT
+#define PAC193X_SAMPLE_COUNT 32
+#endif
+
+#ifndef TNG_ENERGY_MONITOR_FID_SET_BLOCK_READ_MODE
+#define TNG_ENERGY_MONITOR_FID_SET_BLOCK_READ_MODE 226
+#endif
+
+#ifndef TNG_ENERGY_MONITOR_FID_READ_RAW_SAMPLES
+#define TNG_ENERGY_MONITOR_FID_READ_RAW_SAMPLES 227
+#endif
+
+#ifndef TNG_ENERGY_MONITOR_FID_READ_SAMPLES
+#define TNG_ENERGY_MONITOR_FID_READ_SAMPLES 228
+#endif
+
 typedef enum {
-    PAC193X_STATE_REFRESH      = 0,
-    PAC193X_STATE_REFRESH_WAIT = 1,
-    PAC193X_STATE_READ_TX      = 2,
-    PAC193X_STATE_READ_TX_WAIT = 3,
-    PAC193X_STATE_READ_RX      = 4,
-    PAC193X_STATE_READ_RX_WAIT = 5,
-    PAC193X_STATE_SLEEP        = 6
+    PAC193X_STATE_CONFIG_NEG_PWR      = 0,
+    PAC193X_STATE_CONFIG_NEG_PWR_WAIT = 1,
+    PAC193X_STATE_CONFIG_CTRL         = 2,
+    PAC193X_STATE_CONFIG_CTRL_WAIT    = 3,
+    PAC193X_STATE_REFRESH             = 4,
+    PAC193X_STATE_REFRESH_WAIT        = 5,
+    PAC193X_STATE_READ                = 6,
+    PAC193X_STATE_READ_WAIT           = 7,
+    PAC193X_STATE_READ_DONE           = 8,
+    PAC193X_STATE_SLEEP               = 9,
+    PAC193X_STATE_RAW_READ_WAIT       = 10,
+    PAC193X_STATE_RAW_REFRESH_WAIT    = 11,
+    PAC193X_STATE_ERROR               = 12
 } PAC193XState;
 
 typedef struct {
@@ -51,24 +97,115 @@ typedef struct {
     uint8_t vpower[PAC193X_CHANNEL_NUM][2];
 } __attribute__((__packed__)) PAC193XReadRegister;
 
+// VBUSn and VSENSEn as read with one block read starting at VBUS1
+typedef struct {
+    uint8_t vbus[PAC193X_CHANNEL_NUM][2];
+    uint8_t vsense[PAC193X_CHANNEL_NUM][2];
+} __attribute__((__packed__)) PAC193XRawRegister;
+
+typedef struct {
+    uint32_t timestamp; // system_timer_get_us32() at the REFRESH/REFRESH_V that latched the values
+    PAC193XRawRegister reg;
+} __attribute__((__packed__)) PAC193XRawSample;
+
+typedef struct {
+    uint32_t timestamp; // system_timer_get_us32() at the REFRESH/REFRESH_V that latched the values
+    uint16_t voltage;   // mV
+    uint16_t current;   // mA
+    uint32_t power;     // mW
+} __attribute__((__packed__)) TNGEnergyMonitorSample;
+
 typedef struct {
     PAC193XReadRegister pac193x_read_register;
-    PAC193XState pac193x_state;
+    volatile PAC193XState pac193x_state;
+
+    uint16_t sample_rate;          // Sample rate requested by the user
+    uint16_t sample_rate_ctrl;     // Sample rate written to CTRL, used by the chip after the next REFRESH
+    uint16_t sample_rate_chip;     // Sample rate the chip currently accumulates with
+    uint16_t sample_rate_period;   // Sample rate of the period that is currently read
+    bool config_pending;
+    volatile uint32_t refresh_time;
+    uint32_t refresh_time_last;
+    volatile uint32_t wait_start_time;
+    bool first_read;
+
+    bool block_read;
+    bool raw_pending;
+    volatile uint32_t raw_refresh_time;
+    PAC193XRawSample raw_samples[PAC193X_RAW_SAMPLE_COUNT];
+    volatile uint8_t raw_samples_start;
+    volatile uint8_t raw_samples_end;
+    volatile uint32_t raw_samples_overflow;
+
+    // Filled with every VBUSn/VSENSEn read, in block-read mode with the full chip sample rate
+    TNGEnergyMonitorSample samples[PAC193X_CHANNEL_NUM][PAC193X_SAMPLE_COUNT];
+    volatile uint8_t samples_start[PAC193X_CHANNEL_NUM];
+    volatile uint8_t samples_end[PAC193X_CHANNEL_NUM];
+    volatile uint32_t samples_overflow[PAC193X_CHANNEL_NUM];
+
+    uint32_t error_count;
 
     uint32_t voltage[PAC193X_CHANNEL_NUM];
     uint32_t current[PAC193X_CHANNEL_NUM];
     uint32_t power[PAC193X_CHANNEL_NUM];
-    uint64_t energy[PAC193X_CHANNEL_NUM];
+    uint64_t energy[PAC193X_CHANNEL_NUM];           // milliwatt-seconds
+    uint64_t energy_remainder[PAC193X_CHANNEL_NUM]; // fraction of a milliwatt-second, see pac193x_integrate_energy
 
     I2C_HandleTypeDef pac193x_i2c;
 } TNGEnergyMonitor;
 
+typedef struct {
+	TFPMessageHeader header;
+	bool block_read;
+} __attribute__((__packed__)) TNGEnergyMonitorSetBlockReadMode;
+
+#define TNG_ENERGY_MONITOR_RAW_SAMPLES_PER_MESSAGE 4
+
+typedef struct {
+	TFPMessageHeader header;
+} __attribute__((__packed__)) TNGEnergyMonitorReadRawSamples;
+
+typedef struct {
+	TFPMessageHeader header;
+	uint8_t samples_length;
+	uint32_t samples_overflow;
+	PAC193XRawSample samples[TNG_ENERGY_MONITOR_RAW_SAMPLES_PER_MESSAGE];
+} __attribute__((__packed__)) TNGEnergyMonitorReadRawSamples_Response;
+
+#define TNG_ENERGY_MONITOR_SAMPLES_PER_MESSAGE 5
+
+typedef struct {
+	TFPMessageHeader header;
+	uint8_t channel;
+} __attribute__((__packed__)) TNGEnergyMonitorReadSamples;
+
+typedef struct {
+	TFPMessageHeader header;
+	uint8_t channel;
+	uint8_t samples_length;
+	uint32_t samples_overflow;
+	TNGEnergyMonitorSample samples[TNG_ENERGY_MONITOR_SAMPLES_PER_MESSAGE];
+} __attribute__((__packed__)) TNGEnergyMonitorReadSamples_Response;
+
 extern TNGEnergyMonitor tng_energy_monitor;
 
 void tng_energy_monitor_init(void);
 void tng_energy_monitor_tick(void);
+bool tng_energy_monitor_set_sample_rate(const uint16_t sample_rate);
+void tng_energy_monitor_set_block_read(const bool block_read);
+uint8_t tng_energy_monitor_read_raw_samples(PAC193XRawSample *samples, const uint8_t max_length);
+uint8_t tng_energy_monitor_read_samples(const uint8_t channel, TNGEnergyMonitorSample *samples, const uint8_t max_length);
+TNGHandleMessageResponse tng_energy_monitor_handle_message(const void *message, void *response);
 
-#define PAC193X_REG_REFRESH 0x00
-#define PAC193X_REG_CTRL    0x01
+#define PAC193X_REG_REFRESH   0x00
+#define PAC193X_REG_CTRL      0x01
+#define PAC193X_REG_VBUS1     0x07
+#define PAC193X_REG_NEG_PWR   0x1D
+#define PAC193X_REG_REFRESH_V 0x1F
 
-#endif
\ No newline at end of file
+#define PAC193X_CTRL_SAMPLE_RATE_1024 (0b00 << 6)
+#define PAC193X_CTRL_SAMPLE_RATE_256  (0b01 << 6)
+#define PAC193X_CTRL_SAMPLE_RATE_64   (0b10 << 6)
+#define PAC193X_CTRL_SAMPLE_RATE_8    (0b11 << 6)
+
+#endif
@@ -20,12 +20,118 @@
  */
 
 #include "tng_firmware.h"
+#include "tng_communication.h"
 
 #include "bricklib2/utility/crc32.h"
 
 #include "configs/config.h"
 #include "config_stm32f0_128kb.h"
 
+#include "bricklib2/utility/util_definitions.h"
+
+#include <string.h>
+
+// Offset of the first byte that is covered by the firmware CRC (after CRC and length)
+#define TNG_FIRMWARE_CRC_START 8
+
+TNGFirmwareWriteState tng_firmware_write_state;
+
+static void tng_firmware_write_reset(void) {
+	tng_firmware_write_state.erased_end = 0;
+	tng_firmware_write_state.crc_end    = TNG_FIRMWARE_CRC_START;
+	tng_firmware_write_state.crc        = 0;
+	tng_firmware_write_state.crc_valid  = true;
+	tng_firmware_write_state.status     = TNG_WRITE_FIRMWARE_STATUS_OK;
+}
+
+// Update the incremental CRC with the data that was just written to flash.
+// We read the data back from flash, so the CRC covers what is really in the flash.
+static void tng_firmware_update_crc(const uint32_t pointer, const uint16_t length) {
+	TNGFirmwareWriteState *state = &tng_firmware_write_state;
+	if(!state->crc_valid) {
+		return;
+	}
+
+	// Only the bytes between offset 8 and the image length are part of the CRC.
+	// The length is written with the first chunk, before that the flash reads 0xFFFFFFFF.
+	uint32_t end = pointer + length;
+	const uint32_t image_length = tng_firmware_get_length();
+	if((image_length >= TNG_FIRMWARE_CRC_START) && (end > image_length)) {
+		end = image_length;
+	}
+
+	const uint32_t start = MAX(pointer, TNG_FIRMWARE_CRC_START);
+	if(end <= start) {
+		return;
+	}
+
+	if(start != state->crc_end) {
+		// Gap or data that is already covered by the CRC was written again,
+		// we can't calculate the CRC incrementally anymore
+		state->crc_valid = false;
+		return;
+	}
+
+	crc32_ieee_802_3_recalculate((const void*)(STM32F0_FIRMWARE_NEW_POS_START + state->crc_end), end - state->crc_end, &state->crc);
+	state->crc_end = end;
+}
+
+// Writes length bytes (multiple of 4) of firmware to the new firmware area at offset pointer.
+// A write to pointer 0 starts a new upload.
+uint8_t tng_firmware_write(const uint32_t pointer, const uint8_t *data, const uint16_t length) {
+	TNGFirmwareWriteState *state = &tng_firmware_write_state;
+
+	if(pointer == 0) {
+		tng_firmware_write_reset();
+	}
+
+	// pointer comes directly from the host, check without overflow of pointer + length
+	if(((pointer % 4) != 0) || ((length % 4) != 0) || (length > STM32F0_FIRMWARE_SIZE) || (pointer > STM32F0_FIRMWARE_SIZE - length)) {
+		state->status = TNG_WRITE_FIRMWARE_STATUS_INVALID_POINTER;
+		return state->status;
+	}
+
+	HAL_FLASH_Unlock();
+
+	// Erase the pages that are touched by this write and were not erased yet.
+	// This spreads the erase time over the upload instead of blocking for
+	// the whole firmware area at the first chunk.
+	// The CPU runs from flash and stalls during erase and program, so the USB
+	// interrupt is not serviced in the meantime. Erase and USB handling
+	// don't overlap, a chunk that starts a new page just takes longer.
+	while(state->erased_end < pointer + length) {
+		FLASH_EraseInitTypeDef erase_init = {
+			.TypeErase   = FLASH_TYPEERASE_PAGES,
+			.PageAddress = STM32F0_FIRMWARE_NEW_POS_START + state->erased_end,
+			.NbPages     = 1
+		};
+		uint32_t page_error = 0;
+		if(HAL_FLASHEx_Erase(&erase_init, &page_error) != HAL_OK) {
+			HAL_FLASH_Lock();
+			state->status = TNG_WRITE_FIRMWARE_STATUS_INVALID_POINTER;
+			return state->status;
+		}
+		state->erased_end += FLASH_PAGE_SIZE;
+	}
+
+	for(uint16_t i = 0; i < length; i += 4) {
+		// The data may come directly from the USB buffer and may not be 4-byte aligned
+		uint32_t data32;
+		memcpy(&data32, &data[i], sizeof(uint32_t));
+		if(HAL_FLASH_Program(FLASH_TYPEPROGRAM_WORD, STM32F0_FIRMWARE_NEW_POS_START + pointer + i, data32) != HAL_OK) {
+			HAL_FLASH_Lock();
+			state->status = TNG_WRITE_FIRMWARE_STATUS_INVALID_POINTER;
+			return state->status;
+		}
+	}
+	HAL_FLASH_Lock();
+
+	tng_firmware_update_crc(pointer, length);
+
+	state->status = TNG_WRITE_FIRMWARE_STATUS_OK;
+	return state->status;
+}
+
 
 uint32_t tng_firmware_get_crc(void) {
 	const uint32_t *crc = (uint32_t *)STM32F0_NEW_CRC_POSITION;
@@ -62,7 +168,13 @@ bool tng_firmware_check_crc(void) {
 	const uint32_t length = tng_firmware_get_length();
 	const uint32_t crc    = tng_firmware_get_crc();
 
-	const uint32_t crc_calc = crc32_ieee_802_3((const void*)STM32F0_FIRMWARE_NEW_POS_START + 8, length - 8);
+	// If the firmware was written sequentially we already have the CRC
+	const TNGFirmwareWriteState *state = &tng_firmware_write_state;
+	if(state->crc_valid && (state->crc_end == length)) {
+		return crc == state->crc;
+	}
+
+	const uint32_t crc_calc = crc32_ieee_802_3((const void*)STM32F0_FIRMWARE_NEW_POS_START + TNG_FIRMWARE_CRC_START, length - TNG_FIRMWARE_CRC_START);
 
 	return crc == crc_calc;
 }
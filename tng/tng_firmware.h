@@ -31,6 +31,21 @@
 #define TNG_FIRMWARE_COPY_STATUS_LENGTH_MALFORMED            3
 #define TNG_FIRMWARE_COPY_STATUS_CRC_MISMATCH                4
 
+// State of a firmware upload into the "new" firmware area.
+// Pages are erased on demand when a write reaches them and the CRC is
+// calculated incrementally for sequential writes, so the final CRC check
+// does not need to read the whole image again.
+typedef struct {
+	uint32_t erased_end;   // Offset up to which the flash is erased
+	uint32_t crc_end;      // Offset up to which the CRC is calculated (starting at offset 8)
+	uint32_t crc;
+	bool crc_valid;        // False if the writes were not sequential
+	uint8_t status;        // Status of last write (TNG_WRITE_FIRMWARE_STATUS_*)
+} TNGFirmwareWriteState;
+
+extern TNGFirmwareWriteState tng_firmware_write_state;
+
+uint8_t tng_firmware_write(const uint32_t pointer, const uint8_t *data, const uint16_t length);
 uint32_t tng_firmware_get_length(void);
 bool tng_firmware_check_device_identifier(void);
 bool tng_firmware_check_magic_number(void);
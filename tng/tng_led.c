@@ -27,8 +27,9 @@
 #include "bricklib2/utility/util_definitions.h"
 #include "bricklib2/hal/system_timer/system_timer.h"
 
+#include <string.h>
+
 #include "tng_led_cie1931.inc"
-#include "tng_led_rainbow.inc"
 
 #define TNG_LED_PERIOD 0xFFFF
 
@@ -138,38 +139,180 @@ const GPIO_TypeDef *tng_led_channel_port[TNG_LED_CHANNEL_NUM] = {
 #endif
 
 #ifdef TNG_LED_STATUS_R_PIN
-void tng_led_status_set(const uint8_t r, const uint8_t g, const uint8_t b) {
+// Green breathing, 2048ms period
+static const TNGLEDKeyframe tng_led_keyframes_breathing[] = {
+	{0, 255, 0, 1024, 0},
+	{0,   0, 0, 1024, 0}
+};
+
+// Hue circle with 75% intensity, 1000ms period.
+// A linear fade between neighbouring corners of the hue circle is the same as the HSV fade.
+static const TNGLEDKeyframe tng_led_keyframes_rainbow[] = {
+	{191,   0, 191, 167, 0},
+	{  0,   0, 191, 167, 0},
+	{  0, 191, 191, 166, 0},
+	{  0, 191,   0, 167, 0},
+	{191, 191,   0, 167, 0},
+	{191,   0,   0, 166, 0}
+};
+
+// Red blinking with 2Hz
+static const TNGLEDKeyframe tng_led_keyframes_blink[] = {
+	{255, 0, 0, 0, 250},
+	{  0, 0, 0, 0, 250}
+};
+
+const TNGLEDAnimation tng_led_animation_breathing = {tng_led_keyframes_breathing, sizeof(tng_led_keyframes_breathing)/sizeof(TNGLEDKeyframe), true};
+const TNGLEDAnimation tng_led_animation_rainbow   = {tng_led_keyframes_rainbow,   sizeof(tng_led_keyframes_rainbow)/sizeof(TNGLEDKeyframe),   true};
+const TNGLEDAnimation tng_led_animation_blink     = {tng_led_keyframes_blink,     sizeof(tng_led_keyframes_blink)/sizeof(TNGLEDKeyframe),     true};
+
+// Animation state, only changed in the TIM1 update interrupt
+// or with the interrupt disabled
+static const TNGLEDAnimation *volatile tng_led_animation = NULL;
+static uint8_t tng_led_animation_index = 0;
+static uint32_t tng_led_animation_time_us = 0;
+static uint32_t tng_led_animation_step_us = 0;
+static uint8_t tng_led_animation_from[TNG_LED_STATUS_NUM] = {0, 0, 0};
+static uint8_t tng_led_animation_current[TNG_LED_STATUS_NUM] = {0, 0, 0};
+
+static void tng_led_status_write(const uint8_t r, const uint8_t g, const uint8_t b) {
+	// The CCR registers are preloaded, the new values are used with the next update event
 	TIM1->CCR1 = TNG_LED_PERIOD - tng_led_cie1931[r];
 	TIM1->CCR2 = TNG_LED_PERIOD - tng_led_cie1931[g];
 	TIM1->CCR3 = TNG_LED_PERIOD - tng_led_cie1931[b];
+
+	tng_led_animation_current[TNG_LED_STATUS_R] = r;
+	tng_led_animation_current[TNG_LED_STATUS_G] = g;
+	tng_led_animation_current[TNG_LED_STATUS_B] = b;
 }
-#endif
 
-#ifdef TNG_LED_CHANNEL_0_PIN
-void tng_led_channel_set(const TNGLEDChannel channel, const bool enable) {
-	if(channel < TNG_LED_CHANNEL_NUM) {
-		HAL_GPIO_WritePin((GPIO_TypeDef *)tng_led_channel_port[channel], tng_led_channel_pin[channel], enable ? GPIO_PIN_RESET : GPIO_PIN_SET);
+// Advance the animation by one step. Called once per TIM1 update event (with repetition counter),
+// so the animation timing does not depend on main loop latency.
+static void tng_led_animation_step(void) {
+	const TNGLEDAnimation *animation = tng_led_animation;
+	if(animation == NULL) {
+		return;
+	}
+
+	tng_led_animation_time_us += tng_led_animation_step_us;
+
+	// Skip over all keyframes that are already done.
+	// The loop is bounded, so an animation with only zero-length keyframes can't stall us.
+	const TNGLEDKeyframe *keyframe = &animation->keyframes[tng_led_animation_index];
+	for(uint8_t i = 0; i <= animation->length; i++) {
+		const uint32_t duration_us = (keyframe->fade_ms + keyframe->hold_ms)*1000;
+		if(tng_led_animation_time_us < duration_us) {
+			break;
+		}
+
+		tng_led_animation_time_us -= duration_us;
+		tng_led_animation_from[TNG_LED_STATUS_R] = keyframe->r;
+		tng_led_animation_from[TNG_LED_STATUS_G] = keyframe->g;
+		tng_led_animation_from[TNG_LED_STATUS_B] = keyframe->b;
+
+		if(tng_led_animation_index + 1 < animation->length) {
+			tng_led_animation_index++;
+		} else if(animation->loop) {
+			tng_led_animation_index = 0;
+		} else {
+			// Animation is done, keep the color of the last keyframe
+			tng_led_animation = NULL;
+			tng_led_status_write(keyframe->r, keyframe->g, keyframe->b);
+			return;
+		}
+
+		keyframe = &animation->keyframes[tng_led_animation_index];
 	}
+
+	const uint32_t time_ms = tng_led_animation_time_us/1000;
+	if(time_ms >= keyframe->fade_ms) {
+		tng_led_status_write(keyframe->r, keyframe->g, keyframe->b);
+		return;
+	}
+
+	const uint8_t to[TNG_LED_STATUS_NUM] = {keyframe->r, keyframe->g, keyframe->b};
+	uint8_t value[TNG_LED_STATUS_NUM];
+	for(uint8_t i = 0; i < TNG_LED_STATUS_NUM; i++) {
+		value[i] = tng_led_animation_from[i] + ((int32_t)to[i] - (int32_t)tng_led_animation_from[i])*(int32_t)time_ms/(int32_t)keyframe->fade_ms;
+	}
+
+	tng_led_status_write(value[TNG_LED_STATUS_R], value[TNG_LED_STATUS_G], value[TNG_LED_STATUS_B]);
 }
-#endif
 
-void tng_led_tick_breathing(void) {
-	int16_t value = system_timer_get_ms()/4 % 512;
-	if(value > 255) {
-		value = 511 - value;
+void TIM1_BRK_UP_TRG_COM_IRQHandler(void) {
+	if(TIM1->SR & TIM_SR_UIF) {
+		TIM1->SR = ~TIM_SR_UIF;
+		tng_led_animation_step();
 	}
+}
+
+// Disables the animation interrupt and returns if it was enabled before.
+// The state is read from ISER directly, the CMSIS of the M0 has no NVIC_GetEnableIRQ in older versions.
+static bool tng_led_animation_irq_disable(void) {
+	const bool enabled = (NVIC->ISER[0] & (1UL << (((uint32_t)TIM1_BRK_UP_TRG_COM_IRQn) & 0x1FUL))) != 0;
+	NVIC_DisableIRQ(TIM1_BRK_UP_TRG_COM_IRQn);
+
+	return enabled;
+}
 
-	tng_led_status_set(0, value, 0);
+static void tng_led_animation_irq_restore(const bool enabled) {
+	if(enabled) {
+		NVIC_EnableIRQ(TIM1_BRK_UP_TRG_COM_IRQn);
+	}
+}
+
+// Starts the animation from the current color.
+// The animation is advanced in the TIM1 interrupt, no tick is needed.
+void tng_led_status_animation_start(const TNGLEDAnimation *animation) {
+	if((animation != NULL) && (animation->length == 0)) {
+		animation = NULL;
+	}
+
+	const bool irq_enabled = tng_led_animation_irq_disable();
+	memcpy(tng_led_animation_from, tng_led_animation_current, TNG_LED_STATUS_NUM);
+	tng_led_animation_index   = 0;
+	tng_led_animation_time_us = 0;
+	tng_led_animation         = animation;
+	tng_led_animation_irq_restore(irq_enabled);
+}
+
+bool tng_led_status_animation_is_running(void) {
+	return tng_led_animation != NULL;
+}
+
+// Sets a static color, a running animation is stopped
+void tng_led_status_set(const uint8_t r, const uint8_t g, const uint8_t b) {
+	const bool irq_enabled = tng_led_animation_irq_disable();
+	tng_led_animation = NULL;
+	tng_led_status_write(r, g, b);
+	tng_led_animation_irq_restore(irq_enabled);
+}
+
+// Kept for compatibility with firmwares that called these periodically.
+// They start the corresponding animation if it is not running already.
+void tng_led_tick_breathing(void) {
+	if(tng_led_animation != &tng_led_animation_breathing) {
+		tng_led_status_animation_start(&tng_led_animation_breathing);
+	}
 }
 
 void tng_led_tick_rainbow(void) {
-	uint8_t value = system_timer_get_ms()/4 % 250;
+	if(tng_led_animation != &tng_led_animation_rainbow) {
+		tng_led_status_animation_start(&tng_led_animation_rainbow);
+	}
+}
+#endif
 
-	tng_led_status_set(tng_led_rainbow[value][0], tng_led_rainbow[value][1], tng_led_rainbow[value][2]);
+#ifdef TNG_LED_CHANNEL_0_PIN
+void tng_led_channel_set(const TNGLEDChannel channel, const bool enable) {
+	if(channel < TNG_LED_CHANNEL_NUM) {
+		HAL_GPIO_WritePin((GPIO_TypeDef *)tng_led_channel_port[channel], tng_led_channel_pin[channel], enable ? GPIO_PIN_RESET : GPIO_PIN_SET);
+	}
 }
+#endif
 
 void tng_led_tick(void) {
-	tng_led_tick_breathing();
+	// The status LED animation runs in the TIM1 interrupt, nothing to do here
 }
 
 void tng_led_init(void) {
@@ -188,7 +331,7 @@ void tng_led_init(void) {
 		.Init.Period            = TNG_LED_PERIOD - 1,
 		.Init.ClockDivision     = 0,
 		.Init.CounterMode       = TIM_COUNTERMODE_UP,
-		.Init.RepetitionCounter = 0,
+		.Init.RepetitionCounter = TNG_LED_ANIMATION_REPETITION,
 		.Init.AutoReloadPreload = TIM_AUTORELOAD_PRELOAD_DISABLE
 	};
 	HAL_TIM_PWM_Init(&tim);
@@ -216,6 +359,16 @@ void tng_led_init(void) {
 		HAL_TIM_PWM_ConfigChannel(&tim, &oc, tng_led_status_tim_ch[i]);
 		HAL_TIM_PWM_Start(&tim, tng_led_status_tim_ch[i]);
 	}
+
+	// One animation step per update event. With the repetition counter the update event
+	// only happens every TNG_LED_ANIMATION_REPETITION+1 PWM periods.
+	tng_led_animation_step_us = (uint32_t)((uint64_t)TNG_LED_PERIOD*(TNG_LED_ANIMATION_REPETITION+1)*1000000/HAL_RCC_GetPCLK1Freq());
+	__HAL_TIM_CLEAR_IT(&tim, TIM_IT_UPDATE);
+	__HAL_TIM_ENABLE_IT(&tim, TIM_IT_UPDATE);
+	HAL_NVIC_SetPriority(TIM1_BRK_UP_TRG_COM_IRQn, TNG_LED_ANIMATION_IRQ_PRIORITY, 0);
+	HAL_NVIC_EnableIRQ(TIM1_BRK_UP_TRG_COM_IRQn);
+
+	tng_led_status_animation_start(&tng_led_animation_breathing);
 #endif
 
 #ifdef TNG_LED_CHANNEL_0_PIN
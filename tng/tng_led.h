@@ -50,10 +50,44 @@ typedef enum {
 	TNG_LED_CHANNEL_11 = 11
 } TNGLEDChannel;
 
+// Animation step rate is TIM1 clock/(TNG_LED_PERIOD*(TNG_LED_ANIMATION_REPETITION+1)),
+// about 91Hz with 48MHz and the default of 7
+#ifndef TNG_LED_ANIMATION_REPETITION
+#define TNG_LED_ANIMATION_REPETITION 7
+#endif
 
+#ifndef TNG_LED_ANIMATION_IRQ_PRIORITY
+#define TNG_LED_ANIMATION_IRQ_PRIORITY 3
+#endif
+
+// Fade from the current color to r, g, b in fade_ms, then hold the color for hold_ms
+typedef struct {
+	uint8_t r;
+	uint8_t g;
+	uint8_t b;
+	uint16_t fade_ms;
+	uint16_t hold_ms;
+} __attribute__((__packed__)) TNGLEDKeyframe;
+
+typedef struct {
+	const TNGLEDKeyframe *keyframes;
+	uint8_t length;
+	bool loop;
+} TNGLEDAnimation;
+
+extern const TNGLEDAnimation tng_led_animation_breathing;
+extern const TNGLEDAnimation tng_led_animation_rainbow;
+extern const TNGLEDAnimation tng_led_animation_blink;
+
+void tng_led_status_animation_start(const TNGLEDAnimation *animation);
+bool tng_led_status_animation_is_running(void);
 void tng_led_status_set(const uint8_t r, const uint8_t g, const uint8_t b);
 void tng_led_channel_set(const TNGLEDChannel channel, const bool enable);
 
+// Deprecated, use tng_led_status_animation_start
+void tng_led_tick_breathing(void);
+void tng_led_tick_rainbow(void);
+
 void tng_led_tick(void);
 void tng_led_init(void);
 
@@ -23,6 +23,7 @@
 
 #include "bricklib2/logging/logging.h"
 #include "bricklib2/os/coop_task.h"
+#include "bricklib2/protocols/tfp/tfp.h"
 
 #include "stm32f0xx.h"
 #include "stm32f0xx_hal.h"
@@ -36,9 +37,16 @@ TFUSB tfusb;
 
 USBD_HandleTypeDef usbd_device;
 
-// USB interrupt enable/disable functions can be used to prevent race condition
-// with USB code and USB_IRQHandler. Currently, because of the structure of
-// the USB code, these are not necessary!
+// Locking contract of the IN/OUT buffers:
+// The USB interrupt (usb_send_complete, usb_recv_complete) and the main loop
+// both change the buffer indices. Every main loop function that touches them
+// (usb_handle_reset, usb_send_reserve/commit, usb_recv_peek/consume) does this
+// between usb_interrupt_disable and usb_interrupt_enable. Functions that are
+// documented with "Has to be called with USB interrupt disabled or from USB
+// interrupt" (usb_send_start, usb_recv_arm) don't lock themselves.
+// usb_interrupt_disable returns the previous enable state, so the calls can be nested.
+// The data between usb_send_reserve and usb_send_commit and the data returned by
+// usb_recv_peek is only used by the main loop and can be accessed without the lock.
 void usb_interrupt_enable(bool mask) {
 	if(mask) {
 		NVIC_EnableIRQ(USB_IRQn);
@@ -78,92 +86,222 @@ void usb_init(void) {
 	}
 }
 
-bool usb_send_storage(void) {
-	// If there is data in storage and there is no transfer in progress,
-	// try to send the storage data.
-	if((tfusb.in_buffer_storage_length != 0) && (!tfusb.transfer_in_progress)) {
-		// Copy storage to USB in buffer and try to send
-		memcpy(tfusb.in_buffer, tfusb.in_buffer_storage, tfusb.in_buffer_storage_length);
-		tfusb.in_buffer_length = tfusb.in_buffer_storage_length;
-		tfusb.transfer_in_progress = true;
-		if(USBD_LL_Transmit(&usbd_device, USBD_TFP_IN_EP, tfusb.in_buffer, tfusb.in_buffer_length) == USBD_OK) {
-			// If the transmit was successful, we can set the storage length back to 0.
-			tfusb.in_buffer_storage_length = 0;
-			return true;
+// Has to be called from main loop.
+// After a (re-)enumeration (see usbd_tfp_init) the IN and OUT buffers still contain
+// data from before the bus reset. The buffers are reset here instead of in the
+// USB interrupt, so we can't interfere with a reserve/commit or peek/consume that
+// is in progress. Returns true if the buffers were reset.
+bool usb_handle_reset(void) {
+	if(!tfusb.reset_pending) {
+		return false;
+	}
+
+	bool interrupt_state = usb_interrupt_disable();
+	tfusb.in_read              = 0;
+	tfusb.in_write             = 0;
+	tfusb.in_wrap              = 0;
+	tfusb.in_transfer_length   = 0;
+	tfusb.transfer_in_progress = false;
+
+	tfusb.out_read             = 0;
+	tfusb.out_write            = 0;
+
+	tfusb.reset_pending        = false;
+	usb_recv_arm();
+	usb_interrupt_enable(interrupt_state);
+
+	return true;
+}
+
+// Has to be called with USB interrupt disabled or from USB interrupt
+void usb_send_start(void) {
+	// Nothing is send after a (re-)enumeration until the stale data is thrown away
+	if(tfusb.transfer_in_progress || tfusb.reset_pending) {
+		return;
+	}
+
+	// All data before the wrap-around is send, continue at the beginning
+	if((tfusb.in_wrap != 0) && (tfusb.in_read == tfusb.in_wrap)) {
+		tfusb.in_read = 0;
+		tfusb.in_wrap = 0;
+	}
+
+	const uint16_t end = (tfusb.in_wrap != 0) ? tfusb.in_wrap : tfusb.in_write;
+	if(end <= tfusb.in_read) {
+		return;
+	}
+
+	// Pack as many complete messages as possible back-to-back into one packet.
+	// A message that is bigger than one packet is send alone.
+	const uint16_t available = end - tfusb.in_read;
+	uint16_t length = 0;
+	while(length < available) {
+		const uint8_t message_length = tfp_get_length_from_message(&tfusb.in_buffer[tfusb.in_read + length]);
+		if((message_length < TFP_MESSAGE_MIN_LENGTH) || (length + message_length > available)) {
+			// Not a valid TFP message, we just send everything that is left
+			length = available;
+			break;
+		}
+
+		if((length > 0) && (length + message_length > USBD_TFP_IN_SIZE)) {
+			break;
 		}
+
+		length += message_length;
+	}
+
+	tfusb.transfer_in_progress = true;
+	tfusb.in_transfer_length   = length;
+	if(USBD_LL_Transmit(&usbd_device, USBD_TFP_IN_EP, &tfusb.in_buffer[tfusb.in_read], length) != USBD_OK) {
 		tfusb.transfer_in_progress = false;
+		tfusb.in_transfer_length   = 0;
+	}
+}
+
+// Called from USB interrupt if IN transfer is done
+void usb_send_complete(void) {
+	tfusb.in_read             += tfusb.in_transfer_length;
+	tfusb.in_transfer_length   = 0;
+	tfusb.transfer_in_progress = false;
+
+	usb_send_start();
+}
+
+// Returns pointer to length bytes in the IN buffer or NULL if there is not enough space.
+// The data can be written directly to the returned pointer and has to be
+// committed with usb_send_commit before the next reserve.
+uint8_t *usb_send_reserve(uint16_t length) {
+	uint8_t *data = NULL;
+	bool interrupt_state = usb_interrupt_disable();
+
+	// If everything is send we can start at the beginning of the buffer again
+	if((tfusb.in_wrap == 0) && (tfusb.in_read == tfusb.in_write)) {
+		tfusb.in_read  = 0;
+		tfusb.in_write = 0;
 	}
 
-	return false;
+	tfusb.in_reserve_wrap = false;
+	if(tfusb.in_wrap == 0) {
+		if(USB_BUFFER_SIZE - tfusb.in_write >= length) {
+			tfusb.in_reserve_pos = tfusb.in_write;
+			data = &tfusb.in_buffer[tfusb.in_write];
+		} else if(tfusb.in_read >= length) {
+			// Not enough space at the end, but at the beginning
+			tfusb.in_reserve_pos  = 0;
+			tfusb.in_reserve_wrap = true;
+			data = tfusb.in_buffer;
+		}
+	} else if(tfusb.in_read - tfusb.in_write >= length) {
+		tfusb.in_reserve_pos = tfusb.in_write;
+		data = &tfusb.in_buffer[tfusb.in_write];
+	}
+
+	usb_interrupt_enable(interrupt_state);
+	return data;
 }
 
-bool usb_append_to_storage(uint8_t *data, uint16_t length) {
-	if(tfusb.in_buffer_storage_length + length < USB_BUFFER_SIZE) {
-		// Append to storage if there is enough space
-		memcpy(&tfusb.in_buffer_storage[tfusb.in_buffer_storage_length], data, length);
-		tfusb.in_buffer_storage_length += length;
-		return true;
+// Commit length bytes of the data that was written to the pointer returned by
+// usb_send_reserve. Use length = 0 to discard the reserved space.
+void usb_send_commit(uint16_t length) {
+	if(length == 0) {
+		return;
 	}
 
-	// Not enough space
-	return false;
+	bool interrupt_state = usb_interrupt_disable();
+	if(tfusb.in_reserve_wrap) {
+		tfusb.in_wrap = tfusb.in_write;
+	}
+	tfusb.in_write = tfusb.in_reserve_pos + length;
+
+	usb_send_start();
+	usb_interrupt_enable(interrupt_state);
 }
 
 bool usb_send(uint8_t *data, uint16_t length) {
-	// first check if the storage is empty.
-	// If it is not we append the data to the storage, otherwise we would re-order responses.
-	if(tfusb.in_buffer_storage_length > 0) {
-		if(usb_append_to_storage(data, length)) {
-			// Try to send the storage
-			usb_send_storage();
-
-			// The data was copied in any way at this point, we can always return true!
-			return true;
-		}
-			
-		// If the storage is full we can't do anything
+	uint8_t *buffer = usb_send_reserve(length);
+	if(buffer == NULL) {
 		return false;
 	}
 
-	if(tfusb.transfer_in_progress) {
-		// If there is a transfer in progress, append the data to storage
-		return usb_append_to_storage(data, length);
+	memcpy(buffer, data, length);
+	usb_send_commit(length);
+
+	return true;
+}
+
+// Has to be called with USB interrupt disabled or from USB interrupt
+void usb_recv_arm(void) {
+	if(tfusb.out_receive_armed || tfusb.reset_pending) {
+		return;
 	}
 
-	// Copy data to USB in buffer and try to send
-	memcpy(tfusb.in_buffer, data, length);
-	tfusb.in_buffer_length = length;
-	tfusb.transfer_in_progress = true;
-	if(USBD_LL_Transmit(&usbd_device, USBD_TFP_IN_EP, tfusb.in_buffer, tfusb.in_buffer_length) == USBD_OK) {
-		return true;
+	// If everything is consumed we can start at the beginning of the buffer again
+	if(tfusb.out_read == tfusb.out_write) {
+		tfusb.out_read  = 0;
+		tfusb.out_write = 0;
 	}
 
-	// If we can't send we try to append the data to the storage.
-	tfusb.transfer_in_progress = false;
+	// The endpoint always receives a full packet directly behind the already received data
+	if(USB_BUFFER_SIZE - tfusb.out_write < USBD_TFP_OUT_SIZE) {
+		return;
+	}
 
-	return usb_append_to_storage(data, length);
+	tfusb.out_receive_armed = true;
+	if(USBD_LL_PrepareReceive(&usbd_device, USBD_TFP_OUT_EP, &tfusb.out_buffer[tfusb.out_write], USBD_TFP_OUT_SIZE) != USBD_OK) {
+		tfusb.out_receive_armed = false;
+	}
 }
 
-uint16_t usb_recv(uint8_t *data, uint16_t max_length) {
-	// If we didn't receive any data return 0.
-	if(tfusb.out_buffer_length == 0) {
-		return 0;
-	}
+// Called from USB interrupt if OUT transfer is done
+void usb_recv_complete(uint16_t length) {
+	tfusb.out_write        += length;
+	tfusb.out_receive_armed = false;
 
-	// Copy received data
-	const uint16_t length = tfusb.out_buffer_length;
-	memcpy(data, tfusb.out_buffer, length);
+	usb_recv_arm();
+}
+
+// Has to be called with USB interrupt disabled.
+// If the endpoint is not armed (not enough space at the end of the buffer),
+// we move the remaining data to the beginning and arm the endpoint again.
+// The remaining data is typically only a part of a message, so this is cheap.
+static void usb_recv_compact(void) {
+	if(tfusb.out_receive_armed) {
+		return;
+	}
 
-	// Set out USB buffer again for next receive.
-	tfusb.out_buffer_length = 0;
-	if(USBD_LL_PrepareReceive(&usbd_device, USBD_TFP_OUT_EP, tfusb.out_buffer, USB_BUFFER_SIZE) == USBD_OK) {
-		return length;
+	const uint16_t remaining = tfusb.out_write - tfusb.out_read;
+	if((remaining > 0) && (tfusb.out_read > 0)) {
+		memmove(tfusb.out_buffer, &tfusb.out_buffer[tfusb.out_read], remaining);
 	}
+	tfusb.out_read  = 0;
+	tfusb.out_write = remaining;
 
-	tfusb.out_buffer_length = length;
-	return 0;
+	usb_recv_arm();
+}
+
+// Returns pointer to the received data in the OUT buffer. The pointer is
+// valid until the next call of usb_recv_peek or usb_recv_consume.
+//
+// The endpoint may have run out of space while only a part of a message
+// was received, so we also compact and re-arm here. Otherwise the rest
+// of the message would never arrive and it could never be consumed.
+uint8_t *usb_recv_peek(uint16_t *length) {
+	bool interrupt_state = usb_interrupt_disable();
+	usb_recv_compact();
+	*length = tfusb.out_write - tfusb.out_read;
+	uint8_t *data = &tfusb.out_buffer[tfusb.out_read];
+	usb_interrupt_enable(interrupt_state);
+
+	return data;
+}
+
+void usb_recv_consume(uint16_t length) {
+	bool interrupt_state = usb_interrupt_disable();
+	tfusb.out_read += length;
+	usb_recv_compact();
+	usb_interrupt_enable(interrupt_state);
 }
 
 inline bool usb_can_recv(void) {
-	return tfusb.out_buffer_length != 0;
-}
\ No newline at end of file
+	return tfusb.out_write != tfusb.out_read;
+}
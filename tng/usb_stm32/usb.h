@@ -29,23 +29,43 @@
 
 #define USB_BUFFER_SIZE 256
 
+// The OUT endpoint receives directly into out_buffer at position out_write, so
+// TFP messages can be parsed in place (usb_recv_peek/usb_recv_consume).
+// The IN data is built directly in in_buffer (usb_send_reserve/usb_send_commit).
+// in_buffer is used as a bip buffer: If there is not enough space at the end, new data
+// is written to the beginning and in_wrap marks the end of the data before the wrap.
 typedef struct {
     __attribute__ ((aligned (4))) uint8_t in_buffer[USB_BUFFER_SIZE];
     __attribute__ ((aligned (4))) uint8_t out_buffer[USB_BUFFER_SIZE];
-    uint16_t in_buffer_length;
-    uint16_t out_buffer_length;
-    bool transfer_in_progress;
 
-    uint16_t in_buffer_storage_length;
-    uint8_t in_buffer_storage[USB_BUFFER_SIZE];
+    volatile uint16_t in_read;             // Start of data that is not yet acknowledged by host
+    volatile uint16_t in_write;            // End of committed data
+    volatile uint16_t in_wrap;             // End of data before wrap-around (0 = no wrap-around)
+    volatile uint16_t in_transfer_length;  // Length of transfer in progress (starting at in_read)
+    volatile bool transfer_in_progress;
+    uint16_t in_reserve_pos;
+    bool in_reserve_wrap;
+
+    volatile uint16_t out_read;            // Start of data that is not yet consumed
+    volatile uint16_t out_write;           // End of received data
+    volatile bool out_receive_armed;       // Endpoint is armed to receive at out_write
+
+    volatile bool reset_pending;           // (Re-)enumerated, buffers are reset by usb_handle_reset
 } TFUSB;
 
 extern TFUSB tfusb;
 
 void usb_init(void);
+bool usb_handle_reset(void);
 bool usb_send(uint8_t *data, uint16_t length);
-bool usb_send_storage(void);
-uint16_t usb_recv(uint8_t *data, uint16_t max_length);
+uint8_t *usb_send_reserve(uint16_t length);
+void usb_send_commit(uint16_t length);
+void usb_send_start(void);
+void usb_send_complete(void);
+uint8_t *usb_recv_peek(uint16_t *length);
+void usb_recv_consume(uint16_t length);
+void usb_recv_arm(void);
+void usb_recv_complete(uint16_t length);
 bool usb_can_recv(void);
 void usb_interrupt_enable(bool mask);
 bool usb_interrupt_disable(void);
@@ -93,13 +93,12 @@ static uint8_t usbd_tfp_init(USBD_HandleTypeDef *dev, uint8_t cfgidx) {
 	// Open OUT EP 
 	USBD_LL_OpenEP(dev,	USBD_TFP_OUT_EP, USBD_EP_TYPE_BULK, USBD_TFP_OUT_SIZE);
 	
-	// Prepare Out endpoint to receive next packet
-	USBD_LL_PrepareReceive(dev, USBD_TFP_OUT_EP, tfusb.out_buffer, USBD_TFP_OUT_SIZE);
-
-	// TODO: We don't check if there was enough space in the usb buffer here.
-	//       I think this is always OK for the initial enumerate, since there is never any messages in the buffer?
-	//       If this doesn't work out we can add a tng_communication_tick with a bool for the initial enumeration.
-	tng_send_initial_enumerate();
+	// Transfers that were in progress before (re-)enumeration are lost.
+	// The buffers are reset and the initial enumerate is send from tng_tick
+	// (usb_handle_reset), since we may have interrupted the main loop while
+	// it was using the buffers.
+	tfusb.out_receive_armed = false;
+	tfusb.reset_pending     = true;
 
 	return USBD_OK;
 }
@@ -115,17 +114,15 @@ static uint8_t usbd_tfp_deinit(USBD_HandleTypeDef *dev, uint8_t cfgidx) {
 }
 
 static uint8_t usbd_tfp_data_in(USBD_HandleTypeDef *dev, uint8_t epnum) {
-	tfusb.transfer_in_progress = false;
-	usb_send_storage();
+	usb_send_complete();
 
 	return USBD_OK;
 }
 
-static uint8_t usbd_tfp_data_out(USBD_HandleTypeDef *dev, uint8_t epnum) {      
-	tfusb.out_buffer_length += USBD_LL_GetRxDataSize(dev, epnum);
-
-	// If possible we try to handle the data directly in the callback to improve USB speed.
-	tng_try_usb_recv();
+static uint8_t usbd_tfp_data_out(USBD_HandleTypeDef *dev, uint8_t epnum) {
+	// The data was received directly into the OUT buffer,
+	// we only need to arm the endpoint for the next packet.
+	usb_recv_complete(USBD_LL_GetRxDataSize(dev, epnum));
 
 	return USBD_OK;
 }
@@ -25,6 +25,21 @@
 #include <stdint.h>
 
 #ifdef CRC16_USE_MODBUS
+#ifdef CRC16_USE_NIBBLE_TABLE
+// 4-bit table (32 byte) for the reflected polynomial 0xA001
+static const uint16_t crc16_modbus_table[] = {
+	0x0000, 0xCC01, 0xD801, 0x1400, 0xF001, 0x3C00, 0x2800, 0xE401,
+	0xA001, 0x6C00, 0x7800, 0xB401, 0x5000, 0x9C01, 0x8801, 0x4400
+};
+
+static inline uint16_t crc16_modbus_byte(uint16_t crc, const uint8_t value) {
+	crc ^= value;
+	crc = (crc >> 4) ^ crc16_modbus_table[crc & 0x0F];
+	crc = (crc >> 4) ^ crc16_modbus_table[crc & 0x0F];
+
+	return crc;
+}
+#else
 static const uint16_t crc16_modbus_table[] = {
 	0X0000, 0XC0C1, 0XC181, 0X0140, 0XC301, 0X03C0, 0X0280, 0XC241,
 	0XC601, 0X06C0, 0X0780, 0XC741, 0X0500, 0XC5C1, 0XC481, 0X0440,
@@ -60,20 +75,47 @@ static const uint16_t crc16_modbus_table[] = {
 	0X8201, 0X42C0, 0X4380, 0X8341, 0X4100, 0X81C1, 0X8081, 0X4040
 };
 
-uint16_t crc16_modbus(uint8_t *buffer, uint32_t length) {
-	uint16_t crc = 0xFFFF;
+static inline uint16_t crc16_modbus_byte(uint16_t crc, const uint8_t value) {
+	uint8_t tmp = value ^ crc;
+	crc >>= 8;
+	crc ^= crc16_modbus_table[tmp];
+
+	return crc;
+}
+#endif
 
+uint16_t crc16_modbus_update_byte(uint16_t crc, const uint8_t value) {
+	return crc16_modbus_byte(crc, value);
+}
+
+uint16_t crc16_modbus_update(uint16_t crc, const uint8_t *buffer, uint32_t length) {
 	while (length--) {
-		uint8_t tmp = *buffer++ ^ crc;
-		crc >>= 8;
-		crc ^= crc16_modbus_table[tmp];
+		crc = crc16_modbus_byte(crc, *buffer++);
 	}
 
 	return crc;
 }
+
+uint16_t crc16_modbus(uint8_t *buffer, uint32_t length) {
+	return crc16_modbus_final(crc16_modbus_update(crc16_modbus_init(), buffer, length));
+}
 #endif
 
 #ifdef CRC16_USE_CCITT
+#ifdef CRC16_USE_NIBBLE_TABLE
+// 4-bit table (32 byte) for the polynomial 0x1021
+static const uint16_t crc16_ccitt_table[] = {
+	0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50A5, 0x60C6, 0x70E7,
+	0x8108, 0x9129, 0xA14A, 0xB16B, 0xC18C, 0xD1AD, 0xE1CE, 0xF1EF
+};
+
+static inline uint16_t crc16_ccitt_byte(uint16_t crc, const uint8_t value) {
+	crc = (crc << 4) ^ crc16_ccitt_table[((crc >> 12) ^ (value >> 4)) & 0x0F];
+	crc = (crc << 4) ^ crc16_ccitt_table[((crc >> 12) ^ value) & 0x0F];
+
+	return crc;
+}
+#else
 static const uint16_t crc16_ccitt_table[] = {
 	0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50A5, 0x60C6, 0x70E7,
 	0x8108, 0x9129, 0xA14A, 0xB16B, 0xC18C, 0xD1AD, 0xE1CE, 0xF1EF,
@@ -109,26 +151,36 @@ static const uint16_t crc16_ccitt_table[] = {
 	0x6E17, 0x7E36, 0x4E55, 0x5E74, 0x2E93, 0x3EB2, 0x0ED1, 0x1EF0
 };
 
-uint16_t crc16_ccitt_8in(uint8_t *buffer, uint32_t length) {
-    uint16_t crc = 0;
+static inline uint16_t crc16_ccitt_byte(uint16_t crc, const uint8_t value) {
+	return (crc << 8) ^ crc16_ccitt_table[((crc >> 8) ^ value) & 0xFF];
+}
+#endif
 
-    while(length--) {
-        uint8_t value = *buffer++;
-        crc = ((crc << 8) ^  crc16_ccitt_table[((crc >> 8) ^ value) & 0xFF]);
-    }
+uint16_t crc16_ccitt_update_byte(uint16_t crc, const uint8_t value) {
+	return crc16_ccitt_byte(crc, value);
+}
+
+uint16_t crc16_ccitt_update(uint16_t crc, const uint8_t *buffer, uint32_t length) {
+	while(length--) {
+		crc = crc16_ccitt_byte(crc, *buffer++);
+	}
 
-    return crc;
+	return crc;
+}
+
+uint16_t crc16_ccitt_8in(uint8_t *buffer, uint32_t length) {
+    return crc16_ccitt_final(crc16_ccitt_update(crc16_ccitt_init(), buffer, length));
 }
 
 uint16_t crc16_ccitt_16in(uint16_t *buffer, uint32_t length) {
-    uint16_t crc = 0;
+    uint16_t crc = crc16_ccitt_init();
 
     while(length--) {
         uint16_t value = *buffer++;
-        crc = ((crc << 8) ^  crc16_ccitt_table[((crc >> 8) ^ (value >> 8))   & 0xFF]);
-        crc = ((crc << 8) ^  crc16_ccitt_table[((crc >> 8) ^ (value & 0xFF)) & 0xFF]);
+        crc = crc16_ccitt_byte(crc, value >> 8);
+        crc = crc16_ccitt_byte(crc, value & 0xFF);
     }
 
-    return crc;
+    return crc16_ccitt_final(crc);
 }
 #endif
@@ -27,11 +27,39 @@
 
 #include <stdint.h>
 
+// By default the CRCs are calculated with 512 byte tables (one lookup per byte).
+// Define CRC16_USE_NIBBLE_TABLE to use 32 byte tables instead (two lookups per byte),
+// e.g. for bootloaders or other flash constrained firmwares.
+
 #ifdef CRC16_USE_MODBUS
+// Streaming API: crc = crc16_modbus_init(); crc = crc16_modbus_update(crc, ...); ...; crc16_modbus_final(crc).
+// The result is transmitted low byte first. If the received CRC bytes are
+// also fed into the CRC, the result of a valid frame is 0.
+static inline uint16_t crc16_modbus_init(void) {
+	return 0xFFFF;
+}
+
+static inline uint16_t crc16_modbus_final(const uint16_t crc) {
+	return crc;
+}
+
+uint16_t crc16_modbus_update_byte(uint16_t crc, const uint8_t value);
+uint16_t crc16_modbus_update(uint16_t crc, const uint8_t *buffer, uint32_t length);
 uint16_t crc16_modbus(uint8_t *buffer, uint32_t length);
 #endif
 
 #ifdef CRC16_USE_CCITT
+// Streaming API (CRC-16/XMODEM), used the same way as the Modbus variant.
+static inline uint16_t crc16_ccitt_init(void) {
+	return 0x0000;
+}
+
+static inline uint16_t crc16_ccitt_final(const uint16_t crc) {
+	return crc;
+}
+
+uint16_t crc16_ccitt_update_byte(uint16_t crc, const uint8_t value);
+uint16_t crc16_ccitt_update(uint16_t crc, const uint8_t *buffer, uint32_t length);
 uint16_t crc16_ccitt_8in(uint8_t *buffer, uint32_t length);
 uint16_t crc16_ccitt_16in(uint16_t *buffer, uint32_t length);
 #endif
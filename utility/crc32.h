@@ -26,7 +26,16 @@
 #include <stdbool.h>
 #include <stddef.h>
 
+// Note: Before crc32_update was added, crc32_ieee_802_3(_recalculate) hashed the
+// wrong bytes for blocks shorter than 4 bytes that do not end on a word
+// boundary. CRCs stored with the old implementation for such blocks
+// (or for incremental updates with such blocks) do not match anymore.
+uint32_t crc32_update(uint32_t crc, const void *data, size_t length);
 void crc32_ieee_802_3_recalculate(const void *data, size_t length, uint32_t *crc);
 uint32_t crc32_ieee_802_3(const void *data, size_t length);
 
+// Enables the CRC unit with CRC32_USE_HARDWARE on STM32F0, no-op otherwise
+void crc32_init(void);
+bool crc32_check(void);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,93 @@
+#!/usr/bin/env python3
+
+# This program generates the lookup tables of crc32.c (CRC32_SLICE_BY 1, 4
+# and 8). Before printing, the slice-by-n calculation with the generated
+# tables is cross-checked against zlib (binascii.crc32) for random buffers.
+#
+# Usage: ./crc32_table.py > table.txt, then replace the table in crc32.c
+
+import binascii
+import random
+import struct
+import sys
+
+POLYNOMIAL = 0xEDB88320
+
+def generate_table(rows):
+    table = [[0] * 256 for _ in range(rows)]
+
+    for n in range(256):
+        crc = n
+        for _ in range(8):
+            crc = (crc >> 1) ^ POLYNOMIAL if crc & 1 else crc >> 1
+        table[0][n] = crc
+
+    # Row k advances a byte by k additional zero bytes
+    for k in range(1, rows):
+        for n in range(256):
+            prev = table[k - 1][n]
+            table[k][n] = (prev >> 8) ^ table[0][prev & 0xFF]
+
+    return table
+
+# Same order of operations as crc32_update_software in crc32.c (aligned buffer)
+def crc32_slice(table, slice_by, data, crc=0):
+    crc ^= 0xFFFFFFFF
+    pos = 0
+
+    if slice_by == 8:
+        while len(data) - pos >= 8:
+            one, two = struct.unpack_from('<II', data, pos)
+            one ^= crc
+            crc = table[7][one & 0xFF] ^ table[6][(one >> 8) & 0xFF] ^ table[5][(one >> 16) & 0xFF] ^ table[4][one >> 24] ^ \
+                  table[3][two & 0xFF] ^ table[2][(two >> 8) & 0xFF] ^ table[1][(two >> 16) & 0xFF] ^ table[0][two >> 24]
+            pos += 8
+
+    if slice_by >= 4:
+        while len(data) - pos >= 4:
+            one = struct.unpack_from('<I', data, pos)[0] ^ crc
+            crc = table[3][one & 0xFF] ^ table[2][(one >> 8) & 0xFF] ^ table[1][(one >> 16) & 0xFF] ^ table[0][one >> 24]
+            pos += 4
+
+    for b in data[pos:]:
+        crc = table[0][(crc ^ b) & 0xFF] ^ (crc >> 8)
+
+    return crc ^ 0xFFFFFFFF
+
+def check(table):
+    rng = random.Random(0)
+
+    for slice_by in [1, 4, 8]:
+        for length in list(range(64)) + [rng.randrange(64, 4096) for _ in range(64)]:
+            data = bytes(rng.randrange(256) for _ in range(length))
+            split = rng.randrange(length + 1)
+            expected = binascii.crc32(data) & 0xFFFFFFFF
+            crc = crc32_slice(table, slice_by, data[split:], crc32_slice(table, slice_by, data[:split]))
+
+            if crc != expected:
+                sys.exit('CRC mismatch for slice-by-{0}, length {1}: 0x{2:08X} != 0x{3:08X}'.format(slice_by, length, crc, expected))
+
+def print_table(table):
+    print('// Lookup tables for the reflected polynomial 0xEDB88320 (generated by crc32_table.py).')
+    print('// Row 0 is the classic byte table, row n advances a byte by n additional')
+    print('// zero bytes. This allows slice-by-n to process n bytes with n independent lookups.')
+    print('static const uint32_t crc32_table[CRC32_SLICE_BY][256] = {')
+
+    for k, row in enumerate(table):
+        if k == 1:
+            print('#if CRC32_SLICE_BY >= 4')
+        elif k == 4:
+            print('#endif')
+            print('#if CRC32_SLICE_BY >= 8')
+
+        print('\t{')
+        for i in range(0, 256, 8):
+            print('\t\t' + ' '.join('0x{0:08X},'.format(value) for value in row[i:i + 8]))
+        print('\t},')
+
+    print('#endif')
+    print('};')
+
+table = generate_table(8)
+check(table)
+print_table(table)
@@ -0,0 +1,67 @@
+/* bricklib2
+ * Copyright (C) 2026 Olaf Lüke <olaf@tinkerforge.com>
+ *
+ * ema_filter.c: Fixed-point exponential moving average
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include "ema_filter.h"
+
+#include "bricklib2/utility/util_definitions.h"
+
+// Division by 2^shift rounded half away from zero (symmetric for negative
+// values, like moving_average_get), shift of 0 is allowed
+static inline int32_t ema_filter_shift_round(const int64_t value, const uint32_t shift) {
+	if(shift == 0) {
+		return (int32_t)value;
+	}
+
+	// Shift the magnitude only, right shifting a negative value is implementation-defined
+	const uint64_t half = ((uint64_t)1) << (shift - 1);
+	if(value < 0) {
+		return (int32_t)(-(int64_t)((((uint64_t)-value) + half) >> shift));
+	}
+
+	return (int32_t)((((uint64_t)value) + half) >> shift);
+}
+
+int32_t ema_filter_get(const EMAFilter *const ema_filter) {
+	return ema_filter_shift_round(ema_filter->sum, ema_filter->shift);
+}
+
+void ema_filter_new_shift(EMAFilter *const ema_filter, const uint32_t shift) {
+	const uint32_t new_shift = MIN(shift, EMA_FILTER_MAX_SHIFT);
+	if(new_shift == ema_filter->shift) {
+		return;
+	}
+
+	ema_filter_init(ema_filter, ema_filter_get(ema_filter), new_shift);
+}
+
+void ema_filter_init(EMAFilter *const ema_filter, const int32_t start_value, const uint32_t shift) {
+	ema_filter->shift = MIN(shift, EMA_FILTER_MAX_SHIFT);
+	ema_filter->sum   = ((int64_t)start_value) * (((int64_t)1) << ema_filter->shift);
+}
+
+int32_t ema_filter_handle_value(EMAFilter *const ema_filter, const int32_t new_value) {
+	// sum = sum*(1 - alpha) + new_value*alpha, everything scaled by 2^shift.
+	// Subtracting the rounded (instead of truncated) output avoids a bias of
+	// up to one LSB for a constant input.
+	ema_filter->sum += (int64_t)new_value - ema_filter_get(ema_filter);
+
+	return ema_filter_get(ema_filter);
+}
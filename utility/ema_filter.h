@@ -0,0 +1,50 @@
+/* bricklib2
+ * Copyright (C) 2026 Olaf Lüke <olaf@tinkerforge.com>
+ *
+ * ema_filter.h: Fixed-point exponential moving average
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#ifndef EMA_FILTER_H
+#define EMA_FILTER_H
+
+#include "configs/config.h"
+
+#include <stdint.h>
+
+// The filter constant is alpha = 1/2^shift, the time constant is about 2^shift samples.
+// The state is kept with shift fractional bits in an int64_t, so the full int32_t
+// value range can be used with every shift up to EMA_FILTER_MAX_SHIFT.
+#ifndef EMA_FILTER_MAX_SHIFT
+#define EMA_FILTER_MAX_SHIFT 16
+#endif
+
+#ifndef EMA_FILTER_DEFAULT_SHIFT
+#define EMA_FILTER_DEFAULT_SHIFT 4
+#endif
+
+typedef struct {
+	uint32_t shift;
+	int64_t sum; // value * 2^shift
+} EMAFilter;
+
+int32_t ema_filter_get(const EMAFilter *const ema_filter);
+void ema_filter_new_shift(EMAFilter *const ema_filter, const uint32_t shift);
+void ema_filter_init(EMAFilter *const ema_filter, const int32_t start_value, const uint32_t shift);
+int32_t ema_filter_handle_value(EMAFilter *const ema_filter, const int32_t new_value);
+
+#endif
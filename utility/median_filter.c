@@ -0,0 +1,119 @@
+/* bricklib2
+ * Copyright (C) 2026 Olaf Lüke <olaf@tinkerforge.com>
+ *
+ * median_filter.c: Median filter for spike rejection
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include "median_filter.h"
+
+#include "bricklib2/utility/util_definitions.h"
+
+// Rebuild the sorted copy from the values with a full insertion sort
+static void median_filter_sort(MedianFilter *const median_filter) {
+	int32_t *sorted = median_filter->sorted;
+
+	for(uint32_t i = 0; i < median_filter->length; i++) {
+		const int32_t value = median_filter->values[i];
+		uint32_t j = i;
+		while((j > 0) && (sorted[j - 1] > value)) {
+			sorted[j] = sorted[j - 1];
+			j--;
+		}
+		sorted[j] = value;
+	}
+}
+
+int32_t median_filter_get(const MedianFilter *const median_filter) {
+	const uint32_t middle = median_filter->length/2;
+	if(median_filter->length & 1) {
+		return median_filter->sorted[middle];
+	}
+
+	// Average of the two middle values with proper rounding (as in moving_average).
+	// a + (b - a)/2 can not overflow, b - a is non-negative and fits into an uint32_t.
+	const int32_t a = median_filter->sorted[middle - 1];
+	const uint32_t diff = (uint32_t)median_filter->sorted[middle] - (uint32_t)a;
+	const int32_t mean = a + (int32_t)(diff/2);
+
+	// For an odd difference the exact mean is mean + 0.5, round it away from zero
+	if((diff & 1) && (mean >= 0)) {
+		return mean + 1;
+	}
+
+	return mean;
+}
+
+void median_filter_new_length(MedianFilter *const median_filter, const uint32_t length) {
+	const uint32_t new_length = BETWEEN(1, length, MEDIAN_FILTER_MAX_LENGTH);
+	if(new_length == median_filter->length) {
+		return;
+	}
+
+	median_filter_init(median_filter, median_filter_get(median_filter), new_length);
+}
+
+void median_filter_init(MedianFilter *const median_filter, const int32_t start_value, const uint32_t length) {
+	const uint32_t new_length = BETWEEN(1, length, MEDIAN_FILTER_MAX_LENGTH);
+
+	median_filter->index = 0;
+	median_filter->length = new_length;
+
+	for(uint32_t i = 0; i < new_length; i++) {
+		median_filter->values[i] = start_value;
+		median_filter->sorted[i] = start_value;
+	}
+}
+
+int32_t median_filter_handle_value(MedianFilter *const median_filter, const int32_t new_value) {
+	const int32_t old_value = median_filter->values[median_filter->index];
+	median_filter->values[median_filter->index] = new_value;
+
+	median_filter->index = median_filter->index + 1;
+	if(median_filter->index >= median_filter->length) {
+		median_filter->index = 0;
+	}
+
+	// Find the oldest value in the sorted array and move the new value
+	// from there to its sorted position (one insertion sort step).
+	int32_t *sorted = median_filter->sorted;
+	uint32_t i = 0;
+	while((i < median_filter->length) && (sorted[i] != old_value)) {
+		i++;
+	}
+
+	if(i >= median_filter->length) {
+		// The sorted copy does not match the values (e.g. memory corruption),
+		// rebuild it from the values instead of searching out of bounds.
+		median_filter_sort(median_filter);
+		return median_filter_get(median_filter);
+	}
+
+	while((i > 0) && (sorted[i - 1] > new_value)) {
+		sorted[i] = sorted[i - 1];
+		i--;
+	}
+
+	while((i < median_filter->length - 1) && (sorted[i + 1] < new_value)) {
+		sorted[i] = sorted[i + 1];
+		i++;
+	}
+
+	sorted[i] = new_value;
+
+	return median_filter_get(median_filter);
+}
@@ -0,0 +1,52 @@
+/* bricklib2
+ * Copyright (C) 2026 Olaf Lüke <olaf@tinkerforge.com>
+ *
+ * median_filter.h: Median filter for spike rejection
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#ifndef MEDIAN_FILTER_H
+#define MEDIAN_FILTER_H
+
+#include "configs/config.h"
+
+#include <stdint.h>
+
+// Meant for small windows (3-9 values), every new value costs O(length).
+// Odd lengths are recommended, for even lengths the two middle values are averaged.
+#ifndef MEDIAN_FILTER_MAX_LENGTH
+#define MEDIAN_FILTER_MAX_LENGTH 9
+#endif
+
+#ifndef MEDIAN_FILTER_DEFAULT_LENGTH
+#define MEDIAN_FILTER_DEFAULT_LENGTH 5
+#endif
+
+typedef struct {
+	uint32_t length;
+	uint32_t index;
+
+	int32_t values[MEDIAN_FILTER_MAX_LENGTH]; // in order of arrival (ring buffer)
+	int32_t sorted[MEDIAN_FILTER_MAX_LENGTH];
+} MedianFilter;
+
+int32_t median_filter_get(const MedianFilter *const median_filter);
+void median_filter_new_length(MedianFilter *const median_filter, const uint32_t length);
+void median_filter_init(MedianFilter *const median_filter, const int32_t start_value, const uint32_t length);
+int32_t median_filter_handle_value(MedianFilter *const median_filter, const int32_t new_value);
+
+#endif
@@ -0,0 +1,99 @@
+/* bricklib2
+ * Copyright (C) 2026 Olaf Lüke <olaf@tinkerforge.com>
+ *
+ * min_max_filter.c: Running minimum/maximum over a window of values
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include "min_max_filter.h"
+
+#include "bricklib2/utility/util_definitions.h"
+
+static void min_max_filter_scan(MinMaxFilter *const min_max_filter) {
+	min_max_filter->min_max.min = min_max_filter->values[0];
+	min_max_filter->min_max.max = min_max_filter->values[0];
+
+	for(uint32_t i = 1; i < min_max_filter->length; i++) {
+		min_max_filter->min_max.min = MIN(min_max_filter->min_max.min, min_max_filter->values[i]);
+		min_max_filter->min_max.max = MAX(min_max_filter->min_max.max, min_max_filter->values[i]);
+	}
+}
+
+MinMax min_max_filter_get(const MinMaxFilter *const min_max_filter) {
+	return min_max_filter->min_max;
+}
+
+void min_max_filter_new_length(MinMaxFilter *const min_max_filter, const uint32_t length) {
+	const uint32_t new_length = BETWEEN(1, length, MIN_MAX_FILTER_MAX_LENGTH);
+	if(new_length == min_max_filter->length) {
+		return;
+	}
+
+	// Keep the newest values that still fit into the window, fill up with the oldest one
+	int32_t values[MIN_MAX_FILTER_MAX_LENGTH];
+	const uint32_t keep = MIN(new_length, min_max_filter->length);
+	for(uint32_t i = 0; i < keep; i++) {
+		const uint32_t index = (min_max_filter->index + min_max_filter->length - keep + i) % min_max_filter->length;
+		values[new_length - keep + i] = min_max_filter->values[index];
+	}
+
+	for(uint32_t i = 0; i < new_length - keep; i++) {
+		values[i] = values[new_length - keep];
+	}
+
+	for(uint32_t i = 0; i < new_length; i++) {
+		min_max_filter->values[i] = values[i];
+	}
+
+	min_max_filter->index  = 0;
+	min_max_filter->length = new_length;
+	min_max_filter_scan(min_max_filter);
+}
+
+void min_max_filter_init(MinMaxFilter *const min_max_filter, const int32_t start_value, const uint32_t length) {
+	const uint32_t new_length = BETWEEN(1, length, MIN_MAX_FILTER_MAX_LENGTH);
+
+	min_max_filter->index       = 0;
+	min_max_filter->length      = new_length;
+	min_max_filter->min_max.min = start_value;
+	min_max_filter->min_max.max = start_value;
+
+	for(uint32_t i = 0; i < new_length; i++) {
+		min_max_filter->values[i] = start_value;
+	}
+}
+
+MinMax min_max_filter_handle_value(MinMaxFilter *const min_max_filter, const int32_t new_value) {
+	const int32_t old_value = min_max_filter->values[min_max_filter->index];
+	min_max_filter->values[min_max_filter->index] = new_value;
+
+	min_max_filter->index = min_max_filter->index + 1;
+	if(min_max_filter->index >= min_max_filter->length) {
+		min_max_filter->index = 0;
+	}
+
+	if(((old_value == min_max_filter->min_max.min) && (new_value > old_value)) ||
+	   ((old_value == min_max_filter->min_max.max) && (new_value < old_value))) {
+		// The old minimum or maximum left the window
+		min_max_filter_scan(min_max_filter);
+	} else {
+		min_max_filter->min_max.min = MIN(min_max_filter->min_max.min, new_value);
+		min_max_filter->min_max.max = MAX(min_max_filter->min_max.max, new_value);
+	}
+
+	return min_max_filter->min_max;
+}
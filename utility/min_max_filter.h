@@ -0,0 +1,61 @@
+/* bricklib2
+ * Copyright (C) 2026 Olaf Lüke <olaf@tinkerforge.com>
+ *
+ * min_max_filter.h: Running minimum/maximum over a window of values
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#ifndef MIN_MAX_FILTER_H
+#define MIN_MAX_FILTER_H
+
+#include "configs/config.h"
+
+#include <stdint.h>
+
+// Minimum and maximum of exactly the last length values.
+//
+// The values are kept in a ring buffer (as in moving_average) and the
+// current minimum/maximum is cached. A new value costs O(1), except if the
+// value that leaves the window was the minimum or maximum. Then the window
+// is scanned again, which costs O(length).
+#ifndef MIN_MAX_FILTER_MAX_LENGTH
+#define MIN_MAX_FILTER_MAX_LENGTH 100
+#endif
+
+#ifndef MIN_MAX_FILTER_DEFAULT_LENGTH
+#define MIN_MAX_FILTER_DEFAULT_LENGTH 10
+#endif
+
+typedef struct {
+	int32_t min;
+	int32_t max;
+} MinMax;
+
+typedef struct {
+	uint32_t length;
+	uint32_t index;
+
+	MinMax min_max;
+	int32_t values[MIN_MAX_FILTER_MAX_LENGTH];
+} MinMaxFilter;
+
+MinMax min_max_filter_get(const MinMaxFilter *const min_max_filter);
+void min_max_filter_new_length(MinMaxFilter *const min_max_filter, const uint32_t length);
+void min_max_filter_init(MinMaxFilter *const min_max_filter, const int32_t start_value, const uint32_t length);
+MinMax min_max_filter_handle_value(MinMaxFilter *const min_max_filter, const int32_t new_value);
+
+#endif
@@ -31,6 +31,7 @@
 #include "bricklib2/logging/logging.h"
 #include "bricklib2/os/coop_task.h"
 #include "bricklib2/utility/util_definitions.h"
+#include "bricklib2/hal/usic_fifo/usic_fifo.h"
 
 #include <stdint.h>
 
@@ -41,124 +42,62 @@ SDMMC sdmmc;
 #define sdmmc_miso_irq_handler IRQ_Hdlr_11
 #define sdmmc_mosi_irq_handler IRQ_Hdlr_12
 
-uint8_t sdmmc_spi_buffer[512] = {0};
-volatile uint16_t sdmmc_spi_miso_index  = 0;
-volatile uint16_t sdmmc_spi_mosi_index  = 0;
-volatile uint16_t sdmmc_spi_data_length = 0;
+static USICFifo sdmmc_usic_fifo;
 
 void __attribute__((optimize("-O3"))) __attribute__ ((section (".ram_code"))) sdmmc_miso_irq_handler(void) {
-	const uint8_t amount = XMC_USIC_CH_RXFIFO_GetLevel(SDMMC_USIC);
-
-#pragma GCC diagnostic push
-#pragma GCC diagnostic ignored "-Wimplicit-fallthrough"
-	switch(amount) {
-		case 16: sdmmc_spi_buffer[sdmmc_spi_miso_index++] = SDMMC_USIC->OUTR;
-		case 15: sdmmc_spi_buffer[sdmmc_spi_miso_index++] = SDMMC_USIC->OUTR;
-		case 14: sdmmc_spi_buffer[sdmmc_spi_miso_index++] = SDMMC_USIC->OUTR;
-		case 13: sdmmc_spi_buffer[sdmmc_spi_miso_index++] = SDMMC_USIC->OUTR;
-		case 12: sdmmc_spi_buffer[sdmmc_spi_miso_index++] = SDMMC_USIC->OUTR;
-		case 11: sdmmc_spi_buffer[sdmmc_spi_miso_index++] = SDMMC_USIC->OUTR;
-		case 10: sdmmc_spi_buffer[sdmmc_spi_miso_index++] = SDMMC_USIC->OUTR;
-		case  9: sdmmc_spi_buffer[sdmmc_spi_miso_index++] = SDMMC_USIC->OUTR;
-		case  8: sdmmc_spi_buffer[sdmmc_spi_miso_index++] = SDMMC_USIC->OUTR;
-		case  7: sdmmc_spi_buffer[sdmmc_spi_miso_index++] = SDMMC_USIC->OUTR;
-		case  6: sdmmc_spi_buffer[sdmmc_spi_miso_index++] = SDMMC_USIC->OUTR;
-		case  5: sdmmc_spi_buffer[sdmmc_spi_miso_index++] = SDMMC_USIC->OUTR;
-		case  4: sdmmc_spi_buffer[sdmmc_spi_miso_index++] = SDMMC_USIC->OUTR;
-		case  3: sdmmc_spi_buffer[sdmmc_spi_miso_index++] = SDMMC_USIC->OUTR;
-		case  2: sdmmc_spi_buffer[sdmmc_spi_miso_index++] = SDMMC_USIC->OUTR;
-		case  1: sdmmc_spi_buffer[sdmmc_spi_miso_index++] = SDMMC_USIC->OUTR;
-	}
-#pragma GCC diagnostic pop
+	usic_fifo_irq_handler(&sdmmc_usic_fifo);
 }
 
 void __attribute__((optimize("-O3"))) __attribute__ ((section (".ram_code"))) sdmmc_mosi_irq_handler(void) {
-	// Use local pointer to save the time for accessing the struct
-	volatile uint32_t *SDMMC_USIC_IN_PTR = SDMMC_USIC->IN;
-
-	const uint16_t to_send    = sdmmc_spi_data_length - sdmmc_spi_mosi_index;
-	const uint8_t  fifo_level = MIN(16 - XMC_USIC_CH_TXFIFO_GetLevel(SDMMC_USIC), 16 - XMC_USIC_CH_RXFIFO_GetLevel(SDMMC_USIC));
-	const uint8_t  amount     = MIN(to_send, fifo_level);
-#pragma GCC diagnostic push
-#pragma GCC diagnostic ignored "-Wimplicit-fallthrough"
-	switch(amount) {
-		case 16: SDMMC_USIC_IN_PTR[0] = sdmmc_spi_buffer[sdmmc_spi_mosi_index++];
-		case 15: SDMMC_USIC_IN_PTR[0] = sdmmc_spi_buffer[sdmmc_spi_mosi_index++];
-		case 14: SDMMC_USIC_IN_PTR[0] = sdmmc_spi_buffer[sdmmc_spi_mosi_index++];
-		case 13: SDMMC_USIC_IN_PTR[0] = sdmmc_spi_buffer[sdmmc_spi_mosi_index++];
-		case 12: SDMMC_USIC_IN_PTR[0] = sdmmc_spi_buffer[sdmmc_spi_mosi_index++];
-		case 11: SDMMC_USIC_IN_PTR[0] = sdmmc_spi_buffer[sdmmc_spi_mosi_index++];
-		case 10: SDMMC_USIC_IN_PTR[0] = sdmmc_spi_buffer[sdmmc_spi_mosi_index++];
-		case  9: SDMMC_USIC_IN_PTR[0] = sdmmc_spi_buffer[sdmmc_spi_mosi_index++];
-		case  8: SDMMC_USIC_IN_PTR[0] = sdmmc_spi_buffer[sdmmc_spi_mosi_index++];
-		case  7: SDMMC_USIC_IN_PTR[0] = sdmmc_spi_buffer[sdmmc_spi_mosi_index++];
-		case  6: SDMMC_USIC_IN_PTR[0] = sdmmc_spi_buffer[sdmmc_spi_mosi_index++];
-		case  5: SDMMC_USIC_IN_PTR[0] = sdmmc_spi_buffer[sdmmc_spi_mosi_index++];
-		case  4: SDMMC_USIC_IN_PTR[0] = sdmmc_spi_buffer[sdmmc_spi_mosi_index++];
-		case  3: SDMMC_USIC_IN_PTR[0] = sdmmc_spi_buffer[sdmmc_spi_mosi_index++];
-		case  2: SDMMC_USIC_IN_PTR[0] = sdmmc_spi_buffer[sdmmc_spi_mosi_index++];
-		case  1: SDMMC_USIC_IN_PTR[0] = sdmmc_spi_buffer[sdmmc_spi_mosi_index++];
-	}
-#pragma GCC diagnostic pop
-
-	if(sdmmc_spi_mosi_index >= sdmmc_spi_data_length) {
-		XMC_USIC_CH_TXFIFO_DisableEvent(SDMMC_USIC, XMC_USIC_CH_TXFIFO_EVENT_CONF_STANDARD);
-	}
+	// The transfer is completely driven by the RX FIFO event, the TX event is not used
+	XMC_USIC_CH_TXFIFO_DisableEvent(SDMMC_USIC, XMC_USIC_CH_TXFIFO_EVENT_CONF_STANDARD);
 }
 
-bool sdmmc_spi_transceive_async(const uint8_t *data_mosi, uint8_t *data_miso, uint32_t length) {
-	bool ret = true;
+static bool sdmmc_spi_transceive_async_chunk(const uint8_t *data_mosi, uint8_t *data_miso, uint16_t length) {
+	// MOSI NULL: send 0xFF, MISO NULL: throw away received data
+	const USICFifoDescriptor descriptor = {
+		.mosi   = data_mosi,
+		.miso   = data_miso,
+		.length = length,
+		.next   = NULL
+	};
 
 	uint32_t start = system_timer_get_ms();
-	if(data_mosi) {
-		memcpy(sdmmc_spi_buffer, data_mosi, length);
-	} else {
-		memset(sdmmc_spi_buffer, 0xFF, length);
-	}
-	sdmmc_spi_miso_index  = 0;
-	sdmmc_spi_mosi_index  = 0;
-	sdmmc_spi_data_length = length;
-
-	XMC_USIC_CH_RXFIFO_EnableEvent(SDMMC_USIC, XMC_USIC_CH_RXFIFO_EVENT_CONF_STANDARD | XMC_USIC_CH_RXFIFO_EVENT_CONF_ALTERNATE);
-	XMC_USIC_CH_TXFIFO_EnableEvent(SDMMC_USIC, XMC_USIC_CH_TXFIFO_EVENT_CONF_STANDARD);
-	XMC_USIC_CH_TriggerServiceRequest(SDMMC_USIC, SDMMC_SERVICE_REQUEST_TX);
+	usic_fifo_start(&sdmmc_usic_fifo, &descriptor, NULL, NULL);
 
 	uint32_t yield_count = 0;
-	while((sdmmc_spi_miso_index < sdmmc_spi_data_length) || (sdmmc_spi_mosi_index < sdmmc_spi_data_length)) {
+	while(!usic_fifo_is_done(&sdmmc_usic_fifo)) {
 		coop_task_yield();
 
-		// Read rx FIFO by hand if there is 8 or less bytes left to read (the IRQ is only triggered when level goes from 8 to 9)
-		if(sdmmc_spi_data_length - sdmmc_spi_miso_index <= 8) {
-			XMC_USIC_CH_RXFIFO_DisableEvent(SDMMC_USIC, XMC_USIC_CH_RXFIFO_EVENT_CONF_STANDARD | XMC_USIC_CH_RXFIFO_EVENT_CONF_ALTERNATE);
-			sdmmc_miso_irq_handler();
-			XMC_USIC_CH_RXFIFO_EnableEvent(SDMMC_USIC, XMC_USIC_CH_RXFIFO_EVENT_CONF_STANDARD | XMC_USIC_CH_RXFIFO_EVENT_CONF_ALTERNATE);
-		}
-
-		// Trigger TX IRQ if the FIFO has less than 8 bytes left. If we missed on IRQ trigger it will not trigger otherwise.
-		if(XMC_USIC_CH_TXFIFO_GetLevel(SDMMC_USIC) < 8) {
-			XMC_USIC_CH_TriggerServiceRequest(SDMMC_USIC, SDMMC_SERVICE_REQUEST_TX);
-		}
-
 		yield_count++;
 		if(system_timer_is_time_elapsed_ms(start, SDMMC_RESPONSE_TIMEOUT)) {
-			logw("sdmmc_spi_transceive_async timeout miso %d, mosi %d, len %d, yield count %d\n\r", sdmmc_spi_miso_index, sdmmc_spi_mosi_index, sdmmc_spi_data_length, yield_count);
-			ret = false;
-			break;
+			logw("sdmmc_spi_transceive_async timeout in flight %d, len %d, yield count %d\n\r", sdmmc_usic_fifo.in_flight, length, yield_count);
+			usic_fifo_abort(&sdmmc_usic_fifo);
+			return false;
 		}
 	}
 
-	XMC_USIC_CH_TXFIFO_DisableEvent(SDMMC_USIC, XMC_USIC_CH_TXFIFO_EVENT_CONF_STANDARD);
-	XMC_USIC_CH_RXFIFO_DisableEvent(SDMMC_USIC, XMC_USIC_CH_RXFIFO_EVENT_CONF_STANDARD | XMC_USIC_CH_RXFIFO_EVENT_CONF_ALTERNATE);
+	return true;
+}
 
-	if(data_miso) {
-		memcpy(data_miso, sdmmc_spi_buffer, length);
-	}
+// A descriptor can hold at most UINT16_MAX bytes, longer transfers are split
+bool sdmmc_spi_transceive_async(const uint8_t *data_mosi, uint8_t *data_miso, uint32_t length) {
+	while(length > 0) {
+		const uint16_t chunk = MIN(length, UINT16_MAX);
+		if(!sdmmc_spi_transceive_async_chunk(data_mosi, data_miso, chunk)) {
+			return false;
+		}
 
-	sdmmc_spi_miso_index  = 0;
-	sdmmc_spi_mosi_index  = 0;
-	sdmmc_spi_data_length = 0;
+		if(data_mosi != NULL) {
+			data_mosi += chunk;
+		}
+		if(data_miso != NULL) {
+			data_miso += chunk;
+		}
+		length -= chunk;
+	}
 
-	return ret;
+	return true;
 }
 
 bool sdmmc_spi_write(const uint8_t *data, uint32_t length) {
@@ -324,6 +263,8 @@ void sdmmc_spi_init(const uint32_t baudrate) {
 	// Configure receive FIFO
 	XMC_USIC_CH_RXFIFO_Configure(SDMMC_USIC, SDMMC_RX_FIFO_DATA_POINTER, SDMMC_RX_FIFO_SIZE, 8);
 
+	usic_fifo_init(&sdmmc_usic_fifo, SDMMC_USIC, SDMMC_TX_FIFO_SIZE, SDMMC_RX_FIFO_SIZE);
+
 	// Set service request for tx FIFO transmit interrupt
 	XMC_USIC_CH_TXFIFO_SetInterruptNodePointer(SDMMC_USIC, XMC_USIC_CH_TXFIFO_INTERRUPT_NODE_POINTER_STANDARD, SDMMC_SERVICE_REQUEST_TX);  // IRQ SDMMC_IRQ_TX
 